@@ -0,0 +1,86 @@
+// Arduino.h  (native)
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "WString.h"
+#include "NativeHal.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT           0x01
+#define OUTPUT          0x03
+#define PULLUP          0x04
+#define INPUT_PULLUP    0x05
+#define PULLDOWN        0x08
+#define INPUT_PULLDOWN  0x09
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+// Timing
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+// Random, deterministic unless randomSeed() is called
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+// GPIO
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+// LEDC
+double ledcSetup(uint8_t channel, double freq, uint8_t resolution_bits);
+void ledcAttachPin(uint8_t pin, uint8_t channel);
+void ledcDetachPin(uint8_t pin);
+void ledcWrite(uint8_t channel, uint32_t duty);
+
+/*
+    Serial console. Output goes to stdout while sim::hw().serialEcho is set.
+*/
+class HardwareSerial {
+public:
+    void begin(unsigned long) {}
+    operator bool() const { return true; }
+
+    size_t print(const String &s)           { return write(s.c_str()); }
+    size_t print(const char *s)             { return write(s); }
+    size_t print(char c)                    { char b[2] = {c, 0}; return write(b); }
+    size_t print(int n, int base = 10)      { return print(String(n, base)); }
+    size_t print(unsigned int n, int base = 10)  { return print(String(n, base)); }
+    size_t print(long n, int base = 10)     { return print(String(n, base)); }
+    size_t print(unsigned long n, int base = 10) { return print(String(n, base)); }
+    size_t print(double n, int digits = 2)  { return print(String(n, digits)); }
+
+    size_t println()                        { return write("\n"); }
+    template <typename T>
+    size_t println(const T &value)          { size_t n = print(value); return n + println(); }
+    template <typename T>
+    size_t println(const T &value, int fmt) { size_t n = print(value, fmt); return n + println(); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+private:
+    size_t write(const char *s);
+};
+
+extern HardwareSerial Serial;
+
+#endif // NATIVE_ARDUINO_H
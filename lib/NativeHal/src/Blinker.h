@@ -0,0 +1,42 @@
+// Blinker.h  (native)
+#ifndef NATIVE_BLINKER_H
+#define NATIVE_BLINKER_H
+
+#include "Arduino.h"
+
+/*
+    majenkolibraries/Blinker: toggles an LED pin with separate on / off times.
+*/
+class Blinker {
+public:
+    explicit Blinker(uint8_t pin)
+        : pin(pin), onTime(500), offTime(500), lastChange(0), state(false), running(false) {}
+
+    void start() { pinMode(pin, OUTPUT); running = true; lastChange = millis(); }
+    void stop() { running = false; state = false; digitalWrite(pin, LOW); }
+
+    void setDelay(uint32_t d) { onTime = d; offTime = d; }
+    void setDelay(uint32_t on, uint32_t off) { onTime = on; offTime = off; }
+
+    void blink() {
+        if (!running) return;
+        uint32_t period = state ? onTime : offTime;
+        if (millis() - lastChange >= period) {
+            lastChange = millis();
+            state = !state;
+            if (state && onTime == 0) state = false;
+            if (!state && offTime == 0) state = true;
+            digitalWrite(pin, state ? HIGH : LOW);
+        }
+    }
+
+private:
+    uint8_t  pin;
+    uint32_t onTime;
+    uint32_t offTime;
+    uint32_t lastChange;
+    bool     state;
+    bool     running;
+};
+
+#endif // NATIVE_BLINKER_H
@@ -0,0 +1,47 @@
+// DallasTemperature.h  (native)
+#ifndef NATIVE_DALLAS_TEMPERATURE_H
+#define NATIVE_DALLAS_TEMPERATURE_H
+
+#include <cstdint>
+#include "OneWire.h"
+
+#define DEVICE_DISCONNECTED_C -127
+
+typedef uint8_t DeviceAddress[8];
+
+/*
+    One simulated DS18B20 on the bus. Conversion time follows the datasheet
+    (94 ms at 9 bit up to 750 ms at 12 bit). In blocking mode
+    requestTemperatures() burns that time on the virtual clock, exactly like
+    the real library spinning in delay().
+*/
+class DallasTemperature {
+public:
+    explicit DallasTemperature(OneWire *wire)
+        : wire(wire), resolution(12), waitForConversion(true), conversionStart(0), converting(false) {}
+
+    void begin() {}
+    uint8_t getDeviceCount();
+
+    void setResolution(uint8_t bits);
+    uint8_t getResolution() const { return resolution; }
+
+    void setWaitForConversion(bool wait) { waitForConversion = wait; }
+    bool getWaitForConversion() const { return waitForConversion; }
+
+    void requestTemperatures();
+    bool isConversionComplete();
+    int16_t millisToWaitForConversion(uint8_t bits) const;
+    int16_t millisToWaitForConversion() const { return millisToWaitForConversion(resolution); }
+
+    float getTempCByIndex(uint8_t index);
+
+private:
+    OneWire *wire;
+    uint8_t  resolution;
+    bool     waitForConversion;
+    uint32_t conversionStart;
+    bool     converting;
+};
+
+#endif // NATIVE_DALLAS_TEMPERATURE_H
@@ -0,0 +1,10 @@
+// ESPUI.h  (native)
+#ifndef NATIVE_ESPUI_H
+#define NATIVE_ESPUI_H
+
+/*
+    The web UI lives in main.cpp, which is not part of the host build.
+    Battery.h only needs the header to resolve.
+*/
+
+#endif // NATIVE_ESPUI_H
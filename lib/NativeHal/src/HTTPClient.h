@@ -0,0 +1,20 @@
+// HTTPClient.h  (native)
+#ifndef NATIVE_HTTPCLIENT_H
+#define NATIVE_HTTPCLIENT_H
+
+#include "WString.h"
+#include "WiFiClient.h"
+
+/*
+    No outbound HTTP from the host; every request fails.
+*/
+class HTTPClient {
+public:
+    bool begin(WiFiClient &client, const String &url) { return false; }
+    void addHeader(const String &name, const String &value) {}
+    int POST(const String &payload) { return -1; }
+    String getString() { return String(); }
+    void end() {}
+};
+
+#endif // NATIVE_HTTPCLIENT_H
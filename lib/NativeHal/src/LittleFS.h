@@ -0,0 +1,65 @@
+// LittleFS.h  (native)
+#ifndef NATIVE_LITTLEFS_H
+#define NATIVE_LITTLEFS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+/*
+    LittleFS partition in memory: path -> bytes, shared by every handle like
+    the real file system. Writes land at once, flush() only counts, so a test
+    tears a record with sim::fsTruncate() rather than by losing a cache.
+    The files survive a new Journal / Battery, sim::reset() wipes them.
+*/
+class File {
+public:
+    File() : isOpen(false), pos(0), append(false), writable(false) {}
+
+    explicit operator bool() const { return isOpen; }
+
+    size_t write(const uint8_t *buf, size_t len);
+    size_t read(uint8_t *buf, size_t len);
+    bool seek(uint32_t position);
+    size_t position() const { return pos; }
+    size_t size() const;
+    int available() const { return int(size() - pos); }
+    void flush();
+    void close() { isOpen = false; }
+
+private:
+    friend class LittleFSFS;
+    std::string path;           // looked up per call, a wiped partition fails cleanly
+    bool        isOpen;
+    size_t      pos;
+    bool        append;
+    bool        writable;
+};
+
+class LittleFSFS {
+public:
+    bool begin(bool formatOnFail = false, const char *basePath = "/littlefs",
+               uint8_t maxOpenFiles = 10, const char *partitionLabel = "spiffs");
+    void end();
+    bool format();
+
+    File open(const char *path, const char *mode = FILE_READ);
+    bool exists(const char *path);
+    bool remove(const char *path);
+    bool rename(const char *from, const char *to);
+    bool mkdir(const char *path);
+
+    size_t totalBytes();
+    size_t usedBytes();
+
+private:
+    bool mounted = false;
+};
+
+extern LittleFSFS LittleFS;
+
+#endif // NATIVE_LITTLEFS_H
@@ -0,0 +1,897 @@
+// NativeHal.cpp
+#include "NativeHal.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <map>
+#include <thread>
+
+#include "Arduino.h"
+#include "esp_adc_cal.h"
+#include "Preferences.h"
+#include "DallasTemperature.h"
+#include "QuickPID.h"
+#include "PubSubClient.h"
+#include "WiFi.h"
+#include "LittleFS.h"
+
+HardwareSerial Serial;
+WiFiClass WiFi;
+LittleFSFS LittleFS;
+
+namespace {
+
+typedef std::chrono::steady_clock steadyClock;
+
+steadyClock::time_point epoch = steadyClock::now();
+
+// namespace -> key -> raw value bytes
+std::map<std::string, std::map<std::string, std::string>> nvs;
+
+// LittleFS path -> contents
+std::map<std::string, std::string> files;
+
+sim::Hardware makeHardware() {
+    sim::Hardware h = {};
+    h.frozen = false;
+    for (uint8_t i = 0; i < sim::PIN_COUNT; i++) h.input[i] = -1;
+    for (uint8_t i = 0; i < sim::LEDC_CHANNELS; i++) h.ledcPin[i] = -1;
+    h.temperature = 20.0f;
+    h.wifiConnected = true;
+    h.wifiInRange = true;
+    const uint8_t bssid[6] = {0x24, 0x0a, 0xc4, 0x5e, 0x10, 0x01};
+    memcpy(h.wifiBssid, bssid, sizeof(bssid));
+    h.wifiChannel = 6;
+    h.wifiLease[0] = IPAddress(192, 168, 1, 50);
+    h.wifiLease[1] = IPAddress(192, 168, 1, 1);
+    h.wifiLease[2] = IPAddress(255, 255, 255, 0);
+    h.wifiLease[3] = IPAddress(192, 168, 1, 1);
+    h.wifiScanMs = 2200;
+    h.wifiAssocMs = 150;
+    h.wifiDhcpMs = 1000;
+    h.brokerOnline = true;
+    h.recordPublishes = true;
+    h.serialEcho = true;
+    h.fsTotal = 0x160000;
+    return h;
+}
+
+sim::Hardware hardware = makeHardware();
+
+PubSubClient *subscriber = nullptr;
+
+// adc_digi_* driver, the DMA produces sample_freq_hz samples per second of sim time
+struct {
+    bool        installed;
+    bool        running;
+    bool        overflow;
+    uint32_t    bufSamples;
+    uint32_t    rateHz;
+    uint8_t     channel;
+    uint64_t    startUs;
+    uint64_t    taken;          // samples since adc_digi_start() already read or dropped
+} adcDigi = {};
+
+} // namespace
+
+namespace sim {
+
+Hardware& hw() {
+    return hardware;
+}
+
+void reset() {
+    hardware = makeHardware();
+    subscriber = nullptr;
+    epoch = steadyClock::now();
+    nvs.clear();
+    files.clear();
+    LittleFS.end();
+    WiFi = WiFiClass();
+}
+
+void freezeClock(bool frozen) {
+    // keep time continuous across the switch
+    uint64_t now = micros();
+    hardware.frozen = frozen;
+    epoch = steadyClock::now();
+    hardware.offsetUs = now;
+}
+
+// The WiFi driver task: finish a pending association once its time has come
+static void pollWifi() {
+    if (!hardware.wifiJoinAtUs || micros() < hardware.wifiJoinAtUs) return;
+    hardware.wifiJoinAtUs = 0;
+    hardware.wifiConnected = true;
+    WiFi.dispatch(ARDUINO_EVENT_WIFI_STA_GOT_IP);
+}
+
+void advanceMillis(uint32_t ms) {
+    hardware.offsetUs += uint64_t(ms) * 1000;
+    pollWifi();
+}
+
+void advanceMicros(uint32_t us) {
+    hardware.offsetUs += us;
+    pollWifi();
+}
+
+void setAdcRaw(uint8_t channel, int raw) {
+    if (channel < ADC_CHANNELS) hardware.adcRaw[channel] = raw;
+}
+
+void setAdcSpikes(uint32_t every, int raw) {
+    hardware.adcSpikeEvery = every;
+    hardware.adcSpikeRaw = raw;
+}
+
+void setTemperature(float celsius) {
+    hardware.temperature = celsius;
+}
+
+void setPinInput(uint8_t pin, int level) {
+    if (pin < PIN_COUNT) hardware.input[pin] = level;
+}
+
+void setWifiConnected(bool connected) {
+    if (hardware.wifiConnected == connected) return;
+    hardware.wifiConnected = connected;
+    hardware.wifiJoinAtUs = 0;
+    WiFi.dispatch(connected ? ARDUINO_EVENT_WIFI_STA_GOT_IP : ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+}
+
+void setBrokerOnline(bool online) {
+    hardware.brokerOnline = online;
+}
+
+void setSerialEcho(bool echo) {
+    hardware.serialEcho = echo;
+}
+
+void clearNvs() {
+    nvs.clear();
+}
+
+std::string *fsFile(const char *path) {
+    auto it = files.find(path);
+    return it == files.end() ? nullptr : &it->second;
+}
+
+void fsTruncate(const char *path, size_t size) {
+    auto it = files.find(path);
+    if (it != files.end() && size < it->second.size()) it->second.resize(size);
+}
+
+} // namespace sim
+
+/*
+    Timing
+*/
+unsigned long micros() {
+    uint64_t us = hardware.offsetUs;
+    if (!hardware.frozen) {
+        us += std::chrono::duration_cast<std::chrono::microseconds>(steadyClock::now() - epoch).count();
+    }
+    return static_cast<unsigned long>(static_cast<uint32_t>(us));
+}
+
+unsigned long millis() {
+    uint64_t us = hardware.offsetUs;
+    if (!hardware.frozen) {
+        us += std::chrono::duration_cast<std::chrono::microseconds>(steadyClock::now() - epoch).count();
+    }
+    return static_cast<unsigned long>(static_cast<uint32_t>(us / 1000));
+}
+
+void delay(uint32_t ms) {
+    sim::advanceMillis(ms);
+}
+
+void delayMicroseconds(uint32_t us) {
+    sim::advanceMicros(us);
+}
+
+void yield() {}
+
+long random(long howbig) {
+    return howbig > 0 ? rand() % howbig : 0;
+}
+
+long random(long howsmall, long howbig) {
+    return howsmall < howbig ? howsmall + random(howbig - howsmall) : howsmall;
+}
+
+void randomSeed(unsigned long seed) {
+    srand(seed);
+}
+
+/*
+    FreeRTOS
+*/
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                                   void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask,
+                                   BaseType_t xCoreID) {
+    std::thread(pvTaskCode, pvParameters).detach();
+    if (pvCreatedTask) *pvCreatedTask = nullptr;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete) {}
+
+TickType_t xTaskGetTickCount() {
+    return millis();
+}
+
+void vTaskDelay(TickType_t xTicksToDelay) {
+    TickType_t start = xTaskGetTickCount();
+    while (xTaskGetTickCount() - start < xTicksToDelay) std::this_thread::yield();
+}
+
+void vTaskDelayUntil(TickType_t *pxPreviousWakeTime, TickType_t xTimeIncrement) {
+    *pxPreviousWakeTime += xTimeIncrement;
+    while (int32_t(xTaskGetTickCount() - *pxPreviousWakeTime) < 0) std::this_thread::yield();
+}
+
+BaseType_t xPortGetCoreID() {
+    return 0;
+}
+
+/*
+    GPIO
+*/
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin < sim::PIN_COUNT) hardware.mode[pin] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    if (pin >= sim::PIN_COUNT) return;
+    uint8_t level = val ? HIGH : LOW;
+    if (hardware.level[pin] != level) hardware.toggles[pin]++;
+    hardware.level[pin] = level;
+}
+
+int digitalRead(uint8_t pin) {
+    if (pin >= sim::PIN_COUNT) return LOW;
+    if (hardware.input[pin] >= 0) return hardware.input[pin];
+    if (hardware.mode[pin] == INPUT_PULLUP) return HIGH;
+    return hardware.level[pin];
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode) {
+    if (gpio_num >= sim::PIN_COUNT) return ESP_FAIL;
+    hardware.mode[gpio_num] = mode == GPIO_MODE_OUTPUT ? OUTPUT : INPUT;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+    if (gpio_num >= sim::PIN_COUNT) return ESP_FAIL;
+    digitalWrite(gpio_num, level);
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num) {
+    return digitalRead(gpio_num);
+}
+
+/*
+    LEDC
+*/
+double ledcSetup(uint8_t channel, double freq, uint8_t resolution_bits) {
+    return channel < sim::LEDC_CHANNELS ? freq : 0;
+}
+
+void ledcAttachPin(uint8_t pin, uint8_t channel) {
+    if (channel < sim::LEDC_CHANNELS) hardware.ledcPin[channel] = pin;
+}
+
+void ledcDetachPin(uint8_t pin) {
+    for (uint8_t i = 0; i < sim::LEDC_CHANNELS; i++) {
+        if (hardware.ledcPin[i] == pin) hardware.ledcPin[i] = -1;
+    }
+}
+
+void ledcWrite(uint8_t channel, uint32_t duty) {
+    if (channel < sim::LEDC_CHANNELS) hardware.ledcDuty[channel] = duty;
+}
+
+/*
+    ADC1
+*/
+esp_err_t adc1_config_width(adc_bits_width_t width_bit) {
+    return ESP_OK;
+}
+
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten) {
+    return channel < ADC1_CHANNEL_MAX ? ESP_OK : ESP_FAIL;
+}
+
+int adc1_get_raw(adc1_channel_t channel) {
+    if (channel >= ADC1_CHANNEL_MAX) return -1;
+    hardware.adcReads++;
+    return constrain(hardware.adcRaw[channel], 0, 4095);
+}
+
+esp_adc_cal_value_t esp_adc_cal_characterize(adc_unit_t adc_num, adc_atten_t atten, adc_bits_width_t bit_width,
+                                             uint32_t default_vref, esp_adc_cal_characteristics_t *chars) {
+    chars->adc_num = adc_num;
+    chars->atten = atten;
+    chars->bit_width = bit_width;
+    chars->vref = default_vref;
+    chars->coeff_a = uint32_t((3100.0 * default_vref / 1100.0) * 65536.0 / 4095.0);
+    chars->coeff_b = 0;
+    return ESP_ADC_CAL_VAL_DEFAULT_VREF;
+}
+
+esp_err_t adc_digi_initialize(const adc_digi_init_config_t *init_config) {
+    if (!init_config || adcDigi.installed) return ESP_ERR_INVALID_STATE;
+    adcDigi.installed = true;
+    adcDigi.bufSamples = init_config->max_store_buf_size / SOC_ADC_DIGI_RESULT_BYTES;
+    return ESP_OK;
+}
+
+esp_err_t adc_digi_controller_configure(const adc_digi_configuration_t *config) {
+    if (!adcDigi.installed) return ESP_ERR_INVALID_STATE;
+    if (!config || config->pattern_num != 1 || config->sample_freq_hz == 0) return ESP_ERR_INVALID_ARG;
+    adcDigi.rateHz = config->sample_freq_hz;
+    adcDigi.channel = config->adc_pattern[0].channel;
+    return ESP_OK;
+}
+
+esp_err_t adc_digi_start(void) {
+    if (!adcDigi.installed || !adcDigi.rateHz) return ESP_ERR_INVALID_STATE;
+    if (hardware.adcDmaFails) return ESP_FAIL;
+    adcDigi.running = true;
+    adcDigi.overflow = false;
+    adcDigi.startUs = micros();
+    adcDigi.taken = 0;
+    return ESP_OK;
+}
+
+esp_err_t adc_digi_stop(void) {
+    adcDigi.running = false;
+    return ESP_OK;
+}
+
+esp_err_t adc_digi_read_bytes(uint8_t *buf, uint32_t length_max, uint32_t *out_length, uint32_t timeout_ms) {
+    *out_length = 0;
+    if (!adcDigi.installed) return ESP_ERR_INVALID_STATE;
+
+    uint64_t produced = adcDigi.running ? (micros() - adcDigi.startUs) * adcDigi.rateHz / 1000000 : adcDigi.taken;
+    if (produced - adcDigi.taken > adcDigi.bufSamples) {
+        adcDigi.taken = produced - adcDigi.bufSamples;      // the ring buffer dropped the rest
+        adcDigi.overflow = true;
+        hardware.adcOverruns++;
+    }
+
+    uint32_t n = std::min<uint64_t>(produced - adcDigi.taken, length_max / 4 * 4 / SOC_ADC_DIGI_RESULT_BYTES);
+    if (n == 0) return ESP_ERR_TIMEOUT;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t index = adcDigi.taken + i;
+        int raw = hardware.adcRaw[adcDigi.channel];
+        if (hardware.adcNoise) raw += int(index * 7919 % (2 * hardware.adcNoise + 1)) - hardware.adcNoise;
+        if (hardware.adcSpikeEvery && index % hardware.adcSpikeEvery == hardware.adcSpikeEvery - 1) raw = hardware.adcSpikeRaw;
+
+        adc_digi_output_data_t frame;
+        frame.type1.data = constrain(raw, 0, 4095);
+        frame.type1.channel = adcDigi.channel;
+        memcpy(buf + i * SOC_ADC_DIGI_RESULT_BYTES, &frame, SOC_ADC_DIGI_RESULT_BYTES);
+    }
+    adcDigi.taken += n;
+    hardware.adcSamples += n;
+    *out_length = n * SOC_ADC_DIGI_RESULT_BYTES;
+
+    if (adcDigi.overflow) {
+        adcDigi.overflow = false;
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t adc_digi_deinitialize(void) {
+    adcDigi = {};
+    return ESP_OK;
+}
+
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t adc_reading, const esp_adc_cal_characteristics_t *chars) {
+    return ((uint64_t(chars->coeff_a) * adc_reading + 32768) >> 16) + chars->coeff_b;
+}
+
+/*
+    Serial
+*/
+size_t HardwareSerial::write(const char *s) {
+    size_t n = strlen(s);
+    if (hardware.serialEcho) fwrite(s, 1, n, stdout);
+    return n;
+}
+
+size_t HardwareSerial::printf(const char *format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n < 0) return 0;
+    return write(buf);
+}
+
+/*
+    Preferences
+*/
+bool Preferences::begin(const char *name, bool readOnly, const char *partition_label) {
+    if (started) return false;
+    started = true;
+    this->readOnly = readOnly;
+    ns = name;
+    return true;
+}
+
+void Preferences::end() {
+    started = false;
+}
+
+bool Preferences::clear() {
+    if (!started || readOnly) return false;
+    nvs[ns].clear();
+    hardware.nvsWrites++;
+    return true;
+}
+
+bool Preferences::remove(const char *key) {
+    if (!started || readOnly) return false;
+    hardware.nvsWrites++;
+    return nvs[ns].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char *key) {
+    if (!started) return false;
+    return nvs[ns].count(key) > 0;
+}
+
+size_t Preferences::putValue(const char *key, const void *value, size_t len) {
+    if (!started || readOnly || !key) return 0;
+    nvs[ns][key].assign(static_cast<const char *>(value), len);
+    hardware.nvsWrites++;
+    return len;
+}
+
+size_t Preferences::putString(const char *key, const char *value) {
+    if (!value) return 0;
+    return putValue(key, value, strlen(value) + 1) ? strlen(value) : 0;
+}
+
+bool Preferences::getRaw(const char *key, void *buf, size_t len) {
+    if (!started || !key) return false;
+    hardware.nvsReads++;
+    auto it = nvs[ns].find(key);
+    if (it == nvs[ns].end() || it->second.size() != len) return false;
+    memcpy(buf, it->second.data(), len);
+    return true;
+}
+
+String Preferences::getString(const char *key, const String defaultValue) {
+    if (!started || !key) return defaultValue;
+    hardware.nvsReads++;
+    auto it = nvs[ns].find(key);
+    if (it == nvs[ns].end()) return defaultValue;
+    return String(it->second.c_str());
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+    if (!started || !key) return 0;
+    auto it = nvs[ns].find(key);
+    return it == nvs[ns].end() ? 0 : it->second.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen) {
+    if (!started || !key) return 0;
+    hardware.nvsReads++;
+    auto it = nvs[ns].find(key);
+    if (it == nvs[ns].end() || it->second.size() > maxLen) return 0;
+    memcpy(buf, it->second.data(), it->second.size());
+    return it->second.size();
+}
+
+/*
+    DS18B20
+*/
+uint8_t DallasTemperature::getDeviceCount() {
+    return hardware.temperature == DEVICE_DISCONNECTED_C ? 0 : 1;
+}
+
+void DallasTemperature::setResolution(uint8_t bits) {
+    resolution = constrain(bits, 9, 12);
+}
+
+int16_t DallasTemperature::millisToWaitForConversion(uint8_t bits) const {
+    switch (bits) {
+        case 9:  return 94;
+        case 10: return 188;
+        case 11: return 375;
+        default: return 750;
+    }
+}
+
+void DallasTemperature::requestTemperatures() {
+    hardware.tempRequests++;
+    conversionStart = millis();
+    converting = true;
+    if (waitForConversion) {
+        delay(millisToWaitForConversion());
+    }
+}
+
+bool DallasTemperature::isConversionComplete() {
+    if (!converting) return true;
+    return millis() - conversionStart >= uint32_t(millisToWaitForConversion());
+}
+
+float DallasTemperature::getTempCByIndex(uint8_t index) {
+    if (index > 0 || hardware.temperature == DEVICE_DISCONNECTED_C) return DEVICE_DISCONNECTED_C;
+    converting = false;
+    // quantise to the configured resolution, 0.0625 C at 12 bit
+    float step = 0.5f / (1 << (resolution - 9));
+    return std::floor(hardware.temperature / step) * step;
+}
+
+/*
+    QuickPID
+*/
+QuickPID::QuickPID(float *Input, float *Output, float *Setpoint, float Kp, float Ki, float Kd, Action action)
+    : input(Input), output(Output), setpoint(Setpoint), kp(Kp), ki(Ki), kd(Kd),
+      outMin(0), outMax(255), outputSum(0), lastInput(0), sampleTimeUs(100000), lastTime(0),
+      mode(Control::manual), direction(action), pmode(pMode::pOnError), iawmode(iAwMode::iAwCondition) {
+    lastTime = micros() - sampleTimeUs;
+}
+
+bool QuickPID::Compute() {
+    if (mode == Control::manual) return false;
+    uint32_t now = micros();
+    if (now - lastTime < sampleTimeUs) return false;
+    lastTime = now;
+
+    float in = *input;
+    float error = *setpoint - in;
+    float dInput = in - lastInput;
+    if (direction == Action::reverse) { error = -error; dInput = -dInput; }
+
+    outputSum += ki * error;
+    if (pmode == pMode::pOnMeas) outputSum -= kp * dInput;
+    outputSum = constrain(outputSum, outMin, outMax);
+
+    float out = outputSum - kd * dInput;
+    if (pmode != pMode::pOnMeas) out += kp * error;
+    *output = constrain(out, outMin, outMax);
+    lastInput = in;
+    return true;
+}
+
+void QuickPID::Initialize() {
+    outputSum = constrain(*output, outMin, outMax);
+    lastInput = *input;
+}
+
+void QuickPID::SetMode(Control newMode) {
+    if (mode == Control::manual && newMode != Control::manual) Initialize();
+    mode = newMode;
+}
+
+void QuickPID::SetOutputLimits(float Min, float Max) {
+    if (Min >= Max) return;
+    outMin = Min;
+    outMax = Max;
+    if (mode != Control::manual) {
+        *output = constrain(*output, outMin, outMax);
+        outputSum = constrain(outputSum, outMin, outMax);
+    }
+}
+
+void QuickPID::SetTunings(float Kp, float Ki, float Kd) {
+    if (Kp < 0 || Ki < 0 || Kd < 0) return;
+    float sampleTimeSec = sampleTimeUs / 1000000.0f;
+    kp = Kp;
+    ki = Ki * sampleTimeSec;
+    kd = Kd / sampleTimeSec;
+}
+
+void QuickPID::SetSampleTimeUs(uint32_t NewSampleTimeUs) {
+    if (NewSampleTimeUs == 0) return;
+    float ratio = float(NewSampleTimeUs) / float(sampleTimeUs);
+    ki *= ratio;
+    kd /= ratio;
+    sampleTimeUs = NewSampleTimeUs;
+}
+
+/*
+    LittleFS
+*/
+size_t File::write(const uint8_t *buf, size_t len) {
+    std::string *data = isOpen && writable ? sim::fsFile(path.c_str()) : nullptr;
+    if (!data) return 0;
+    if (append) pos = data->size();
+    if (pos > data->size()) data->resize(pos);
+    data->replace(pos, std::min(len, data->size() - pos), reinterpret_cast<const char *>(buf), len);
+    pos += len;
+    hardware.fsBytesWritten += len;
+    return len;
+}
+
+size_t File::read(uint8_t *buf, size_t len) {
+    std::string *data = isOpen ? sim::fsFile(path.c_str()) : nullptr;
+    if (!data || pos >= data->size()) return 0;
+    size_t n = std::min(len, data->size() - pos);
+    memcpy(buf, data->data() + pos, n);
+    pos += n;
+    return n;
+}
+
+bool File::seek(uint32_t position) {
+    if (!isOpen || position > size()) return false;
+    pos = position;
+    return true;
+}
+
+size_t File::size() const {
+    std::string *data = isOpen ? sim::fsFile(path.c_str()) : nullptr;
+    return data ? data->size() : 0;
+}
+
+void File::flush() {
+    if (isOpen && writable) hardware.fsFlushes++;
+}
+
+bool LittleFSFS::begin(bool formatOnFail, const char *basePath, uint8_t maxOpenFiles, const char *partitionLabel) {
+    mounted = !hardware.fsBroken;
+    return mounted;
+}
+
+void LittleFSFS::end() {
+    mounted = false;
+}
+
+bool LittleFSFS::format() {
+    if (hardware.fsBroken) return false;
+    files.clear();
+    return true;
+}
+
+File LittleFSFS::open(const char *path, const char *mode) {
+    File f;
+    if (!mounted) return f;
+
+    f.path = path;
+    if (mode[0] != 'r' && hardware.fsOpenFails) {
+        hardware.fsOpenFails--;
+        return f;
+    }
+    if (mode[0] == 'r') {
+        if (!files.count(path)) return f;
+        f.isOpen = true;
+        f.writable = mode[1] == '+';
+        return f;
+    }
+    std::string &data = files[path];
+    if (mode[0] == 'w') data.clear();
+    f.isOpen = true;
+    f.writable = true;
+    f.append = mode[0] == 'a';
+    f.pos = f.append ? data.size() : 0;
+    return f;
+}
+
+bool LittleFSFS::exists(const char *path) {
+    return mounted && files.count(path);
+}
+
+bool LittleFSFS::remove(const char *path) {
+    return mounted && files.erase(path);
+}
+
+bool LittleFSFS::rename(const char *from, const char *to) {
+    auto it = files.find(from);
+    if (!mounted || it == files.end()) return false;
+    files[to] = it->second;
+    files.erase(from);
+    return true;
+}
+
+bool LittleFSFS::mkdir(const char *path) {
+    return mounted;
+}
+
+size_t LittleFSFS::totalBytes() {
+    return hardware.fsTotal;
+}
+
+size_t LittleFSFS::usedBytes() {
+    size_t used = 0;
+    for (auto &f : files) used += f.second.size();
+    return used;
+}
+
+/*
+    WiFi
+*/
+wl_status_t WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel,
+                             const uint8_t *bssid, bool connect) {
+    hardware.wifiBegins++;
+    wifiMode = (wifiMode == WIFI_MODE_AP || wifiMode == WIFI_MODE_APSTA) ? WIFI_MODE_APSTA : WIFI_MODE_STA;
+    if (hardware.wifiConnected) {
+        hardware.wifiConnected = false;
+        dispatch(ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    }
+    hardware.wifiJoinAtUs = 0;
+    if (!connect || !ssid || !*ssid || !hardware.wifiInRange) return WL_DISCONNECTED;
+
+    // a wrong channel or BSSID never finds the AP, the driver gives up silently
+    if (channel && channel != hardware.wifiChannel) return WL_DISCONNECTED;
+    if (bssid && memcmp(bssid, hardware.wifiBssid, sizeof(hardware.wifiBssid)) != 0) return WL_DISCONNECTED;
+
+    uint32_t ms = hardware.wifiAssocMs;
+    if (!channel || !bssid) ms += hardware.wifiScanMs;
+    if (!staticIp) {
+        if (hardware.wifiDhcpDown) return WL_DISCONNECTED;
+        ms += hardware.wifiDhcpMs;
+    }
+    hardware.wifiJoinAtUs = micros() + uint64_t(ms) * 1000;
+    return WL_DISCONNECTED;
+}
+
+bool WiFiClass::config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1) {
+    // static -> DHCP while associated starts the DHCP client, GOT_IP once it has a lease
+    if (staticIp && local == INADDR_NONE && hardware.wifiConnected && !hardware.wifiDhcpDown) {
+        hardware.wifiJoinAtUs = micros() + uint64_t(hardware.wifiDhcpMs) * 1000;
+    }
+    staticIp = local != INADDR_NONE;
+    staticLocal = local;
+    staticGateway = gateway;
+    staticSubnet = subnet;
+    staticDns = dns1;
+    return true;
+}
+
+bool WiFiClass::disconnect(bool wifioff, bool eraseap) {
+    hardware.wifiJoinAtUs = 0;
+    if (hardware.wifiConnected) {
+        hardware.wifiConnected = false;
+        dispatch(ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    }
+    if (wifioff) wifiMode = WIFI_MODE_NULL;
+    return true;
+}
+
+bool WiFiClass::softAP(const char *ssid, const char *passphrase) {
+    hardware.wifiHotspot = ssid && *ssid;
+    if (wifiMode == WIFI_MODE_NULL) wifiMode = WIFI_MODE_AP;
+    else if (wifiMode == WIFI_MODE_STA) wifiMode = WIFI_MODE_APSTA;
+    return hardware.wifiHotspot;
+}
+
+bool WiFiClass::softAPdisconnect(bool wifioff) {
+    hardware.wifiHotspot = false;
+    if (wifioff) wifiMode = WIFI_MODE_NULL;
+    return true;
+}
+
+bool WiFiClass::softAPConfig(IPAddress local, IPAddress gateway, IPAddress subnet) {
+    apAddress = local;
+    return true;
+}
+
+int WiFiClass::onEvent(WiFiEventCb cb, arduino_event_id_t event) {
+    for (int i = 0; i < WIFI_EVENT_HANDLERS; i++) {
+        if (!handlers[i].cb) {
+            handlers[i] = {cb, event};
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+void WiFiClass::dispatch(arduino_event_id_t event) {
+    for (int i = 0; i < WIFI_EVENT_HANDLERS; i++) {
+        if (handlers[i].cb && (handlers[i].event == ARDUINO_EVENT_MAX || handlers[i].event == event)) {
+            handlers[i].cb(event);
+        }
+    }
+}
+
+uint8_t *WiFiClass::BSSID() {
+    return hardware.wifiConnected ? hardware.wifiBssid : nullptr;
+}
+
+int32_t WiFiClass::channel() {
+    return hardware.wifiChannel;
+}
+
+IPAddress WiFiClass::localIP() {
+    if (!hardware.wifiConnected) return INADDR_NONE;
+    return staticIp ? staticLocal : IPAddress(hardware.wifiLease[0]);
+}
+
+IPAddress WiFiClass::gatewayIP() {
+    if (!hardware.wifiConnected) return INADDR_NONE;
+    return staticIp ? staticGateway : IPAddress(hardware.wifiLease[1]);
+}
+
+IPAddress WiFiClass::subnetMask() {
+    if (!hardware.wifiConnected) return INADDR_NONE;
+    return staticIp ? staticSubnet : IPAddress(hardware.wifiLease[2]);
+}
+
+IPAddress WiFiClass::dnsIP(uint8_t dns_no) {
+    if (!hardware.wifiConnected || dns_no) return INADDR_NONE;
+    return staticIp ? staticDns : IPAddress(hardware.wifiLease[3]);
+}
+
+/*
+    PubSubClient
+*/
+bool PubSubClient::connect(const char *id, const char *user, const char *pass) {
+    hardware.mqttConnects++;
+    hardware.brokerHost = domain ? domain : "";
+    hardware.brokerPort = port;
+    if (hardware.wifiConnected && hardware.brokerOnline) {
+        link = true;
+        lastState = MQTT_CONNECTED;
+        return true;
+    }
+    delay(hardware.brokerTimeoutMs);
+    link = false;
+    lastState = MQTT_CONNECT_FAILED;
+    return false;
+}
+
+bool PubSubClient::connected() {
+    if (link && !(hardware.wifiConnected && hardware.brokerOnline)) {
+        link = false;
+        lastState = MQTT_CONNECTION_LOST;
+    }
+    return link;
+}
+
+bool PubSubClient::subscribe(const char *topic, uint8_t qos) {
+    if (!connected()) return false;
+    hardware.subscriptions.push_back(topic);
+    subscriber = this;
+    return true;
+}
+
+bool sim::mqttDeliver(const char *topic, const char *payload) {
+    static char topicBuf[256];
+    static uint8_t payloadBuf[256];
+
+    if (!subscriber || !subscriber->connected() || !subscriber->callback) return false;
+
+    bool match = false;
+    for (const std::string &filter : hardware.subscriptions) {
+        size_t n = filter.size();
+        if (n && filter[n - 1] == '#') match |= strncmp(topic, filter.c_str(), n - 1) == 0;
+        else match |= filter == topic;
+    }
+    if (!match) return false;
+
+    size_t len = strlen(payload);
+    if (strlen(topic) >= sizeof(topicBuf) || len > sizeof(payloadBuf)) return false;
+    strcpy(topicBuf, topic);
+    memcpy(payloadBuf, payload, len);
+    subscriber->callback(topicBuf, payloadBuf, len);
+    return true;
+}
+
+bool PubSubClient::publish(const char *topic, const char *payload, bool retained) {
+    return publish(topic, reinterpret_cast<const uint8_t *>(payload), payload ? strlen(payload) : 0, retained);
+}
+
+bool PubSubClient::publish(const char *topic, const uint8_t *payload, unsigned int plength, bool retained) {
+    if (!connected()) return false;
+    if (strlen(topic) + plength + 7 > bufferSize) return false;
+    if (hardware.publishRejects) return false;
+    hardware.publishCount++;
+    if (hardware.recordPublishes)
+        hardware.published.push_back({topic, std::string(reinterpret_cast<const char *>(payload), plength), retained});
+    return true;
+}
@@ -0,0 +1,134 @@
+// NativeHal.h
+#ifndef NATIVE_HAL_H
+#define NATIVE_HAL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+    Simulated hardware behind the host (env:native) build.
+
+    The Arduino / ESP-IDF shims in this library all read and write the state
+    below, so a test or the host runner can play "the board": set the ADC and
+    DS18B20 readings, flip the save button, take the broker down, and look at
+    what the firmware did to the pins, the PWM channel, NVS and MQTT.
+
+    Time: micros()/millis() follow the real steady clock (so loop latency can
+    be measured) plus a virtual offset. delay() does not sleep, it only moves
+    the virtual offset, so blocking code still shows its full cost in the
+    timings but tests do not wait for it. freezeClock(true) drops the real
+    clock part for fully deterministic tests.
+*/
+namespace sim {
+
+constexpr uint8_t PIN_COUNT = 40;
+constexpr uint8_t LEDC_CHANNELS = 16;
+constexpr uint8_t ADC_CHANNELS = 8;
+
+struct Publish {
+    std::string topic;
+    std::string payload;
+    bool        retained;
+};
+
+struct Hardware {
+    // Clock
+    bool        frozen;             // ignore the real clock, virtual time only
+    uint64_t    offsetUs;           // virtual time added on top of the real clock
+
+    // GPIO
+    uint8_t     mode[PIN_COUNT];    // last pinMode / gpio_set_direction
+    uint8_t     level[PIN_COUNT];   // output level driven by the firmware
+    int8_t      input[PIN_COUNT];   // forced input level, -1 = not driven
+    uint32_t    toggles[PIN_COUNT]; // output level changes per pin
+
+    // LEDC
+    int8_t      ledcPin[LEDC_CHANNELS];
+    uint32_t    ledcDuty[LEDC_CHANNELS];
+
+    // ADC1
+    int         adcRaw[ADC_CHANNELS];
+    uint32_t    adcReads;           // adc1_get_raw() calls
+    int         adcNoise;           // +- counts of deterministic noise on DMA samples
+    uint32_t    adcSpikeEvery;      // every n-th DMA sample reads adcSpikeRaw, 0 = off
+    int         adcSpikeRaw;
+    uint32_t    adcSamples;         // DMA samples handed to the firmware
+    uint32_t    adcOverruns;        // DMA ring buffer overflows
+    bool        adcDmaFails;        // adc_digi_start() returns ESP_FAIL
+
+    // DS18B20
+    float       temperature;        // DEVICE_DISCONNECTED_C when unplugged
+    uint32_t    tempRequests;
+
+    // WiFi / MQTT broker
+    bool        wifiConnected;
+    uint32_t    wifiReconnects;
+    uint32_t    wifiBegins;         // WiFi.begin() calls
+    bool        wifiInRange;        // the access point answers
+    uint8_t     wifiBssid[6];       // and is this radio
+    int32_t     wifiChannel;        // on this channel
+    uint32_t    wifiLease[4];       // DHCP: address, gateway, subnet, dns (IPAddress order)
+    uint32_t    wifiScanMs;         // begin() without channel/BSSID scans all channels first
+    uint32_t    wifiAssocMs;        // authenticate + associate
+    uint32_t    wifiDhcpMs;         // DHCP, skipped with a static address
+    bool        wifiDhcpDown;       // the DHCP server does not answer
+    uint64_t    wifiJoinAtUs;       // pending association, 0 = none
+    bool        wifiHotspot;        // softAP() is up
+    bool        brokerOnline;
+    uint32_t    brokerTimeoutMs;    // how long a failed connect() blocks
+    uint32_t    mqttConnects;
+    std::string brokerHost;         // read through the setServer() pointer at connect()
+    uint16_t    brokerPort;
+    uint32_t    publishCount;       // publishes accepted by the broker
+    bool        publishRejects;     // publish() fails while connected, like a full send buffer
+    bool        recordPublishes;    // keep a copy in published (allocates)
+    std::vector<Publish> published;
+    std::vector<std::string> subscriptions;
+
+    // NVS
+    uint32_t    nvsWrites;          // put* calls that reached the store
+    uint32_t    nvsReads;           // get* calls
+
+    // LittleFS
+    bool        fsBroken;           // mount fails, format too
+    uint32_t    fsTotal;            // partition size, bytes
+    uint32_t    fsOpenFails;        // the next n opens for writing fail, e.g. no free block
+    uint32_t    fsBytesWritten;
+    uint32_t    fsFlushes;
+
+    // Serial
+    bool        serialEcho;         // print Serial output to stdout
+};
+
+Hardware& hw();
+
+// Put every back-end back to its power-on state and clear NVS. The ADC DMA
+// driver keeps its configuration: the firmware singleton installs it once.
+void reset();
+
+void freezeClock(bool frozen);
+void advanceMillis(uint32_t ms);
+void advanceMicros(uint32_t us);
+
+void setAdcRaw(uint8_t channel, int raw);
+void setAdcSpikes(uint32_t every, int raw);     // every = 0 turns them off
+void setTemperature(float celsius);
+void setPinInput(uint8_t pin, int level);       // -1 releases the pin
+void setWifiConnected(bool connected);          // fires GOT_IP / STA_DISCONNECTED on change
+void setBrokerOnline(bool online);
+void setSerialEcho(bool echo);
+
+// Broker -> firmware message, topic filters ending in '#' match by prefix.
+// Returns false when nobody is subscribed or the link is down.
+bool mqttDeliver(const char *topic, const char *payload);
+
+void clearNvs();
+
+// LittleFS contents, nullptr when the file does not exist
+std::string *fsFile(const char *path);
+void fsTruncate(const char *path, size_t size);     // torn write at power loss
+
+} // namespace sim
+
+#endif // NATIVE_HAL_H
@@ -0,0 +1,20 @@
+// OneWire.h  (native)
+#ifndef NATIVE_ONEWIRE_H
+#define NATIVE_ONEWIRE_H
+
+#include <cstdint>
+
+/*
+    The bus itself carries nothing on the host; DallasTemperature talks to
+    the simulated sensor directly.
+*/
+class OneWire {
+public:
+    explicit OneWire(uint8_t pin) : pin(pin) {}
+    uint8_t getPin() const { return pin; }
+
+private:
+    uint8_t pin;
+};
+
+#endif // NATIVE_ONEWIRE_H
@@ -0,0 +1,66 @@
+// PubSubClient.h  (native)
+#ifndef NATIVE_PUBSUBCLIENT_H
+#define NATIVE_PUBSUBCLIENT_H
+
+#include <cstdint>
+#include <functional>
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+
+/*
+    knolleary/PubSubClient against the simulated broker. Publishes are
+    recorded in sim::hw().published; a connect() to an offline broker blocks
+    for sim::hw().brokerTimeoutMs on the virtual clock, like the socket
+    timeout on the real client. Like the real one it keeps the pointer given
+    to setServer() and reads the host through it on every connect().
+*/
+class PubSubClient {
+public:
+    explicit PubSubClient(Client &client) : client(&client), domain(nullptr), port(0), link(false), lastState(MQTT_DISCONNECTED), bufferSize(256) {}
+
+    PubSubClient &setServer(const char *domain, uint16_t port) { this->domain = domain; this->port = port; return *this; }
+    PubSubClient &setCallback(MQTT_CALLBACK_SIGNATURE) { this->callback = callback; return *this; }
+    PubSubClient &setClient(Client &client) { this->client = &client; return *this; }
+    PubSubClient &setKeepAlive(uint16_t keepAlive) { return *this; }
+    PubSubClient &setSocketTimeout(uint16_t timeout) { return *this; }
+    bool setBufferSize(uint16_t size) { bufferSize = size; return true; }
+    uint16_t getBufferSize() const { return bufferSize; }
+
+    bool connect(const char *id) { return connect(id, nullptr, nullptr); }
+    bool connect(const char *id, const char *user, const char *pass);
+    void disconnect() { link = false; lastState = MQTT_DISCONNECTED; }
+
+    bool publish(const char *topic, const char *payload) { return publish(topic, payload, false); }
+    bool publish(const char *topic, const char *payload, bool retained);
+    bool publish(const char *topic, const uint8_t *payload, unsigned int plength) { return publish(topic, payload, plength, false); }
+    bool publish(const char *topic, const uint8_t *payload, unsigned int plength, bool retained);
+
+    bool subscribe(const char *topic) { return subscribe(topic, 0); }
+    bool subscribe(const char *topic, uint8_t qos);
+    bool unsubscribe(const char *topic) { return connected(); }
+
+    bool loop() { return connected(); }
+    bool connected();
+    int state() const { return lastState; }
+
+private:
+    friend bool sim::mqttDeliver(const char *topic, const char *payload);
+
+    Client *client;
+    const char *domain;             // kept, not copied, like the real client
+    uint16_t port;
+    bool link;
+    int lastState;
+    uint16_t bufferSize;
+    MQTT_CALLBACK_SIGNATURE;
+};
+
+#endif // NATIVE_PUBSUBCLIENT_H
@@ -0,0 +1,54 @@
+// QuickPID.h  (native)
+#ifndef NATIVE_QUICKPID_H
+#define NATIVE_QUICKPID_H
+
+#include <cstdint>
+
+/*
+    Same interface as dlloydev/QuickPID, with a plain PID behind it
+    (proportional on measurement, clamped integral). Good enough to close
+    the heater loop against the simulated sensor.
+*/
+class QuickPID {
+public:
+    enum class Control : uint8_t { manual, automatic, timer, toggle };
+    enum class Action : uint8_t { direct, reverse };
+    enum class pMode : uint8_t { pOnError, pOnMeas, pOnErrorMeas };
+    enum class dMode : uint8_t { dOnError, dOnMeas };
+    enum class iAwMode : uint8_t { iAwCondition, iAwClamp, iAwOff };
+
+    QuickPID(float *Input, float *Output, float *Setpoint, float Kp, float Ki, float Kd, Action action);
+
+    bool Compute();
+    void Initialize();
+
+    void SetMode(Control mode);
+    void SetOutputLimits(float Min, float Max);
+    void SetTunings(float Kp, float Ki, float Kd);
+    void SetSampleTimeUs(uint32_t NewSampleTimeUs);
+    void SetProportionalMode(pMode mode) { pmode = mode; }
+    void SetAntiWindupMode(iAwMode mode) { iawmode = mode; }
+    void SetControllerDirection(Action action) { direction = action; }
+
+    uint8_t GetMode() const { return static_cast<uint8_t>(mode); }
+    float GetKp() const { return kp; }
+    float GetKi() const { return ki; }
+    float GetKd() const { return kd; }
+
+private:
+    float *input;
+    float *output;
+    float *setpoint;
+    float kp, ki, kd;
+    float outMin, outMax;
+    float outputSum;
+    float lastInput;
+    uint32_t sampleTimeUs;
+    uint32_t lastTime;
+    Control mode;
+    Action direction;
+    pMode pmode;
+    iAwMode iawmode;
+};
+
+#endif // NATIVE_QUICKPID_H
@@ -0,0 +1,77 @@
+// WString.h  (native)
+#ifndef NATIVE_WSTRING_H
+#define NATIVE_WSTRING_H
+
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+
+/*
+    Host version of the Arduino String. Backed by std::string, only the
+    parts the firmware actually uses are here.
+*/
+class String {
+public:
+    String() {}
+    String(const char *str) : s(str ? str : "") {}
+    String(const std::string &str) : s(str) {}
+    String(char c) : s(1, c) {}
+    String(unsigned char value, unsigned char base = 10) { fromUnsigned(value, base); }
+    String(int value, unsigned char base = 10) { fromSigned(value, base); }
+    String(unsigned int value, unsigned char base = 10) { fromUnsigned(value, base); }
+    String(long value, unsigned char base = 10) { fromSigned(value, base); }
+    String(unsigned long value, unsigned char base = 10) { fromUnsigned(value, base); }
+    String(float value, unsigned int decimalPlaces = 2) { fromDouble(value, decimalPlaces); }
+    String(double value, unsigned int decimalPlaces = 2) { fromDouble(value, decimalPlaces); }
+
+    const char *c_str() const { return s.c_str(); }
+    unsigned int length() const { return s.length(); }
+    bool isEmpty() const { return s.empty(); }
+    void reserve(unsigned int size) { s.reserve(size); }
+
+    char operator[](unsigned int index) const { return index < s.length() ? s[index] : 0; }
+    char &operator[](unsigned int index) { return s[index]; }
+
+    String &operator+=(const String &rhs) { s += rhs.s; return *this; }
+    String &operator+=(const char *rhs) { s += rhs; return *this; }
+    String &operator+=(char rhs) { s += rhs; return *this; }
+    bool concat(const String &rhs) { s += rhs.s; return true; }
+
+    friend String operator+(const String &lhs, const String &rhs) { return String(lhs.s + rhs.s); }
+    friend String operator+(const String &lhs, const char *rhs) { return String(lhs.s + rhs); }
+    friend String operator+(const char *lhs, const String &rhs) { return String(lhs + rhs.s); }
+
+    bool operator==(const String &rhs) const { return s == rhs.s; }
+    bool operator==(const char *rhs) const { return s == rhs; }
+    bool operator!=(const String &rhs) const { return s != rhs.s; }
+
+    long toInt() const { return std::strtol(s.c_str(), nullptr, 10); }
+    float toFloat() const { return std::strtof(s.c_str(), nullptr); }
+
+private:
+    std::string s;
+
+    void fromSigned(long value, unsigned char base) {
+        if (value < 0 && base == 10) { fromUnsigned(-value, base); s.insert(0, 1, '-'); }
+        else fromUnsigned(value, base);
+    }
+    void fromUnsigned(unsigned long value, unsigned char base) {
+        char buf[8 * sizeof(long) + 1];
+        char *p = &buf[sizeof(buf) - 1];
+        *p = '\0';
+        if (base < 2) base = 10;
+        do {
+            unsigned long digit = value % base;
+            *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+            value /= base;
+        } while (value);
+        s = p;
+    }
+    void fromDouble(double value, unsigned int decimalPlaces) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+        s = buf;
+    }
+};
+
+#endif // NATIVE_WSTRING_H
@@ -0,0 +1,121 @@
+// WiFi.h  (native)
+#ifndef NATIVE_WIFI_H
+#define NATIVE_WIFI_H
+
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+typedef enum {
+    WL_IDLE_STATUS   = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED     = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED  = 6
+} wl_status_t;
+
+typedef enum {
+    WIFI_MODE_NULL = 0,
+    WIFI_MODE_STA,
+    WIFI_MODE_AP,
+    WIFI_MODE_APSTA
+} wifi_mode_t;
+
+#define WIFI_OFF    WIFI_MODE_NULL
+#define WIFI_STA    WIFI_MODE_STA
+#define WIFI_AP     WIFI_MODE_AP
+#define WIFI_AP_STA WIFI_MODE_APSTA
+
+typedef enum {
+    ARDUINO_EVENT_WIFI_STA_START,
+    ARDUINO_EVENT_WIFI_STA_CONNECTED,
+    ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+    ARDUINO_EVENT_WIFI_STA_GOT_IP,
+    ARDUINO_EVENT_WIFI_STA_LOST_IP,
+    ARDUINO_EVENT_MAX
+} arduino_event_id_t;
+
+typedef void (*WiFiEventCb)(arduino_event_id_t event);
+
+/*
+    IPv4 address, stored in network order like the ESP32 core.
+*/
+class IPAddress {
+public:
+    IPAddress() : addr(0) {}
+    IPAddress(uint32_t address) : addr(address) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+        : addr(uint32_t(a) | uint32_t(b) << 8 | uint32_t(c) << 16 | uint32_t(d) << 24) {}
+
+    operator uint32_t() const { return addr; }
+    bool operator==(const IPAddress& rhs) const { return addr == rhs.addr; }
+    bool operator!=(const IPAddress& rhs) const { return addr != rhs.addr; }
+    uint8_t operator[](int i) const { return uint8_t(addr >> (8 * i)); }
+
+    String toString() const {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+        return String(buf);
+    }
+
+private:
+    uint32_t addr;
+};
+
+#define INADDR_NONE IPAddress(0u)
+
+#define WIFI_EVENT_HANDLERS 4
+
+/*
+    Station and soft AP. The access point in range, its channel and the
+    DHCP lease it hands out are in sim::hw(); begin() schedules the
+    association and sim::advanceMillis() delivers it as GOT_IP to the
+    onEvent() handlers, the way the WiFi driver task does.
+*/
+class WiFiClass {
+public:
+    bool isConnected() { return sim::hw().wifiConnected; }
+    wl_status_t status() { return isConnected() ? WL_CONNECTED : WL_DISCONNECTED; }
+    bool reconnect() { sim::hw().wifiReconnects++; return true; }
+    bool setHostname(const char *) { return true; }
+    bool setAutoReconnect(bool) { return true; }
+    bool setSleep(bool) { return true; }
+    bool mode(wifi_mode_t m) { wifiMode = m; return true; }
+    wifi_mode_t getMode() const { return wifiMode; }
+
+    wl_status_t begin(const char *ssid, const char *passphrase = nullptr, int32_t channel = 0,
+                      const uint8_t *bssid = nullptr, bool connect = true);
+    bool config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress());
+    bool disconnect(bool wifioff = false, bool eraseap = false);
+
+    bool softAP(const char *ssid, const char *passphrase = nullptr);
+    bool softAPConfig(IPAddress local, IPAddress gateway, IPAddress subnet);
+    bool softAPdisconnect(bool wifioff = false);
+
+    int onEvent(WiFiEventCb cb, arduino_event_id_t event = ARDUINO_EVENT_MAX);
+
+    uint8_t *BSSID();
+    int32_t channel();
+    IPAddress localIP();
+    IPAddress gatewayIP();
+    IPAddress subnetMask();
+    IPAddress dnsIP(uint8_t dns_no = 0);
+    IPAddress softAPIP() { return apAddress; }
+
+    // sim side: call the registered handlers
+    void dispatch(arduino_event_id_t event);
+
+private:
+    wifi_mode_t wifiMode = WIFI_MODE_NULL;
+    bool        staticIp = false;
+    IPAddress   staticLocal, staticGateway, staticSubnet, staticDns;
+    IPAddress   apAddress;
+    struct {
+        WiFiEventCb         cb;
+        arduino_event_id_t  event;
+    } handlers[WIFI_EVENT_HANDLERS] = {};
+};
+
+extern WiFiClass WiFi;
+
+#endif // NATIVE_WIFI_H
@@ -0,0 +1,24 @@
+// WiFiClient.h  (native)
+#ifndef NATIVE_WIFICLIENT_H
+#define NATIVE_WIFICLIENT_H
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+    Stand-in TCP client. PubSubClient never touches the socket on the host,
+    it asks the simulated broker instead.
+*/
+class Client {
+public:
+    virtual ~Client() {}
+    virtual int connected() { return 0; }
+    virtual void stop() {}
+};
+
+class WiFiClient : public Client {
+public:
+    void setTimeout(uint32_t) {}
+};
+
+#endif // NATIVE_WIFICLIENT_H
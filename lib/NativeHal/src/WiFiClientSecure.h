@@ -0,0 +1,12 @@
+// WiFiClientSecure.h  (native)
+#ifndef NATIVE_WIFICLIENTSECURE_H
+#define NATIVE_WIFICLIENTSECURE_H
+
+#include "WiFiClient.h"
+
+class WiFiClientSecure : public WiFiClient {
+public:
+    void setInsecure() {}
+};
+
+#endif // NATIVE_WIFICLIENTSECURE_H
@@ -0,0 +1,100 @@
+// driver/adc.h  (native)
+#ifndef NATIVE_DRIVER_ADC_H
+#define NATIVE_DRIVER_ADC_H
+
+#include "driver/gpio.h"
+
+typedef enum {
+    ADC_UNIT_1 = 1,
+    ADC_UNIT_2 = 2
+} adc_unit_t;
+
+typedef enum {
+    ADC_ATTEN_DB_0   = 0,
+    ADC_ATTEN_DB_2_5 = 1,
+    ADC_ATTEN_DB_6   = 2,
+    ADC_ATTEN_DB_11  = 3
+} adc_atten_t;
+
+typedef enum {
+    ADC_WIDTH_BIT_9  = 0,
+    ADC_WIDTH_BIT_10 = 1,
+    ADC_WIDTH_BIT_11 = 2,
+    ADC_WIDTH_BIT_12 = 3
+} adc_bits_width_t;
+
+#define ADC_WIDTH_9Bit  ADC_WIDTH_BIT_9
+#define ADC_WIDTH_10Bit ADC_WIDTH_BIT_10
+#define ADC_WIDTH_11Bit ADC_WIDTH_BIT_11
+#define ADC_WIDTH_12Bit ADC_WIDTH_BIT_12
+
+typedef enum {
+    ADC1_CHANNEL_0 = 0, ADC1_CHANNEL_1, ADC1_CHANNEL_2, ADC1_CHANNEL_3,
+    ADC1_CHANNEL_4, ADC1_CHANNEL_5, ADC1_CHANNEL_6, ADC1_CHANNEL_7,
+    ADC1_CHANNEL_MAX
+} adc1_channel_t;
+
+esp_err_t adc1_config_width(adc_bits_width_t width_bit);
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten);
+int adc1_get_raw(adc1_channel_t channel);
+
+/*
+    Continuous (DMA) mode, the ESP-IDF 4.4 adc_digi_* API. On the ESP32 it
+    runs ADC1 through I2S0, type 1 frames of 16 bits: 12 bit data, 4 bit channel.
+*/
+typedef enum {
+    ADC_CONV_SINGLE_UNIT_1 = 1,
+    ADC_CONV_SINGLE_UNIT_2 = 2,
+    ADC_CONV_BOTH_UNIT     = 3,
+    ADC_CONV_ALTER_UNIT    = 7
+} adc_digi_convert_mode_t;
+
+typedef enum {
+    ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    ADC_DIGI_OUTPUT_FORMAT_TYPE2
+} adc_digi_output_format_t;
+
+typedef struct {
+    uint32_t    max_store_buf_size;     // DMA ring buffer, bytes
+    uint32_t    conv_num_each_intr;     // bytes per DMA interrupt
+    uint32_t    adc1_chan_mask;
+    uint32_t    adc2_chan_mask;
+} adc_digi_init_config_t;
+
+typedef struct {
+    uint8_t atten;
+    uint8_t channel;
+    uint8_t unit;
+    uint8_t bit_width;
+} adc_digi_pattern_config_t;
+
+typedef struct {
+    bool                        conv_limit_en;
+    uint32_t                    conv_limit_num;
+    uint32_t                    pattern_num;
+    adc_digi_pattern_config_t  *adc_pattern;
+    uint32_t                    sample_freq_hz;
+    adc_digi_convert_mode_t     conv_mode;
+    adc_digi_output_format_t    format;
+} adc_digi_configuration_t;
+
+typedef struct {
+    union {
+        struct {
+            uint16_t data:     12;
+            uint16_t channel:   4;
+        } type1;
+        uint16_t val;
+    };
+} adc_digi_output_data_t;
+
+#define SOC_ADC_DIGI_RESULT_BYTES 2
+
+esp_err_t adc_digi_initialize(const adc_digi_init_config_t *init_config);
+esp_err_t adc_digi_controller_configure(const adc_digi_configuration_t *config);
+esp_err_t adc_digi_start(void);
+esp_err_t adc_digi_stop(void);
+esp_err_t adc_digi_read_bytes(uint8_t *buf, uint32_t length_max, uint32_t *out_length, uint32_t timeout_ms);
+esp_err_t adc_digi_deinitialize(void);
+
+#endif // NATIVE_DRIVER_ADC_H
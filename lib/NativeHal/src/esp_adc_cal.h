@@ -0,0 +1,30 @@
+// esp_adc_cal.h  (native)
+#ifndef NATIVE_ESP_ADC_CAL_H
+#define NATIVE_ESP_ADC_CAL_H
+
+#include <cstdint>
+#include "driver/adc.h"
+
+typedef enum {
+    ESP_ADC_CAL_VAL_EFUSE_VREF = 0,
+    ESP_ADC_CAL_VAL_EFUSE_TP   = 1,
+    ESP_ADC_CAL_VAL_DEFAULT_VREF = 2
+} esp_adc_cal_value_t;
+
+typedef struct {
+    adc_unit_t          adc_num;
+    adc_atten_t         atten;
+    adc_bits_width_t    bit_width;
+    uint32_t            coeff_a;    // gradient, scaled by 65536
+    uint32_t            coeff_b;    // offset in mV
+    uint32_t            vref;
+} esp_adc_cal_characteristics_t;
+
+/*
+    Linear model of the ESP32 ADC1 at 11 dB: 4095 counts ~ 3.1 V scaled by vref / 1100.
+*/
+esp_adc_cal_value_t esp_adc_cal_characterize(adc_unit_t adc_num, adc_atten_t atten, adc_bits_width_t bit_width,
+                                             uint32_t default_vref, esp_adc_cal_characteristics_t *chars);
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t adc_reading, const esp_adc_cal_characteristics_t *chars);
+
+#endif // NATIVE_ESP_ADC_CAL_H
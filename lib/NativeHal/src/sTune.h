@@ -0,0 +1,43 @@
+// sTune.h  (native)
+#ifndef NATIVE_STUNE_H
+#define NATIVE_STUNE_H
+
+#include <cstdint>
+
+/*
+    Interface of dlloydev/sTune. The host has no plant to step, so the tuner
+    stays in its test phase and never hands out tunings; the firmware then
+    falls back to the stored PID gains, as it does when tuning times out.
+*/
+class sTune {
+public:
+    enum TuningMethod : uint8_t { ZN_PID, DampedOsc_PID, NoOvershoot_PID, CohenCoon_PID, Mixed_PID,
+                                  ZN_PI, DampedOsc_PI, NoOvershoot_PI, CohenCoon_PI, Mixed_PI };
+    enum Action : uint8_t { directIP, direct5T, reverseIP, reverse5T };
+    enum SerialMode : uint8_t { printOFF, printALL, printSUMMARY, printDEBUG, printPIDTUNER };
+    enum TunerStatus : uint8_t { sample, test, tunings, runPid, timerPid };
+
+    sTune(float *input, float *output, TuningMethod tuningMethod, Action action, SerialMode serialMode)
+        : input(input), output(output) {}
+
+    void Configure(const float inputSpan, const float outputSpan, float outputStart, float outputStep,
+                   uint32_t testTimeSec, uint32_t settleTimeSec, const uint16_t samples) {}
+    void SetEmergencyStop(float e_Stop) {}
+    uint8_t Run() { return test; }
+    float softPwm(const uint8_t relayPin, float input, float output, float setpoint,
+                  uint32_t windowSize, uint8_t debounce) { return output; }
+    void plotter(float input, float output, float setpoint, float outputScale = 1, uint8_t everyNth = 1) {}
+
+    void GetAutoTunings(float *kp, float *ki, float *kd) {}
+    float GetKp() { return 0; }
+    float GetKi() { return 0; }
+    float GetKd() { return 0; }
+    float GetTau() { return 0; }
+    float GetDeadTime() { return 1; }
+
+private:
+    float *input;
+    float *output;
+};
+
+#endif // NATIVE_STUNE_H
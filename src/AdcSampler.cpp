@@ -0,0 +1,92 @@
+#include "AdcSampler.h"
+#include <algorithm>
+
+bool AdcSampler::begin(adc1_channel_t ch, adc_atten_t atten) {
+    channel = ch;
+
+    adc_digi_init_config_t init = {};
+    init.max_store_buf_size = ADC_DMA_BUFFER;
+    init.conv_num_each_intr = ADC_FRAME_BYTES;
+    init.adc1_chan_mask = 1 << ch;
+
+    adc_digi_pattern_config_t pattern = {};
+    pattern.atten = atten;
+    pattern.channel = ch;
+    pattern.unit = 0;                       // ADC1
+    pattern.bit_width = 12;
+
+    adc_digi_configuration_t config = {};
+    config.conv_limit_en = true;            // required on the ESP32
+    config.conv_limit_num = 250;
+    config.pattern_num = 1;
+    config.adc_pattern = &pattern;
+    config.sample_freq_hz = ADC_SAMPLE_RATE;
+    config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+    config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+
+    ready = adc_digi_initialize(&init) == ESP_OK && adc_digi_controller_configure(&config) == ESP_OK;
+
+    #ifdef DEBUG
+    if (!ready) Serial.println("ADC DMA init failed");
+    #endif
+    return ready;
+}
+
+void AdcSampler::start() {
+    if (!ready) return;
+    if (running) adc_digi_stop();
+
+    count = 0;
+    running = adc_digi_start() == ESP_OK;
+}
+
+void AdcSampler::stop() {
+    if (running) adc_digi_stop();
+    running = false;
+}
+
+bool AdcSampler::poll() {
+    if (!running) return false;
+
+    while (count < ADC_WINDOW) {
+        uint32_t len = 0;
+        esp_err_t err = adc_digi_read_bytes(frame, sizeof(frame), &len, 0);
+
+        if (err == ESP_ERR_INVALID_STATE) stats.overruns++;    // data is still valid
+        else if (err != ESP_OK) return false;                   // nothing buffered yet
+
+        for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= len && count < ADC_WINDOW; i += SOC_ADC_DIGI_RESULT_BYTES) {
+            adc_digi_output_data_t sample;
+            memcpy(&sample, frame + i, SOC_ADC_DIGI_RESULT_BYTES);
+
+            if (sample.type1.channel != channel) {
+                stats.foreign++;
+                continue;
+            }
+            window[count++] = sample.type1.data;
+        }
+    }
+
+    stats.samples += count;
+    stats.low = *std::min_element(window, window + count);
+    stats.high = *std::max_element(window, window + count);
+    result = reduce(window, count, ADC_TRIM);
+    stats.windows++;
+    count = 0;
+    return true;
+}
+
+uint32_t AdcSampler::reduce(uint16_t* samples, size_t n, size_t trim) {
+    if (n == 0) return 0;
+    if (2 * trim >= n) trim = (n - 1) / 2;
+
+    // two partial sorts, O(n): the trimmed tails end up outside [trim, n - trim)
+    std::nth_element(samples, samples + n - trim - 1, samples + n);
+    std::nth_element(samples, samples + trim, samples + n - trim);
+
+    uint32_t sum = 0;
+    for (size_t i = trim; i < n - trim; i++) sum += samples[i];
+
+    size_t kept = n - 2 * trim;
+    return (sum * ADC_OVERSAMPLE + kept / 2) / kept;
+}
@@ -0,0 +1,73 @@
+// AdcSampler.h
+#ifndef ADC_SAMPLER_H
+#define ADC_SAMPLER_H
+
+#include <Arduino.h>
+#include <driver/adc.h>
+
+/*
+    Oversampled battery voltage from the ADC in continuous (DMA) mode.
+
+    start() lets the I2S/DMA engine fill a ring buffer with ADC_SAMPLE_RATE
+    samples per second in the background. poll() only copies whatever is
+    already there, never waits, and returns true once ADC_WINDOW samples are
+    in. The window is then reduced to one value: the lowest and highest
+    ADC_TRIM samples are thrown away (spikes from the charger or the heater
+    PWM), the rest are averaged. The result is kept in 1/ADC_OVERSAMPLE
+    counts, so averaging really buys resolution instead of being rounded
+    off again.
+
+        if (sampler.poll()) {
+            sampler.stop();
+            uint32_t raw16 = sampler.value();
+        }
+*/
+
+#define ADC_SAMPLE_RATE 20000       // Hz, lowest the ESP32 DMA mode runs at
+#define ADC_WINDOW 256              // samples per reading, ~13 ms
+#define ADC_TRIM 32                 // samples dropped at each end of the sorted window
+#define ADC_OVERSAMPLE 16           // value() is in 1/16 counts
+#define ADC_DMA_BUFFER 1024         // bytes, 512 samples
+#define ADC_FRAME_BYTES 256         // read per adc_digi_read_bytes() call
+
+struct adcSamplerStats {
+    uint32_t    windows;        // completed readings
+    uint32_t    samples;        // DMA samples taken into a window
+    uint32_t    foreign;        // frames from another channel
+    uint32_t    overruns;       // DMA ring buffer overflowed, samples were lost
+    uint16_t    low;            // range of the last window, before trimming
+    uint16_t    high;
+};
+
+class AdcSampler {
+public:
+    AdcSampler() : channel(ADC1_CHANNEL_0), ready(false), running(false), count(0), result(0), stats{} {}
+
+    bool begin(adc1_channel_t channel, adc_atten_t atten);
+
+    // Start a new window, anything sampled before is dropped
+    void start();
+    void stop();
+
+    // Non-blocking, true when a full window has been reduced into value()
+    bool poll();
+
+    bool isRunning() const { return running; }
+    uint32_t value() const { return result; }
+    const adcSamplerStats& getStats() const { return stats; }
+
+    // Trimmed mean of a window in 1/ADC_OVERSAMPLE counts, reorders samples
+    static uint32_t reduce(uint16_t* samples, size_t n, size_t trim);
+
+private:
+    adc1_channel_t  channel;
+    bool            ready;
+    bool            running;
+    uint16_t        count;
+    uint32_t        result;
+    adcSamplerStats stats;
+    uint16_t        window[ADC_WINDOW];
+    uint8_t         frame[ADC_FRAME_BYTES];
+};
+
+#endif // ADC_SAMPLER_H
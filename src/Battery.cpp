@@ -5,34 +5,21 @@
 #include <ESPUI.h>
 #include <sTune.h>
 #include <WiFiClientSecure.h>
+#include <algorithm>
 #include <cctype>
+#include <cstdarg>
 #include <functional>
 #define DEBUG
-#define LOG_BUFFER 50
-#define LOGS_SIZE 10
-
-
-
-struct logEntry {
-    int voltageState;
-    int tempState;
-    int previousVState;
-    int previousTState;
-    uint32_t timestamps;
-};
-
-struct statesLog {
-    logEntry entries[LOGS_SIZE];
-    int index;
-};
 
 Battery::~Battery() {
     digitalWrite(heaterPin, LOW);    // Turn off heater
     digitalWrite(chargerPin, LOW);   // Turn off charger
     // Save settings before destruction
     saveSettings(ALL);
-    // Stop PWM
+    commitSettings(true);
+    // Stop PWM and the ADC DMA
     ledcDetachPin(heaterPin);
+    sampler.stop();
     // Turn off LEDs
     //red.stop();
     yellow.stop();
@@ -78,17 +65,24 @@ void Battery::setup() {
     loadSettings(ALL);
 }
 
+/*
+    Single task mode: everything from the Arduino loop(). With RTOS_TASKS the
+    control task runs controlLoop() and the comms task commsLoop() instead.
+*/
 void Battery::loop() {
+    controlLoop();
+    commsLoop();
+}
+
+void Battery::controlLoop() {
+    LOOP_TIMER(STAGE_BATTERY);
+
+    applyControlCommands();                 // settings changed by the UI or MQTT
 
     switch (currentState) {
         case STARTUP:
 
-            startUpInit();
-            if(battery.startup.startupSave) {
-                currentState = BATTERY_INIT;
-                battery.initLevel = currentState;
-            }
-            else {
+            if(startUpInit()) {             // one step per loop, MQTT and the UI keep running
                 currentState = BATTERY_INIT;
                 battery.initLevel = currentState;
             }
@@ -150,8 +144,8 @@ void Battery::loop() {
 
             readVoltage(1000);
             readTemperature();            
+            predictSoc();
             handleBatteryControl();         
-            handleMqtt(); 
             green.blink(); 
             yellow.blink();  
         break;
@@ -169,16 +163,78 @@ void Battery::loop() {
 
             readVoltage(1000);
             readTemperature();              
+            predictSoc();
             handleBatteryControl();   
-            handleMqtt();  
             green.blink(); 
             yellow.blink();  
             // red.blink();
             controlHeaterPWM();
             break;
     }
+
+    publishTelemetry();
 }  // end loop
 
+void Battery::commsLoop() {
+    applyUiChanges();
+    journal.service();
+    commitSettings();
+
+    if (currentState == STARTUP || currentState == NORMAL || currentState == HEATING) {
+        handleMqtt();                       // also through the commissioning window
+    }
+}
+
+/*
+    Control task: controlLoop() every CONTROL_TASK_PERIOD_MS, pinned to its own core
+    so MQTT / WiFi reconnects and the web UI can not delay the charger or heater.
+*/
+void Battery::startControlTask() {
+    xTaskCreatePinnedToCore(controlTask, "control", CONTROL_TASK_STACK, this,
+                            CONTROL_TASK_PRIORITY, nullptr, CONTROL_TASK_CORE);
+}
+
+void Battery::controlTask(void* param) {
+    Battery* self = static_cast<Battery*>(param);
+    TickType_t lastWake = xTaskGetTickCount();
+
+    for (;;) {
+        self->controlLoop();
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(CONTROL_TASK_PERIOD_MS));
+    }
+}
+
+/*
+    Copy the telemetry subset into the snapshot for the comms task and UI.
+*/
+void Battery::publishTelemetry() {
+    batteryTelemetry t;
+
+    t.time              = millis();
+    t.milliVoltage      = battery.milliVoltage;
+    t.voltageInPrecent  = battery.voltageInPrecent;
+    t.sizeApprx         = battery.sizeApprx;
+    t.initLevel         = battery.initLevel;
+    t.init              = battery.init;
+    t.temperature       = battery.temperature;
+    t.vState            = battery.vState;
+    t.tState            = battery.tState;
+    t.chargerOn         = battery.chrgr.enable;
+    t.heaterOn          = battery.heater.enable;
+    t.pidOutput         = battery.heater.pidOutput;
+    t.pidSetpoint       = battery.heater.pidSetpoint;
+    t.stuneRun          = battery.stune.run;
+    t.stuneDone         = battery.stune.done;
+    t.socEstimate       = battery.soc.ready() ? battery.soc.soc() : battery.voltageInPrecent * 100;
+    t.socConfidence     = battery.soc.confidence();
+    t.chargeEta         = battery.soc.etaMinutes(battery.voltBoost ? battery.boostVoltPrecent : battery.ecoVoltPrecent,
+                                                 battery.chrgr.current, battery.capct);
+    t.chargerToggles    = battery.chrgr.toggles;
+    t.adcAvg            = battery.adc.filter.size() ? battery.adc.avg : 0;
+
+    telemetry.write(t);
+}
+
 
 bool Battery::init() {
 
@@ -203,51 +259,61 @@ void Battery::batteryInit() {
         }
 }
 
-void Battery::startUpInit() {
-    if (!battery.startup.startupSave) {     
-        while(battery.timer.startupTimer > millis()) {
-            readVoltage(50);
-            digitalWrite(redLed, LOW);
-            digitalWrite(greenLed, HIGH);
-            digitalWrite(yellowLed, HIGH);
-        // Check if the button is pressed
-        if (digitalRead(saveButton) == LOW) {
-            // If this is the first time the button is pressed
-            if (!battery.startup.buttonSave) {
-                battery.startup.buttonTime = millis(); // Record the time the button was pressed
-                battery.startup.buttonSave = true; // Set the button pressed flag
-            } else {
-                // Check if the button has been pressed for at least 500ms
-                if (millis() - battery.startup.buttonTime >= 500) {
-                    // Button has been pressed long enough
-                    battery.chrgr.startupSave = true;
-                        digitalWrite(redLed, HIGH);
-                        digitalWrite(yellowLed, LOW);
-                        digitalWrite(greenLed, HIGH);
-                    // Determine battery size and save it
-                    battery.size = uint8_t(determineBatterySeries(battery.milliVoltage));
-
-                    if (battery.size == battery.sizeApprx) {
-                        preferences.begin("btry", false);
-                        preferences.putUChar("size", battery.size);
-                        preferences.end();
-                        // battery.timer.startupTimer = millis() + 10000; // Reset the startup timer
-                        digitalWrite(redLed, HIGH);
-                        digitalWrite(yellowLed, HIGH);
-                        green.setDelay(150);
-                        green.blink();
-                        Serial.println("Startup save success");
-                        battery.startup.startupSave = true; // Set the flag to true so we'll block our loop. Onetime use only!
-                    }
+/*
+    Commissioning window after boot, one step per control loop. Holding the save
+    button for 500 ms measures the pack and stores its series count. With
+    startup.skip and a plausible size already in NVS there is no window at all,
+    so a brown-out reboot goes straight back to work.
+    @return: true once the window is over
+*/
+bool Battery::startUpInit() {
+    if (battery.startup.startupSave || battery.starUpInit) return true;
+
+    if ((battery.startup.skip && battery.size > 5 && battery.size < 21) || millis() >= battery.timer.startupTimer) {
+        battery.starUpInit = true;
+        return true;
+    }
+
+    readVoltage(50);
+    digitalWrite(redLed, LOW);
+    digitalWrite(greenLed, HIGH);
+    digitalWrite(yellowLed, HIGH);
+
+    // Check if the button is pressed
+    if (digitalRead(saveButton) == LOW) {
+        // If this is the first time the button is pressed
+        if (!battery.startup.buttonSave) {
+            battery.startup.buttonTime = millis(); // Record the time the button was pressed
+            battery.startup.buttonSave = true; // Set the button pressed flag
+        } else {
+            // Check if the button has been pressed for at least 500ms
+            if (millis() - battery.startup.buttonTime >= 500) {
+                // Button has been pressed long enough
+                battery.chrgr.startupSave = true;
+                    digitalWrite(redLed, HIGH);
+                    digitalWrite(yellowLed, LOW);
+                    digitalWrite(greenLed, HIGH);
+                // Determine battery size and save it
+                battery.size = uint8_t(determineBatterySeries(battery.milliVoltage));
+
+                if (battery.size == battery.sizeApprx) {
+                    markSettingDirty(SET_SIZE);
+                    digitalWrite(redLed, HIGH);
+                    digitalWrite(yellowLed, HIGH);
+                    green.setDelay(150);
+                    green.blink();
+                    Serial.println("Startup save success");
+                    battery.startup.startupSave = true; // Onetime use only, ends the window
+                    battery.starUpInit = true;
+                    return true;
                 }
             }
-        } else {
-            // Button is not pressed
-            battery.startup.buttonSave = false; // Reset the button pressed flag
         }
+    } else {
+        // Button is not pressed
+        battery.startup.buttonSave = false; // Reset the button pressed flag
     }
-    battery.starUpInit = true;
-    }
+    return false;
 }
 /*
     the QuickPID Wrapping Function, executed every second. 
@@ -387,6 +453,7 @@ void Battery::runTune() {
     Control the PWM with updateHeaterPID function
 */
 void Battery::controlHeaterPWM() {
+    LOOP_TIMER(STAGE_HEATER);
 
     if(heaterPID.Compute()) {
         ledcWrite(PWM_CHANNEL, static_cast<uint32_t>(battery.heater.pidOutput));
@@ -394,28 +461,58 @@ void Battery::controlHeaterPWM() {
 }
 /*
         Dallas temp sensor function
-        @bried: Reads the temperature from the Dallas sensor
-        @return: float
+        @brief: Non-blocking DS18B20 read. A conversion is started every TEMP_INTERVAL,
+                then polled for ready on later calls, so the loop never waits the
+                94..750 ms conversion time on the 1-Wire bus.
 */
 void Battery::readTemperature() {
+    LOOP_TIMER(STAGE_TEMPERATURE);
 
-    if (millis() - dallasTime  >= 1500) {
-        dallasTime = millis();
-        dallas.requestTemperatures();
-        float temperature = dallas.getTempCByIndex(0);
+    if (!battery.ds.setup) {
+        dallas.begin();
+        dallas.setResolution(battery.ds.resolution);
+        dallas.setWaitForConversion(false);
+        battery.ds.setup = true;
+    }
 
-        if (temperature == DEVICE_DISCONNECTED_C) {
-            Serial.println(" Error: Could not read temperature data ");
-            battery.temperature = 127;
-        } 
-        else {
-            battery.temperature = temperature;
-            battery.heater.pidInput = temperature;
+    if (!battery.ds.pending) {
+        if (millis() - dallasTime >= TEMP_INTERVAL) {
+            dallasTime = millis();
+            dallas.requestTemperatures();       // returns right after the convert command
+            battery.ds.pending = true;
         }
+        return;
+    }
+
+    // conversion running, check the bus now and then, give up waiting after the datasheet time
+    if (millis() - dallasTime < uint32_t(dallas.millisToWaitForConversion(battery.ds.resolution))) {
+        if (millis() - battery.ds.pollTime < TEMP_POLL_MS) return;
+        battery.ds.pollTime = millis();
+        if (!dallas.isConversionComplete()) return;
+    }
+
+    battery.ds.pending = false;
+    float temperature = dallas.getTempCByIndex(0);
+
+    if (temperature == DEVICE_DISCONNECTED_C) {
+        Serial.println(" Error: Could not read temperature data ");
+        battery.temperature = 127;
+        battery.ds.filter.reset();              // no history across a disconnect
+        if (!tempFault) journal.log(JRN_FAULT, FAULT_TEMP_LOST, 0, uptimeSeconds());
+        tempFault = true;
+    } 
+    else {
+        if (tempFault) journal.log(JRN_FAULT, FAULT_TEMP_BACK, 0, uptimeSeconds());
+        tempFault = false;
+        battery.ds.filter.push(temperature);
+        temperature = battery.ds.filter.value(battery.ds.filterMode);
+        battery.temperature = temperature;
+        battery.heater.pidInput = temperature;
     }
 }
 
 void Battery::handleBatteryControl() {
+    LOOP_TIMER(STAGE_CONTROL);
 
     if (millis() - battery.stateMachine >= 2500) {
         battery.stateMachine = millis();
@@ -424,192 +521,33 @@ void Battery::handleBatteryControl() {
         battery.prevTState = battery.tState;    // copying the previous state to the previous state
 
         if(battery.temperature > 0 && battery.temperature < 40) { 
-            battery.vState = getVoltageState(battery.voltageInPrecent);  
+            battery.vState = getVoltageState(getStateOfCharge());  
         }
         else {   
             charger(false);
-            battery.tState = getTempState(battery.temperature);         
         }
-
-    switch (battery.vState) {
-            case ALERT:
-                    battery.tState = getTempState(battery.temperature);
-
-                    if(battery.tState != SUBZERO && battery.tState != TEMP_WARNING) 
-                        {
-                            charger(true); 
-                            // red.setDelay(1000, 1000);
-                            yellow.setDelay(1000, 0);
-                            green.setDelay(1000, 0);
-                        }
-                    else 
-                        { 
-                            charger(false);
-                            // red.setDelay(0, 1000);
-                        }
-                break;
-            case WARNING:
-                    battery.tState = getTempState(battery.temperature);
-
-                    if(battery.tState != SUBZERO && battery.tState != TEMP_WARNING) 
-                        { 
-                            charger(true); 
-                            //red.setDelay(1000);
-                            yellow.setDelay(1000, 1000);
-                            green.setDelay(1000, 0);
-                            
-                        }
-                    else 
-                        { 
-                            charger(false); 
-                            //red.setDelay(0, 1000);
-                        }
-                break;
-            case LOVV:
-                    // red.setDelay(1000, 0);
-                    yellow.setDelay(1000, 1000);
-                    green.setDelay(1000, 1000);
-
-                    battery.tState = getTempState(battery.temperature);
-
-                    if(battery.tState != SUBZERO && battery.tState != TEMP_WARNING) { charger(true); }
-
-                break;
-            case ECO:
-
-                    // red.setDelay(1000, 0);
-                    yellow.setDelay(2000, 0);
-                    green.setDelay(0, 1000);
-                    
-                    battery.tState = getTempState(battery.temperature);
-
-                    if(battery.tState != SUBZERO && battery.tState != TEMP_WARNING ) 
-                        { charger(true); }
-
-                break;
-            case BOOST:
-
-                    //red.setDelay(1000, 0);
-                    yellow.setDelay(2000, 0);
-                    green.setDelay(1000, 1000);
-
-                    battery.tState = getTempState(battery.temperature);
-
-                    if ((battery.tState != SUBZERO && battery.tState != TEMP_WARNING ) && battery.voltBoost)   // if not in cold or warning state, and boost is active
-                        { charger(true); }                                                         // then charge
-                    else 
-                        { charger(false); }
-                break;
-            case FULL:
-
-                    // red.setDelay(1000, 0);
-                    yellow.setDelay(2000, 0);
-                    green.setDelay(500, 500);
-
-                    battery.tState = getTempState(battery.temperature);
-
-                    if(getActivateVoltageBoost()) 
-                        { activateVoltageBoost(false); }
-
-                break;
-            default:
-
-                Serial.println("unknown type in the state machine");
-                digitalWrite(redLed, LOW);
-                charger(false);
-
-            break;
+        battery.tState = getTempState(battery.temperature);
+
+        uint32_t now = uptimeSeconds();
+        bool logged = false;
+        if (battery.vState != battery.prevVState) {
+            stateLog.append(LOG_VSTATE, battery.vState, battery.prevVState, now);
+            journal.log(JRN_VSTATE, battery.vState, battery.prevVState, now);
+            logged = true;
         }
+        if (battery.tState != battery.prevTState) {
+            stateLog.append(LOG_TSTATE, battery.tState, battery.prevTState, now);
+            journal.log(JRN_TSTATE, battery.tState, battery.prevTState, now);
+            logged = true;
+        }
+        if (logged) stateLogView.write(stateLog);
 
-    switch (battery.tState) {
-            case SUBZERO:
-
-                    digitalWrite(redLed, LOW);
-                    charger(false);
-
-                 break;
-            case COLD:
-
-                    digitalWrite(redLed, HIGH);
-                    if(battery.tempBoost) { 
-                        battery.heater.pidSetpoint = battery.heater.ecoTemp; 
-                    }
-                    else { 
-                        battery.heater.pidSetpoint = battery.heater.ecoTemp; 
-                    }
-
-                break;
-            case ECO_TEMP:
-
-                    digitalWrite(redLed, HIGH);
-                    if(battery.tempBoost) { 
-                        battery.heater.pidSetpoint = battery.heater.boostTemp; 
-                    }
-                    else { 
-                        battery.heater.pidSetpoint = battery.heater.ecoTemp; 
-                    }
-
-                break;
-            case ECO_READY:
-
-                    digitalWrite(redLed, HIGH);
-                    if(battery.tempBoost) { 
-                        battery.heater.pidSetpoint = battery.heater.boostTemp; 
-                    }
-                    else { 
-                        battery.heater.pidSetpoint = battery.heater.ecoTemp; 
-                    }
-
-                break;
-            case BOOST_TEMP:
-
-                    digitalWrite(redLed, HIGH);
-                    if(battery.tempBoost) { 
-                        battery.heater.pidSetpoint = battery.heater.boostTemp; 
-                    }
-                    else { 
-                        battery.heater.pidSetpoint = battery.heater.ecoTemp; 
-                    }
-
-                break;
-            case BOOST_READY:
-
-                    digitalWrite(redLed, HIGH);
-                    if(battery.tempBoost) { 
-                        battery.heater.pidSetpoint = battery.heater.boostTemp; 
-                    }
-                    else { 
-                        battery.heater.pidSetpoint = battery.heater.ecoTemp; 
-                    }
-                    activateTemperatureBoost(false);
-
-                break;
-            case TEMP_WARNING:
-
-                    digitalWrite(redLed, LOW);
-                    charger(false);
-                    battery.heater.pidSetpoint = 2;
-
-                    if( battery.heater.boostTemp - battery.temperature > 5) {
-                        battery.stune.error = true;
-                    }
-
-                break;
-            case UNKNOWN_TEMP:
-
-                digitalWrite(redLed, LOW);
-                charger(false);
-                heaterPID.SetMode(QuickPID::Control::manual);
-                currentState = STARTUP;
-
-                break;
-            default:
-
-                Serial.println("unknown type in the temp state");
-                digitalWrite(redLed, LOW);
+        if (battery.vState > FULL || battery.tState > UNKNOWN_TEMP) {
+            Serial.println("unknown type in the state machine");
+            charger(false);
+        }
+        else applyControl(controlTable.at(battery.vState, battery.tState));
 
-                break;
-    }
     #ifdef DEBUG
         Serial.print(currentState);
         Serial.print(" -> Temp: ");   
@@ -630,29 +568,89 @@ void Battery::handleBatteryControl() {
     battery.prevTState = battery.tState;    // copying the previous state to the previous state
     }
 }
+
+/*
+    Seconds since boot for the state log. Called every control step, so the
+    millis() delta never spans a wrap.
+*/
+uint32_t Battery::uptimeSeconds() {
+    uint32_t now = millis();
+    uptimeMs += now - uptimeLast;
+    uptimeLast = now;
+    uptimeS += uptimeMs / 1000;
+    uptimeMs %= 1000;
+    return uptimeS;
+}
+
+/*
+    Outputs for one control step, from the ControlTable lookup. The blinkers and
+    the red LED are only written when their pattern changes.
+*/
+void Battery::applyControl(const controlAction& action) {
+    switch (action.charger) {
+        case CHG_ON:    chargerRequest(true); break;
+        case CHG_OFF:   chargerRequest(false); break;
+        case CHG_BOOST: chargerRequest(battery.voltBoost); break;     // eco target reached without boost
+        case CHG_CUT:   charger(false); break;
+        case CHG_KEEP:  break;
+    }
+
+    if (action.leds != LED_KEEP && action.leds != ledsApplied) {
+        const ledTiming& led = ledTimings[action.leds];
+        yellow.setDelay(led.yellowOn, led.yellowOff);
+        green.setDelay(led.greenOn, led.greenOff);
+        ledsApplied = action.leds;
+    }
+
+    int8_t red = (action.flags & CTRL_RED_LED) ? HIGH : LOW;
+    if (red != redApplied) {
+        digitalWrite(redLed, red);
+        redApplied = red;
+    }
+
+    switch (action.heater) {
+        case HEAT_ECO:      battery.heater.pidSetpoint = battery.heater.ecoTemp; break;
+        case HEAT_BY_BOOST: battery.heater.pidSetpoint = battery.tempBoost ? battery.heater.boostTemp : battery.heater.ecoTemp; break;
+        case HEAT_SAFE:     battery.heater.pidSetpoint = HEATER_SAFE_SETPOINT; break;
+        case HEAT_KEEP:     break;
+    }
+
+    if ((action.flags & CTRL_CLEAR_VBOOST) && battery.voltBoost) activateVoltageBoost(false);
+    if ((action.flags & CTRL_CLEAR_TBOOST) && battery.tempBoost) activateTemperatureBoost(false);
+
+    if ((action.flags & CTRL_CHECK_TUNE) && battery.heater.boostTemp - battery.temperature > 5) {
+        battery.stune.error = true;
+    }
+    if (action.flags & CTRL_RESTART) {
+        journal.log(JRN_FAULT, FAULT_SENSOR_RESTART, battery.tState, uptimeSeconds());
+        heaterPID.SetMode(QuickPID::Control::manual);
+        currentState = STARTUP;
+        ledsApplied = LED_KEEP;             // startUpInit() drives the LEDs itself
+        redApplied = -1;
+    }
+}
 /*  State Machine for battery voltage levels and temperature levels
         Todo: add Boost reset state?
-        @brief: Simplifies the logic for the battery control
+        @brief: Simplifies the logic for the battery control. Moving up takes the
+                state's lower edge, moving down takes battery.vHyst[state] % more,
+                so a state of charge sitting on an edge does not flip the charger.
         @return: VoltageState enum
 */
 VoltageState Battery::getVoltageState(int voltagePrecent) {
-    if (voltagePrecent < 10) {
-        return ALERT;
-    } else if (voltagePrecent >= 10 && voltagePrecent < 20) {
-        return ALERT;
-    } else if (voltagePrecent >= 20 && voltagePrecent < 30) {
-        return WARNING;
-    } else if (voltagePrecent >= 30 && voltagePrecent < 50) {
-        return LOVV;
-    } else if (voltagePrecent >= 50 && voltagePrecent < battery.ecoVoltPrecent) {
-        return ECO;
-    } else if (voltagePrecent >= battery.ecoVoltPrecent && voltagePrecent < battery.boostVoltPrecent) {
-        return BOOST;
-    } else if (voltagePrecent >= battery.boostVoltPrecent && voltagePrecent > 99) {
-        return FULL;
-    } else {
-        return ALERT;
-    }
+    const int edge[FULL + 1] = {
+        0,                                              // ALERT
+        20,                                             // WARNING
+        30,                                             // LOVV
+        50,                                             // ECO
+        std::max(50, int(battery.ecoVoltPrecent)),      // BOOST
+        std::max(100, int(battery.boostVoltPrecent))    // FULL
+    };
+    int state = battery.vState <= FULL ? battery.vState : ALERT;
+
+    while (state < FULL && voltagePrecent >= edge[state + 1]) state++;
+    while (state > ALERT && voltagePrecent < edge[state] - battery.vHyst[state]) state--;
+
+    return VoltageState(state);
 }
 /*
     State machine for temperature levels, to simplify the logic 
@@ -678,153 +676,199 @@ TempState Battery::getTempState(float temperature) {
         }
 }
  
+/*
+    Mark a settings group (or ALL) for saving. Nothing is written here, the keys
+    go to flash in one commitSettings() round once the UI has been quiet for
+    SETTINGS_DEBOUNCE_MS, and only those whose value actually changed.
+*/
 void Battery::saveSettings(SettingsType type) {
-    preferences.begin("btry", false); 
+    settings.markGroup(type);
 
-    switch (type) {
-        case SETUP:
-            // Direct access to battery members
-            preferences.putString("myname", String(battery.name));
-            preferences.putUChar("size", constrain(battery.size, 0, 21));
+#ifdef DEBUG
+    Serial.print("Settings marked for save, group "); Serial.println(int(type));
+#endif
 
-            preferences.putUChar("chrgr",        constrain(battery.chrgr.current, 0, 15));     
-            preferences.putUChar("capct",        constrain(battery.capct, 0, 255));       
-            preferences.putFloat("temperature",  constrain(battery.temperature, float(-40), float(40)));
-            preferences.putUChar("currentVolt",  constrain(battery.voltageInPrecent, 1, 100));
-            preferences.putUChar("ecoVolt",      constrain(battery.ecoVoltPrecent, 1, 100));
-            preferences.putUChar("boostVolt",    constrain(battery.boostVoltPrecent, 1, 100));
+    // USer had changed settings. Lets make sure we have everything ok. 
 
-            preferences.putUChar("resistance",   constrain(battery.heater.resistance, 0, 255));
-            preferences.putUChar("boostTemp",    constrain(battery.heater.boostTemp, 1, 40));
-            preferences.putUChar("ecoTemp",      constrain(battery.heater.ecoTemp, 1, 30));
-            preferences.putUChar("maxPower",     constrain(battery.heater.powerLimit, 1, 255));
+    batteryInit();
 
-            preferences.putBool("tboost",        constrain(battery.tempBoost, 0, 1));
-            preferences.putBool("vboost",        constrain(battery.voltBoost, 0, 1));
+    battery.init = false;  // new settings loaded, so we need to check the user input! 
+}
 
-#ifdef DEBUG
-            // Print saved settings for debugging
-            Serial.println("Saved Settings (SETUP):");
-            Serial.print("Name: "); Serial.println(battery.name);
-            Serial.print("Size: "); Serial.println(battery.size);
-            Serial.print("Resistance: "); Serial.println(battery.heater.resistance);
-            Serial.print("Charger Current: "); Serial.println(battery.chrgr.current);
-            Serial.print("Capacity: "); Serial.println(battery.capct);
-            Serial.print("Temperature: "); Serial.println(battery.temperature);
-            Serial.print("Current Voltage: "); Serial.println(battery.voltageInPrecent);
-            Serial.print("Eco Voltage Percent: "); Serial.println(battery.ecoVoltPrecent);
-            Serial.print("Boost Voltage Percent: "); Serial.println(battery.boostVoltPrecent);
-            Serial.print("Boost Temperature: "); Serial.println(battery.heater.boostTemp);
-            Serial.print("Eco Temperature: "); Serial.println(battery.heater.ecoTemp);
-            Serial.print("Max Power: "); Serial.println(battery.heater.maxPower);
-            Serial.print("Power Limit: "); Serial.println(battery.heater.powerLimit);
-            Serial.print("Temperature Boost: "); Serial.println(battery.tempBoost);
-            Serial.print("Voltage Boost: "); Serial.println(battery.voltBoost);
-#endif
-            break;        
-        case WIFI:
-            preferences.putString("wssid", battery.wlan.ssid);  // Save the actual stored SSID
-            preferences.putString("wpass", battery.wlan.pass);  // Save the actual stored password
+void Battery::markSettingDirty(SettingKey key) {
+    settings.markDirty(key);
+}
 
-#ifdef DEBUG
-            // Print saved WiFi settings for debugging
-            Serial.println("Saved Settings (WIFI):");
-            Serial.print("SSID: "); Serial.println(battery.wlan.ssid);
-            Serial.print("Password: "); Serial.println(battery.wlan.pass);
-#endif
-            break;
+bool Battery::commitSettings(bool force) {
+    return settings.commit(preferences, battery, force);
+}
 
-        case HTTP:
-            preferences.putBool("httpen", battery.http.enable);
-            preferences.putString("httpusr", battery.http.username);
-            preferences.putString("httppass", battery.http.password);
+const settingsStats& Battery::getSettingsStats() {
+    return settings.getStats();
+}
 
-#ifdef DEBUG
-            // Print saved HTTP settings for debugging
-            Serial.println("Saved Settings (HTTP):");
-            Serial.print("HTTP Enabled: "); Serial.println(battery.http.enable);
-            Serial.print("Username: "); Serial.println(battery.http.username);
-            Serial.print("Password: "); Serial.println(battery.http.password);
-#endif
-            break;
+/*
+    The settings the control task reads, by key. Only controlLoop() calls
+    these setters: the comms task queues the change with queueControl() and
+    applyControlCommands() takes it at the start of the next step, so a step
+    never sees a setting change halfway or from another core.
+*/
+struct controlSetter {
+    SettingKey  key;
+    bool (*apply)(Battery& b, int32_t value);
+};
 
-        case MQTT:
-            preferences.putBool("mqtten", battery.mqtt.enable);
-            preferences.putString("mqttip", battery.mqtt.server);
-            preferences.putUInt("mqttport", battery.mqtt.port);
-            preferences.putString("mqttusr", battery.mqtt.username);
-            preferences.putString("mqttpass", battery.mqtt.password);
+static const controlSetter controlSetters[] = {
+    {SET_SIZE,          [](Battery& b, int32_t v) { if (v <= 0 || v > 255 || !b.setNominalString(uint8_t(v))) return false;
+                                                    b.batteryInit(); return true; }},
+    {SET_CHRGR,         [](Battery& b, int32_t v) { return b.setCharger(v); }},
+    {SET_CAPCT,         [](Battery& b, int32_t v) { return b.setCapacity(v); }},
+    {SET_ECO_VOLT,      [](Battery& b, int32_t v) { return b.setEcoPrecentVoltage(v); }},
+    {SET_BOOST_VOLT,    [](Battery& b, int32_t v) { return b.setBoostPrecentVoltage(v); }},
+    {SET_RESISTANCE,    [](Battery& b, int32_t v) { return v > 0 && v < 256 && b.setResistance(uint8_t(v)); }},
+    {SET_BOOST_TEMP,    [](Battery& b, int32_t v) { return b.setBoostTemp(v); }},
+    {SET_ECO_TEMP,      [](Battery& b, int32_t v) { return b.setEcoTemp(v); }},
+    {SET_TEMP_RES,      [](Battery& b, int32_t v) { return v > 0 && v < 256 && b.setTempResolution(uint8_t(v)); }},
+    {SET_TEMP_BOOST,    [](Battery& b, int32_t v) { b.activateTemperatureBoost(v != 0); return true; }},
+    {SET_VOLT_BOOST,    [](Battery& b, int32_t v) { b.activateVoltageBoost(v != 0); return true; }},
+    {SET_VOLT_FILTER,   [](Battery& b, int32_t v) { return v >= 0 && b.setVoltageFilter(uint8_t(v)); }},
+    {SET_TEMP_FILTER,   [](Battery& b, int32_t v) { return v >= 0 && b.setTemperatureFilter(uint8_t(v)); }},
+    {SET_CHEMISTRY,     [](Battery& b, int32_t v) { return v >= 0 && b.setChemistry(uint8_t(v)); }},
+    {SET_HYST_WARNING,  [](Battery& b, int32_t v) { return b.setHysteresis(WARNING, v); }},
+    {SET_HYST_LOVV,     [](Battery& b, int32_t v) { return b.setHysteresis(LOVV, v); }},
+    {SET_HYST_ECO,      [](Battery& b, int32_t v) { return b.setHysteresis(ECO, v); }},
+    {SET_HYST_BOOST,    [](Battery& b, int32_t v) { return b.setHysteresis(BOOST, v); }},
+    {SET_HYST_FULL,     [](Battery& b, int32_t v) { return b.setHysteresis(FULL, v); }},
+    {SET_CHRGR_MIN_ON,  [](Battery& b, int32_t v) { return b.setChargerMinOn(v); }},
+    {SET_CHRGR_MIN_OFF, [](Battery& b, int32_t v) { return b.setChargerMinOff(v); }},
+    {SET_QUICK_START,   [](Battery& b, int32_t v) { b.setQuickStart(v != 0); return true; }},
+};
 
-#ifdef DEBUG
-            // Print saved MQTT settings for debugging
-            Serial.println("Saved Settings (MQTT):");
-            Serial.print("MQTT Enabled: "); Serial.println(battery.mqtt.enable);
-            Serial.print("Server: "); Serial.println(battery.mqtt.server);
-            Serial.print("Port: "); Serial.println(battery.mqtt.port);
-            Serial.print("Username: "); Serial.println(battery.mqtt.username);
-            Serial.print("Password: "); Serial.println(battery.mqtt.password);
-#endif
-            break;
+static const controlSetter* findControlSetter(SettingKey key) {
+    for (const controlSetter& s : controlSetters) {
+        if (s.key == key) return &s;
+    }
+    return nullptr;
+}
 
-        case TELEGRAM:
-            preferences.putBool("tgen", battery.telegram.enable);
-            preferences.putString("tgtoken", battery.telegram.token); // Load Telegram token
-            preferences.putInt("tgusr", battery.telegram.chatId); // Load Telegram chat ID
+// Comms task
+bool Battery::queueControl(SettingKey key, int32_t value, bool mqtt) {
+    if (!findControlSetter(key) || !controlCmds.push({key, mqtt, value})) return false;
+    controlQueued++;
+    return true;
+}
 
-#ifdef DEBUG
-            // Print saved Telegram settings for debugging
-            Serial.println("Saved Settings (TELEGRAM):");
-            Serial.print("Telegram Enabled: "); Serial.println(battery.telegram.enable);
-            Serial.print("Token: "); Serial.println(battery.telegram.token);
-            Serial.print("Chat ID: "); Serial.println(battery.telegram.chatId);
-#endif
-            break;
+// Control task, start of every step
+void Battery::applyControlCommands() {
+    controlCommand cmd;
+    while (controlCmds.pop(cmd)) {
+        if (findControlSetter(cmd.key)->apply(*this, cmd.value)) markSettingDirty(cmd.key);
+        else if (cmd.mqtt) mqttRefused++;
+        controlDone.fetch_add(1, std::memory_order_release);
 
-        case PID:
-            preferences.putFloat("pidP", battery.heater.pidP);
-            preferences.putFloat("pidI", battery.heater.pidI);
-            preferences.putFloat("pidD", battery.heater.pidD);
-            preferences.putBool("tuneOk", battery.stune.done);
-            preferences.putBool("heatOn", battery.heater.enable);
-#ifdef DEBUG
-            // Print saved PID settings for debugging
-            Serial.println("Saved Settings (PID):");
-            Serial.print("PID P: "); Serial.println(battery.heater.pidP);
-            Serial.print("PID I: "); Serial.println(battery.heater.pidI);
-            Serial.print("PID D: "); Serial.println(battery.heater.pidD);
-            Serial.print("TuneOk: "); Serial.println(battery.stune.done);
-            Serial.print("HeatOn: "); Serial.println(battery.heater.enable);
-#endif
-            break;
+        #ifdef DEBUG
+        Serial.printf("Control set %u = %ld\n", unsigned(cmd.key), long(cmd.value));
+        #endif
+    }
+}
 
-        case ALL: // Save all settings
-            // Call each case to save all settings
-            saveSettings(SETUP);
-            saveSettings(WIFI);
-            saveSettings(HTTP);
-            saveSettings(MQTT);
-            saveSettings(TELEGRAM);
-            saveSettings(PID);
-
-                #ifdef DEBUG
-                Serial.println("Saved All Settings.");
-                #endif
-            break;
+/*
+    Web UI side, runs on the AsyncTCP task: only copies the value into the
+    queue. A value that does not fit is refused rather than cut short.
+*/
+bool Battery::queueSetting(SettingKey key, const String& value) {
+    uiChange change;
+    if (key >= SETTING_COUNT || value.length() >= sizeof(change.value)) return false;
+    change.key = key;
+    memcpy(change.value, value.c_str(), value.length() + 1);
+    return uiChanges.push(change);
+}
+
+bool Battery::queueReset() {
+    uiChange change;
+    change.key = SETTING_COUNT;
+    change.value[0] = '\0';
+    return uiChanges.push(change);
+}
+
+/*
+    Comms task: apply the queued UI changes in the order they were made and
+    mark them for the debounced commit. Control settings go on to the
+    control task.
+*/
+void Battery::applyUiChanges() {
+    uiChange change;
+    while (uiChanges.pop(change)) {
+        if (change.key == SETTING_COUNT) {
+            resetSettings(true);
+        }
+        else if (findControlSetter(change.key)) {
+            char* end;
+            long value = strtol(change.value, &end, 10);
+            if (end != change.value && *end == '\0') queueControl(change.key, int32_t(value), false);
+        }
+        else if (applySetting(change.key, change.value)) {
+            markSettingDirty(change.key);
+            if (change.key == SET_MQTT_SERVER || change.key == SET_MQTT_PORT) {
+                mqtt.disconnect();              // mqttSetup() gives the client the new broker
+                battery.mqtt.setup = false;
+                battery.link.state = LINK_DOWN; // a reconnect, not a drop
+            }
+        }
+
+        #ifdef DEBUG
+        Serial.printf("UI set %u = %s\n", unsigned(change.key), change.value);
+        #endif
     }
-    preferences.end();
+}
 
+/*
+    One comms side UI change by the kind of its setting, the name and the
+    MQTT format through their setters.
+*/
+bool Battery::applySetting(SettingKey key, const char* value) {
+    if (key == SET_NAME) return setHostname(value);
+    if (key == SET_MQTT_FORMAT) return setMqttFormat(uint8_t(atoi(value)));
 
-    // USer had changed settings. Lets make sure we have everything ok. 
+    const settingDef& d = SettingsStore::def(key);
+    if (d.group == SETUP || d.group == PID) return false;
 
-    batteryInit();
+    void* field = d.field(battery);
+    char* end;
+    long number = strtol(value, &end, 10);
+    bool numeric = end != value && *end == '\0';
 
-    battery.init = false;  // new settings loaded, so we need to check the user input! 
+    switch (d.kind) {
+        case KIND_STRING:
+            *static_cast<String*>(field) = value;
+            return true;
+        case KIND_BOOL:
+            if (!numeric) return false;
+            *static_cast<bool*>(field) = number != 0;
+            return true;
+        case KIND_U16:
+            if (!numeric || number <= 0 || number > UINT16_MAX) return false;
+            *static_cast<uint16_t*>(field) = uint16_t(number);
+            return true;
+        case KIND_I32:
+            if (!numeric) return false;
+            *static_cast<uint32_t*>(field) = uint32_t(number);
+            return true;
+        default:
+            return false;
+    }
 }
 
 void Battery::resetSettings(bool reset) {   
+    bool calibrated = settings.isDirty(SET_CALIBRATION);
+    settings.clear();           // pending changes would overwrite the defaults
+    if (calibrated) markSettingDirty(SET_CALIBRATION);     // the board's, not a user setting
     preferences.begin("btry", false);
 
     if (reset) {
+        preferences.remove(SETTINGS_BLOB_KEY);  // the per-key defaults below are migrated on next boot
+        // CAL_KEY stays, the voltage calibration belongs to the board
+
         // Reset all settings to default values
         preferences.putString("myname", "onni"); // Default name
         preferences.putUChar("size", 0);
@@ -838,8 +882,18 @@ void Battery::resetSettings(bool reset) {
         preferences.putUChar("boostTemp", 25);
         preferences.putUChar("ecoTemp", 15);
         preferences.putUChar("maxPower", 0);
+        preferences.putUChar("tempRes", 12);
         preferences.putBool("tboost", false);
         preferences.putBool("vboost", false);
+        preferences.putUChar("vfilter", FILTER_MEAN);
+        preferences.putUChar("tfilter", FILTER_NONE);
+        preferences.putUChar("chem", CHEM_NMC);
+        for (uint8_t i = WARNING; i <= FULL; i++) {
+            preferences.putUChar(SettingsStore::def(SettingKey(SET_HYST_WARNING + i - WARNING)).key, vStateHystDefault[i]);
+        }
+        preferences.putUShort("chrgrOn", CHARGER_MIN_ON_S);
+        preferences.putUShort("chrgrOff", CHARGER_MIN_OFF_S);
+        preferences.putBool("quickStart", false);
 
         // Reset WiFi settings
         //#ifndef DEBUG
@@ -855,9 +909,10 @@ void Battery::resetSettings(bool reset) {
         // Reset MQTT settings
         preferences.putBool("mqtten", false);
         preferences.putString("mqttip", "");  // Default MQTT server
-        preferences.putUInt("mqttport", 0);  // Default MQTT port
+        preferences.putUShort("mqttport", 1883);  // Default MQTT port
         preferences.putString("mqttusr", "");  // Default MQTT username
         preferences.putString("mqttpass", "");  // Default MQTT password
+        preferences.putUChar("mqttfmt", MQTT_FIELDS);  // Per-field topics
 
         // Reset Telegram settings
         preferences.putBool("tgen", false);
@@ -886,12 +941,51 @@ void Battery::resetSettings(bool reset) {
 }
 
 
+/*
+    Load settings: the packed ones with a single read of the settings blob, the
+    strings with their own keys. A unit with no valid blob yet (older firmware,
+    or a CRC error) is loaded from the old per-key layout and, on a full load,
+    migrated into a new blob right away. A blob from an older version is used
+    as it is and rewritten in the current layout.
+*/
 void Battery::loadSettings(SettingsType type) {
+    settingsBlob blob;
+
     preferences.begin("btry", true);
-    
-    switch (type) {
-        case SETUP:
-            // Direct access to battery members
+    BlobStatus status = settings.readBlob(preferences, blob);
+    bool valid = status == BLOB_OK || status == BLOB_UPGRADED;
+    const settingsBlob* packed = valid ? &blob : nullptr;
+
+    if (type == ALL) {
+        for (uint8_t group = SETUP; group < ALL; group++) loadGroup(SettingsType(group), packed);
+        battery.calibration.load(preferences);
+        calibration.write(battery.calibration);
+    }
+    else loadGroup(type, packed);
+
+    preferences.end();
+
+    if (status != BLOB_OK && type == ALL) {
+        #ifdef DEBUG
+        Serial.printf("Settings blob %d, rewriting it\n", int(status));
+        #endif
+        settings.markPacked();
+        commitSettings(true);
+    }
+
+    battery.init = false;
+}
+
+/*
+    One group from the open namespace, packed values from blob when there is one.
+*/
+void Battery::loadGroup(SettingsType type, const settingsBlob* blob) {
+    if (blob) SettingsStore::unpack(*blob, battery, type);
+
+    switch (type) {
+        case SETUP:
+            if (blob) break;
+            // Direct access to battery members
             battery.name = String(preferences.getString("myname", "Helmi"));
             battery.size = preferences.getUChar("size", 0);
             battery.temperature = preferences.getFloat("temperature", 0);
@@ -904,8 +998,20 @@ void Battery::loadSettings(SettingsType type) {
             battery.capct = constrain(preferences.getUChar("capct", 1), 1, 255);
             battery.chrgr.current = constrain(preferences.getUChar("chrgr", 0), 1, 5);
             battery.heater.powerLimit = constrain(preferences.getUChar("maxPower", 1), 1, 255);
+            battery.ds.resolution = constrain(preferences.getUChar("tempRes", 12), 9, 12);
+            battery.ds.setup = false;
             battery.tempBoost = preferences.getBool("tboost");
             battery.voltBoost = preferences.getBool("vboost");
+            battery.adc.filterMode = preferences.getUChar("vfilter", FILTER_MEAN) % FILTER_MODES;
+            battery.ds.filterMode = preferences.getUChar("tfilter", FILTER_NONE) % FILTER_MODES;
+            battery.chemistry = preferences.getUChar("chem", CHEM_NMC) % CHEM_COUNT;
+            for (uint8_t i = WARNING; i <= FULL; i++) {
+                const char* key = SettingsStore::def(SettingKey(SET_HYST_WARNING + i - WARNING)).key;
+                battery.vHyst[i] = constrain(preferences.getUChar(key, vStateHystDefault[i]), 0, VSTATE_HYST_MAX);
+            }
+            battery.chrgr.minOn = constrain(preferences.getUShort("chrgrOn", CHARGER_MIN_ON_S), 0, CHARGER_DWELL_MAX_S);
+            battery.chrgr.minOff = constrain(preferences.getUShort("chrgrOff", CHARGER_MIN_OFF_S), 0, CHARGER_DWELL_MAX_S);
+            battery.startup.skip = preferences.getBool("quickStart", false);
 
 #ifdef DEBUG
             // Print loaded settings for debugging
@@ -922,6 +1028,7 @@ void Battery::loadSettings(SettingsType type) {
             Serial.print("Capacity: "); Serial.println(battery.capct);
             Serial.print("Charger Current: "); Serial.println(battery.chrgr.current);
             Serial.print("Heater Max Power: "); Serial.println(battery.heater.maxPower);
+            Serial.print("Temp Resolution: "); Serial.println(battery.ds.resolution);
             Serial.print("Temperature Boost: "); Serial.println(battery.tempBoost);
             Serial.print("Voltage Boost: "); Serial.println(battery.voltBoost);
 #endif
@@ -940,7 +1047,7 @@ void Battery::loadSettings(SettingsType type) {
             break;
 
         case HTTP:
-            battery.http.enable = preferences.getBool("httpen");
+            if (!blob) battery.http.enable = preferences.getBool("httpen");
             battery.http.username = String(preferences.getString("httpusr"));
             battery.http.password = String(preferences.getString("httppass"));
 
@@ -954,11 +1061,16 @@ void Battery::loadSettings(SettingsType type) {
             break;
 
         case MQTT:
-            battery.mqtt.enable = preferences.getBool("mqtten");
+            if (!blob) {
+                battery.mqtt.enable = preferences.getBool("mqtten");
+                battery.mqtt.format = preferences.getUChar("mqttfmt", MQTT_FIELDS) & (MQTT_FIELDS | MQTT_STATE);
+                if (!battery.mqtt.format) battery.mqtt.format = MQTT_FIELDS;
+                battery.mqtt.port = preferences.getUShort("mqttport", 1883);
+                if (!battery.mqtt.port) battery.mqtt.port = 1883;
+            }
             battery.mqtt.username = String(preferences.getString("mqttusr"));
             battery.mqtt.password = String(preferences.getString("mqttpass"));
             battery.mqtt.server = String(preferences.getString("mqttip"));
-            // battery.mqtt.port = preferences.getInt("mqttport");
 
 #ifdef DEBUG
             // Print loaded MQTT settings for debugging
@@ -971,9 +1083,11 @@ void Battery::loadSettings(SettingsType type) {
             break;
 
         case TELEGRAM:
-            battery.telegram.enable = preferences.getBool("tgen");
+            if (!blob) {
+                battery.telegram.enable = preferences.getBool("tgen");
+                battery.telegram.chatId = preferences.getInt("tgusr");
+            }
             battery.telegram.token = preferences.getString("tgtoken");
-            battery.telegram.chatId = preferences.getInt("tgusr");
 
 #ifdef DEBUG
             // Print loaded Telegram settings for debugging
@@ -985,6 +1099,7 @@ void Battery::loadSettings(SettingsType type) {
             break;
 
         case PID:
+            if (blob) break;
             battery.heater.pidP = preferences.getFloat("pidP");
             battery.heater.pidI = preferences.getFloat("pidI");
             battery.heater.pidD = preferences.getFloat("pidD");
@@ -1003,18 +1118,8 @@ void Battery::loadSettings(SettingsType type) {
             break;
 
         case ALL:
-            // Load all settings by calling each case
-            loadSettings(SETUP);
-            loadSettings(WIFI);
-            loadSettings(HTTP); 
-            loadSettings(MQTT);
-            loadSettings(TELEGRAM);
-            loadSettings(PID);
             break;
     }
-    preferences.end();
-
-    battery.init = false;
 }
 /*
     Battery voltage reading function call. 
@@ -1023,62 +1128,91 @@ void Battery::loadSettings(SettingsType type) {
             but in a array. And this would lead into actionable data.
 */
 void Battery::readVoltage(uint32_t intervalSeconds) {
-    // Check if enough time has passed since the last reading
-    if (millis() - battery.adc.time >= intervalSeconds) {
+    LOOP_TIMER(STAGE_VOLTAGE);
+
+    /*
+        Two phase measure gate, nothing here waits: switch the divider on, come
+        back after adcSettleMs, let the DMA fill a window, switch it off again.
+        With the charger on the divider is powered anyway and sampling starts
+        right away.
+    */
+    if (battery.adc.phase == ADC_IDLE && millis() - battery.adc.time >= intervalSeconds) {
         battery.adc.time = millis(); // Update the time in the adc struct
 
-        if (!battery.chrgr.enable) {
+        battery.adc.gate = !battery.chrgr.enable;
+        if (battery.adc.gate) {
             gpio_set_direction(GPIO_NUM_32, GPIO_MODE_OUTPUT);
             gpio_set_level(GPIO_NUM_32, HIGH);
-            delay(6);
         }
+        battery.adc.phase = ADC_SETTLING;
+    }
 
-        // Read the voltage from the ADC
-        battery.adc.raw = adc1_get_raw(ADC_CHANNEL); // Store raw ADC value in the adc struct
+    if (battery.adc.phase == ADC_SETTLING) {
+        if (battery.adc.gate && millis() - battery.adc.time < adcSettleMs) return;
+        sampler.start();    // drops whatever was sampled with the divider off
+        battery.adc.phase = ADC_SAMPLING;
+        battery.adc.sampleTime = millis();
+    }
 
-        if (!battery.chrgr.enable) {
-            gpio_set_direction(GPIO_NUM_32, GPIO_MODE_OUTPUT);
-            gpio_set_level(GPIO_NUM_32, LOW);
-        }
+    if (battery.adc.phase != ADC_SAMPLING) return;
 
-        if (battery.firstRun) {
-            for (int i = 0; i < battery.adc.mAvg; i++) {
-                battery.adc.readings[i] = battery.adc.raw; // Use the first reading
-            }
-            battery.firstRun = false; // Set firstRun to false after initialization
-        }
+    // DMA not running or not delivering: never leave the divider on for good
+    bool timedOut = false;
+    if (!sampler.poll()) {
+        if (millis() - battery.adc.sampleTime < ADC_SAMPLE_TIMEOUT_MS) return;
+        timedOut = true;
+    }
+    sampler.stop();
+    battery.adc.phase = ADC_IDLE;
 
-        // Update the moving average array
-        battery.adc.readings[battery.adc.index] = battery.adc.raw; // Store the latest raw reading
-        battery.adc.index = (battery.adc.index + 1) % battery.adc.mAvg; // Increment index and wrap around
+    if (battery.adc.gate) {
+        gpio_set_direction(GPIO_NUM_32, GPIO_MODE_OUTPUT);
+        gpio_set_level(GPIO_NUM_32, LOW);
+        battery.adc.gate = false;
+    }
 
-        // Calculate the moving average
-        battery.adc.sum = 0; // Initialize sum to zero
-        for (int i = 0; i < battery.adc.mAvg; i++) 
-        {
-            battery.adc.sum += battery.adc.readings[i]; // Sum all readings
-        }
+    if (timedOut) {
+        battery.adc.timeouts++;
+        battery.milliVoltage = 1;       // same as a reading out of range below
+        battery.voltageInPrecent = 1;
+        Serial.println(" Voltage reading error: ADC DMA timeout ");
+        return;
+    }
 
-        battery.adc.avg = battery.adc.sum / battery.adc.mAvg; // Calculate average
-        battery.milliVoltage = esp_adc_cal_raw_to_voltage(battery.adc.avg, &characteristics) * float(30.81);
+    battery.adc.raw = sampler.value(); // Trimmed mean of the window in 1/16 counts
 
-        // Check if the moving average is within the valid range
-        if (battery.milliVoltage > 9000 && battery.milliVoltage < 100000) {
- 
-            // int newSeries = 
-            if (battery.sizeApprx < determineBatterySeries(battery.milliVoltage)) {
-                battery.sizeApprx = uint8_t(determineBatterySeries(battery.milliVoltage));
-            }
+    battery.adc.filter.push(battery.adc.raw);
+    battery.adc.avg = battery.adc.filter.value(battery.adc.filterMode);
 
-            battery.voltageInPrecent = getVoltageInPercentage(battery.milliVoltage);
-        } else {
-            battery.milliVoltage = 1; // Set the accurate voltage to 1 in case of reading error
-            battery.voltageInPrecent = 1; // Set the voltage in percentage to 1 in case of reading error
-            Serial.println(" Voltage reading error ");
-            Serial.print(" Voltage: ");
-            Serial.println(battery.adc.avg);
+    VoltageCalibration cal = calibration.read();
+    if (cal.active()) {
+        battery.milliVoltage = cal.toMilliVolts(battery.adc.avg);
+    }
+    else {
+        // Interpolate the calibration between the two whole counts to keep the extra resolution
+        uint32_t count = battery.adc.avg / ADC_OVERSAMPLE;
+        uint32_t lower = esp_adc_cal_raw_to_voltage(count, &characteristics);
+        uint32_t upper = esp_adc_cal_raw_to_voltage(count + 1, &characteristics);
+        float pinVoltage = lower + float(upper - lower) * (battery.adc.avg % ADC_OVERSAMPLE) / ADC_OVERSAMPLE;
+        battery.milliVoltage = pinVoltage * float(30.81);
+    }
+
+    // Check if the moving average is within the valid range
+    if (battery.milliVoltage > 9000 && battery.milliVoltage < 100000) {
+ 
+        // int newSeries = 
+        if (battery.sizeApprx < determineBatterySeries(battery.milliVoltage)) {
+            battery.sizeApprx = uint8_t(determineBatterySeries(battery.milliVoltage));
         }
-        
+
+        battery.voltageInPrecent = getVoltageInPercentage(battery.milliVoltage);
+        correctSoc();
+    } else {
+        battery.milliVoltage = 1; // Set the accurate voltage to 1 in case of reading error
+        battery.voltageInPrecent = 1; // Set the voltage in percentage to 1 in case of reading error
+        Serial.println(" Voltage reading error ");
+        Serial.print(" Voltage: ");
+        Serial.println(battery.adc.avg);
     }
 }
 /*
@@ -1087,42 +1221,48 @@ void Battery::readVoltage(uint32_t intervalSeconds) {
         b)to get faster state machine looping, without too much overhead.
         c) due to a bug, (negative return) it was left as float
 */
+/*
+    Coulomb counting, every pass: the configured charger current while it is on.
+*/
+void Battery::predictSoc() {
+    battery.soc.predict(millis(), battery.chrgr.enable, battery.chrgr.current, battery.capct);
+}
+
+/*
+    A new valid voltage reading. How far it is trusted is the per cell noise
+    (much larger while charging) through the local slope of the OCV curve.
+*/
+void Battery::correctSoc() {
+    if (battery.size == 0) return;
+
+    uint32_t cellMilliVolt = battery.milliVoltage / battery.size;
+    uint32_t noise = battery.chrgr.enable ? SOC_SIGMA_CHARGING_MV : SOC_SIGMA_REST_MV;
+    uint32_t sigma = (noise * ocvCurve(battery.chemistry).slope(cellMilliVolt) * 10) >> OCV_SHIFT;
+
+    battery.soc.correct(ocvCurve(battery.chemistry).socTenths(cellMilliVolt) * 10, sigma);
+}
+
+uint8_t Battery::getStateOfCharge() {
+    return battery.soc.ready() ? battery.soc.percent() : battery.voltageInPrecent;
+}
+
+/*
+    Pack voltage at a state of charge, from the chemistry's OCV curve.
+*/
 float Battery::btryToVoltage(int precent) {
-    if (precent > 0 && precent < 101) {
-        float milliVolts = 0.0f;
-        milliVolts = (battery.size * 3000);
-        milliVolts += (battery.size * (1200 * (float)precent ) / float(100));
-        return milliVolts / 1000;
-    }
-    else {
-        float volttis = ((battery.size * 3) + (battery.size * (float)1.2 * (precent / float(100))));
-        return volttis;
-    }
+    precent = constrain(precent, 0, 100);
+    return battery.size * ocvCurve(battery.chemistry).milliVolts(precent * 10) / 1000.0f;
 }
+
 /*
-    Lets convert the given milliVoltage to precentage at given series 
+    State of charge from the resting pack voltage: per cell voltage looked up
+    on the chemistry's OCV curve, clamped to 0 .. 100 %.
 */
 int Battery::getVoltageInPercentage(uint32_t milliVoltage) {
-    uint32_t minVoltage = 3000;  // Minimum voltage in millivolts (3V)
-    uint32_t maxVoltage = 4200;  // Maximum voltage in millivolts (4.2V)
-
-    milliVoltage = constrain(milliVoltage, 25000, 100000);
-    if (milliVoltage < (minVoltage * battery.size)) {
-        return 0;  // Below minimum voltage, 0% usable area
-        Serial.println("Below minimum voltage");
-    } else if (milliVoltage > (maxVoltage * battery.size)) {
-        return 0;  // Above maximum voltage, 100% usable area
-        Serial.println("Above maximum voltage");
-    } else {
-        uint32_t voltageRange = (maxVoltage - minVoltage) * battery.size;
-        uint32_t voltageDifference = milliVoltage - ( minVoltage * battery.size) ;
-        float result = ((float)voltageDifference / (float)voltageRange) * 100 ;  // Calculate percentage of usable area
-        // Serial.print("Voltage left:  ");
-        // Serial.println(voltageDifference);
-        // Serial.print("Result:  ");
-        // Serial.println(result);
-        return result;
-    }
+    if (battery.size == 0) return 0;
+
+    uint32_t cellMilliVolt = (milliVoltage + battery.size / 2) / battery.size;
+    return (ocvCurve(battery.chemistry).socTenths(cellMilliVolt) + 5) / 10;
 }
 /*
     Batterys Depth of Discharge percentage return.
@@ -1245,6 +1385,180 @@ bool Battery::setBoostTemp(int boostTemp) {
     else return false;
 }
 
+/*
+    DS18B20 resolution, 9..12 bit. Lower resolution converts faster (94 ms vs 750 ms),
+    the new value is applied on the next readTemperature() call.
+*/
+uint8_t Battery::getTempResolution() {
+    return battery.ds.resolution;
+}
+
+bool Battery::setTempResolution(uint8_t bits) {
+    if (bits > 8 && bits < 13) {
+        battery.ds.resolution = bits;
+        battery.ds.setup = false;
+        return true;
+    }
+    else return false;
+}
+
+/*
+    Cell chemistry, selects the OCV curve used for the state of charge and the
+    eco / boost voltages.
+*/
+uint8_t Battery::getChemistry() {
+    return battery.chemistry;
+}
+
+bool Battery::setChemistry(uint8_t chemistry) {
+    if (chemistry >= CHEM_COUNT) return false;
+    battery.chemistry = chemistry;
+    return true;
+}
+
+/*
+    Voltage state hysteresis in %, per state (see getVoltageState()), and the
+    minimum charger on / off times in seconds (see chargerRequest()).
+*/
+uint8_t Battery::getHysteresis(uint8_t vState) {
+    return vState <= FULL ? battery.vHyst[vState] : 0;
+}
+
+bool Battery::setHysteresis(uint8_t vState, int percent) {
+    if (vState == ALERT || vState > FULL || percent < 0 || percent > VSTATE_HYST_MAX) return false;
+    battery.vHyst[vState] = percent;
+    return true;
+}
+
+uint16_t Battery::getChargerMinOn() {
+    return battery.chrgr.minOn;
+}
+
+bool Battery::setChargerMinOn(int seconds) {
+    if (seconds < 0 || seconds > CHARGER_DWELL_MAX_S) return false;
+    battery.chrgr.minOn = seconds;
+    return true;
+}
+
+uint16_t Battery::getChargerMinOff() {
+    return battery.chrgr.minOff;
+}
+
+bool Battery::setChargerMinOff(int seconds) {
+    if (seconds < 0 || seconds > CHARGER_DWELL_MAX_S) return false;
+    battery.chrgr.minOff = seconds;
+    return true;
+}
+
+/*
+    Skip the commissioning window when NVS already has a valid pack size.
+*/
+bool Battery::getQuickStart() {
+    return battery.startup.skip;
+}
+
+void Battery::setQuickStart(bool skip) {
+    battery.startup.skip = skip;
+}
+
+/*
+    Smoothing of the voltage (per ADC window) and temperature (per conversion)
+    readings, see Filter.h. Takes effect on the next reading, history is kept.
+*/
+uint8_t Battery::getVoltageFilter() {
+    return battery.adc.filterMode;
+}
+
+bool Battery::setVoltageFilter(uint8_t mode) {
+    if (mode >= FILTER_MODES) return false;
+    battery.adc.filterMode = mode;
+    return true;
+}
+
+uint8_t Battery::getTemperatureFilter() {
+    return battery.ds.filterMode;
+}
+
+bool Battery::setTemperatureFilter(uint8_t mode) {
+    if (mode >= FILTER_MODES) return false;
+    battery.ds.filterMode = mode;
+    return true;
+}
+
+/*
+    Calibration mode: hold the pack at a steady voltage, read it with a meter
+    and send that value, repeat at a few levels across the range (e.g. empty,
+    eco, full). The point pairs it with the filtered ADC reading of the latest
+    control step, readVoltage() uses the new table from its next window and
+    the settings commit stores it. Comms side.
+*/
+bool Battery::addCalibrationPoint(uint32_t milliVolt) {
+    uint32_t raw = telemetry.read().adcAvg;
+    if (!raw) return false;                                 // nothing measured yet
+    if (!battery.calibration.add(raw, milliVolt)) return false;
+
+    calibration.write(battery.calibration);
+    markSettingDirty(SET_CALIBRATION);
+    return true;
+}
+
+void Battery::clearCalibration() {
+    battery.calibration.clear();
+    calibration.write(battery.calibration);
+    markSettingDirty(SET_CALIBRATION);
+}
+
+uint8_t Battery::getCalibrationPoints() {
+    return battery.calibration.size();
+}
+
+bool Battery::startJournal(uint8_t resetReason) {
+    return journal.begin(resetReason, uptimeSeconds());
+}
+
+uint16_t Battery::readJournal(journalRecord* out, uint16_t max, uint32_t below) {
+    return journal.newest(out, max, below);
+}
+
+bool Battery::requestJournalDump(int count) {
+    if (count <= 0 || !journal.stats().mounted) return false;
+    journalDump = count < JOURNAL_DUMP_MAX ? count : JOURNAL_DUMP_MAX;
+    journalDumpBelow = journal.nextSequence();     // the journal as it is now
+    return true;
+}
+
+void Battery::printJournal(uint16_t count) {
+    journalRecord recs[8];
+    uint16_t done = 0;
+    uint32_t below = UINT32_MAX;
+
+    while (done < count) {
+        uint16_t n = journal.newest(recs, count - done < 8 ? count - done : 8, below);
+        for (uint16_t i = 0; i < n; i++) {
+            const journalRecord& r = recs[i];
+            Serial.printf("%6lu  boot %-4u %8lu s  %-8s %3u %ld\n", (unsigned long)r.seq, r.boot,
+                          (unsigned long)r.seconds, Journal::eventName(r.type), r.arg, (long)r.value);
+        }
+        done += n;
+        if (n < 8) break;
+        below = recs[n - 1].seq;
+    }
+}
+
+/*
+    Time the voltage divider gets to settle after switching it on, before the
+    ADC window starts. Only used while the charger is off.
+*/
+uint8_t Battery::getAdcSettle() {
+    return adcSettleMs;
+}
+
+bool Battery::setAdcSettle(uint8_t ms) {
+    if (ms > ADC_SETTLE_MAX_MS) return false;
+    adcSettleMs = ms;
+    return true;
+}
+
 /*
     Temp and Voltage boost settings. 
         - Activate and deactivate the boost settings. 
@@ -1254,19 +1568,15 @@ bool Battery::setBoostTemp(int boostTemp) {
 */
 bool Battery::activateTemperatureBoost(bool tempBoost) {
     if(tempBoost) {
-            preferences.begin("btry", false);
             battery.tempBoost = true;
-            preferences.putBool("tboost", true);
-            preferences.end(); // Close preferences
+            markSettingDirty(SET_TEMP_BOOST);
             battery.stune.enable = true;
             battery.stune.startTime = millis();
             return true;
     }
     else {
-            preferences.begin("btry", false);
             battery.tempBoost = false;
-            preferences.putBool("tboost", false);
-            preferences.end(); // Close preferences
+            markSettingDirty(SET_TEMP_BOOST);
             return false;
         }
     }
@@ -1282,16 +1592,12 @@ bool Battery::getActivateTemperatureBoost() {
 bool Battery::activateVoltageBoost(bool voltBoost) {
     if(voltBoost) {
         battery.voltBoost = true;
-        preferences.begin("btry", false);           // Open preferences with namespace "battery_settings"
-        preferences.putBool("vboost", true);
-        preferences.end();                          // Close preferences
+        markSettingDirty(SET_VOLT_BOOST);
         return true;
     }
     else{
         battery.voltBoost = false;
-        preferences.begin("btry", false);           // Open preferences with namespace "battery_settings"
-        preferences.putBool("vboost", false);
-        preferences.end();                          // Close preferences
+        markSettingDirty(SET_VOLT_BOOST);
         return false;
     }
 }
@@ -1350,7 +1656,7 @@ int Battery::getCapacity()  {
     }
 */
 uint32_t Battery::determineBatterySeries(uint32_t measuredVoltage_mV) {
-    const uint32_t voltagePerCell_mV = 4200; // 4.2V on 4200 millivolttia
+    const uint32_t voltagePerCell_mV = ocvCurve(battery.chemistry).maxMilliVolts(); // full cell
     const uint32_t toleranceMultiplier = 5;  // 5% marginaali
     const uint32_t toleranceDivisor = 100;   // Jaetaan sadalla 5% marginaalin saamiseksi
 
@@ -1379,18 +1685,35 @@ int Battery::getBatteryApprxSize() {
     return battery.sizeApprx;
 }
 
+/*
+    Charger output, right away. Safety paths (temperature, unknown state) call
+    this directly; the GPIO is only touched when the output really changes.
+*/
 void Battery::charger(bool chargerState) {
-    if (chargerState) {
-        gpio_set_direction(GPIO_NUM_25, GPIO_MODE_OUTPUT);
-        gpio_set_level(GPIO_NUM_25, HIGH);
-        // Serial.print (" Chrgr: ON ");
-        battery.chrgr.enable = true;
-    } else {
-        gpio_set_direction(GPIO_NUM_25, GPIO_MODE_OUTPUT);
-        gpio_set_level(GPIO_NUM_25, LOW);
-        /// Serial.print(" Chrgr: OFF ");
-        battery.chrgr.enable = false;
+    if (chargerState == battery.chrgr.enable) return;
+
+    gpio_set_direction(GPIO_NUM_25, GPIO_MODE_OUTPUT);
+    gpio_set_level(GPIO_NUM_25, chargerState ? HIGH : LOW);
+    battery.chrgr.enable = chargerState;
+    battery.chrgr.switchTime = millis();
+    battery.chrgr.toggles++;
+    journal.log(JRN_CHARGER, chargerState, int32_t(battery.milliVoltage), uptimeSeconds());
+}
+
+/*
+    Charger output from the voltage state machine: once switched, the output
+    keeps its state for at least chrgr.minOn / chrgr.minOff seconds, so the
+    relay and the charger do not cycle every control period.
+*/
+void Battery::chargerRequest(bool chargerState) {
+    if (chargerState == battery.chrgr.enable) return;
+
+    uint32_t dwell = battery.chrgr.enable ? battery.chrgr.minOn : battery.chrgr.minOff;
+    if (battery.chrgr.toggles && millis() - battery.chrgr.switchTime < dwell * 1000UL) {
+        battery.chrgr.held++;
+        return;
     }
+    charger(chargerState);
 }
 
 bool Battery::isValidHostname(const String& hostname) {
@@ -1496,63 +1819,466 @@ bool Battery::getChargerStatus() {
 
 void Battery::publishBatteryData() {
     #ifdef MQTT_ENABLED
-        String baseTopic = "battery/" + String(battery.name) + "/";
-        mqtt.publish((baseTopic + "size").c_str(),                 String(battery.size).c_str());
-        mqtt.publish((baseTopic + "temperature").c_str(),          String(battery.temperature).c_str());
-        mqtt.publish((baseTopic + "voltageInPrecent").c_str(),     String(battery.voltageInPrecent).c_str());
-        mqtt.publish((baseTopic + "ecoVoltPrecent").c_str(),       String(battery.ecoVoltPrecent).c_str());
-        mqtt.publish((baseTopic + "boostVoltPrecent").c_str(),     String(battery.boostVoltPrecent).c_str());
-        mqtt.publish((baseTopic + "ecoTemp").c_str(),              String(battery.heater.ecoTemp).c_str());
-        mqtt.publish((baseTopic + "boostTemp").c_str(),            String(battery.heater.boostTemp).c_str());
-        mqtt.publish((baseTopic + "resistance").c_str(),           String(battery.heater.resistance).c_str());
-        mqtt.publish((baseTopic + "capct").c_str(),                String(battery.capct).c_str());
-        mqtt.publish((baseTopic + "chrgr").c_str(),                String(battery.chrgr.current).c_str());
-        mqtt.publish((baseTopic + "maxPower").c_str(),             String(battery.heater.maxPower).c_str());
-        mqtt.publish((baseTopic + "pidP").c_str(),                 String(battery.heater.pidP).c_str());
-        mqtt.publish((baseTopic + "pidI").c_str(),                 String(battery.heater.pidI).c_str());
-        mqtt.publish((baseTopic + "pidD").c_str(),                 String(battery.heater.pidD).c_str());
-        mqtt.publish((baseTopic + "tempBoost").c_str(),            String(battery.tempBoost).c_str());
-        mqtt.publish((baseTopic + "voltBoost").c_str(),            String(battery.voltBoost).c_str());
+        setTopicBase();
+
+        batteryTelemetry t = telemetry.read();
+        mqttSent = t;
+
+        if (battery.mqtt.format & MQTT_STATE) {
+            formatState(mqttState, sizeof(mqttState));
+            snprintf(mqttTopic + mqttTopicBase, sizeof(mqttTopic) - mqttTopicBase, "state");
+            mqtt.publish(mqttTopic, mqttState);
+        }
+        if (!(battery.mqtt.format & MQTT_FIELDS)) return;
+
+        publishField("size",              "%d",   battery.size);
+        publishField("temperature",       "%.2f", t.temperature);
+        publishField("voltageInPrecent",  "%d",   t.voltageInPrecent);
+        publishField("ecoVoltPrecent",    "%d",   battery.ecoVoltPrecent);
+        publishField("boostVoltPrecent",  "%d",   battery.boostVoltPrecent);
+        publishField("ecoTemp",           "%d",   battery.heater.ecoTemp);
+        publishField("boostTemp",         "%d",   battery.heater.boostTemp);
+        publishField("resistance",        "%d",   battery.heater.resistance);
+        publishField("capct",             "%d",   battery.capct);
+        publishField("chrgr",             "%d",   battery.chrgr.current);
+        publishField("maxPower",          "%d",   battery.heater.maxPower);
+        publishField("pidP",              "%.2f", battery.heater.pidP);
+        publishField("pidI",              "%.2f", battery.heater.pidI);
+        publishField("pidD",              "%.2f", battery.heater.pidD);
+        publishField("tempBoost",         "%d",   battery.tempBoost);
+        publishField("voltBoost",         "%d",   battery.voltBoost);
+        publishField("vState",            "%d",   t.vState);
+        publishField("tState",            "%d",   t.tState);
+        publishField("charger",           "%d",   t.chargerOn);
+        publishField("heater",            "%d",   t.heaterOn);
+        publishField("soc",               "%.1f", t.socEstimate / 100.0f);
+        publishField("socConfidence",     "%d",   t.socConfidence);
+        publishField("chargeEta",         "%d",   t.chargeEta);
+        publishField("chargerToggles",    "%lu",  (unsigned long)t.chargerToggles);
      
         // Publish MQTT settings
-        mqtt.publish((baseTopic + "mqtt/enable").c_str(),          String(battery.mqtt.enable).c_str());
+        publishField("mqtt/enable",       "%d",   battery.mqtt.enable);
         // Publish Telegram settings
-        mqtt.publish((baseTopic + "telegram/enable").c_str(),      String(battery.telegram.enable).c_str());
-        // }
+        publishField("telegram/enable",   "%d",   battery.telegram.enable);
         #endif
 }
 
+/*
+    Whole telemetry snapshot and the settings as one compact JSON object:
+    {"time":..,"mV":..,"soc":..,"temp":..,"vState":..,"tState":..,"charger":..,"heater":..,...}
+    Written with snprintf into the caller's buffer, no heap.
+*/
+size_t Battery::formatState(char* buf, size_t len) {
+    batteryTelemetry t = telemetry.read();
+
+    int n = snprintf(buf, len,
+        "{\"time\":%lu,\"mV\":%lu,\"soc\":%d,\"temp\":%.2f,\"vState\":%d,\"tState\":%d,"
+        "\"charger\":%d,\"heater\":%d,\"pidOutput\":%.1f,\"pidSetpoint\":%.1f,"
+        "\"init\":%d,\"initLevel\":%d,\"size\":%d,\"sizeApprx\":%d,"
+        "\"ecoVoltPrecent\":%d,\"boostVoltPrecent\":%d,\"ecoTemp\":%d,\"boostTemp\":%d,"
+        "\"voltBoost\":%d,\"tempBoost\":%d,\"resistance\":%d,\"capct\":%d,\"chrgr\":%d,\"maxPower\":%d,"
+        "\"pidP\":%.2f,\"pidI\":%.2f,\"pidD\":%.2f,\"socEst\":%.1f,\"socConf\":%d,\"eta\":%d,\"toggles\":%lu}",
+        (unsigned long)t.time, (unsigned long)t.milliVoltage, t.voltageInPrecent, t.temperature, t.vState, t.tState,
+        t.chargerOn, t.heaterOn, t.pidOutput, t.pidSetpoint,
+        t.init, t.initLevel, battery.size, t.sizeApprx,
+        battery.ecoVoltPrecent, battery.boostVoltPrecent, battery.heater.ecoTemp, battery.heater.boostTemp,
+        battery.voltBoost, battery.tempBoost, battery.heater.resistance, battery.capct, battery.chrgr.current, battery.heater.maxPower,
+        battery.heater.pidP, battery.heater.pidI, battery.heater.pidD,
+        t.socEstimate / 100.0f, t.socConfidence, t.chargeEta, (unsigned long)t.chargerToggles);
+
+    return n < 0 ? 0 : size_t(n);
+}
+
+/*
+    Between keyframes: publish only what moved past its deadband since it was last
+    sent. Voltage / temperature state, charger and heater go out on any change.
+    In MQTT_STATE mode any such change sends the whole state JSON.
+*/
+void Battery::publishDelta() {
+    #ifdef MQTT_ENABLED
+        uint32_t version = telemetry.version();
+        if (version == mqttSentVersion) return;
+        mqttSentVersion = version;
+
+        batteryTelemetry t = telemetry.read();
+
+        bool temp    = fabsf(t.temperature - mqttSent.temperature) >= MQTT_DEADBAND_TEMP;
+        bool soc     = abs(int(t.voltageInPrecent) - int(mqttSent.voltageInPrecent)) >= MQTT_DEADBAND_SOC;
+        bool socEst  = abs(int(t.socEstimate) - int(mqttSent.socEstimate)) >= MQTT_DEADBAND_SOC * 100;
+        bool vState  = t.vState != mqttSent.vState;
+        bool tState  = t.tState != mqttSent.tState;
+        bool charger = t.chargerOn != mqttSent.chargerOn;
+        bool heater  = t.heaterOn != mqttSent.heaterOn;
+
+        if (!(temp || soc || socEst || vState || tState || charger || heater)) return;
+
+        setTopicBase();
+
+        // Only what the broker took moves the reference, a failed field goes again next pass
+        bool tempSent = false, socSent = false, socEstSent = false, vStateSent = false,
+             tStateSent = false, chargerSent = false, heaterSent = false;
+
+        if (battery.mqtt.format & MQTT_FIELDS) {
+            if (temp)    tempSent    = publishField("temperature",      "%.2f", t.temperature);
+            if (soc)     socSent     = publishField("voltageInPrecent", "%d",   t.voltageInPrecent);
+            if (socEst)  socEstSent  = publishField("soc",              "%.1f", t.socEstimate / 100.0f);
+            if (socEst)  socEstSent &= publishField("chargeEta",        "%d",   t.chargeEta);
+            if (vState)  vStateSent  = publishField("vState",           "%d",   t.vState);
+            if (tState)  tStateSent  = publishField("tState",           "%d",   t.tState);
+            if (charger) chargerSent = publishField("charger",          "%d",   t.chargerOn);
+            if (heater)  heaterSent  = publishField("heater",           "%d",   t.heaterOn);
+        }
+        if (battery.mqtt.format & MQTT_STATE) {
+            formatState(mqttState, sizeof(mqttState));
+            snprintf(mqttTopic + mqttTopicBase, sizeof(mqttTopic) - mqttTopicBase, "state");
+            if (mqtt.publish(mqttTopic, mqttState)) {       // carries every field
+                tempSent = socSent = socEstSent = vStateSent = tStateSent = chargerSent = heaterSent = true;
+            }
+        }
+
+        if (temp && tempSent)       mqttSent.temperature      = t.temperature;
+        if (soc && socSent)         mqttSent.voltageInPrecent = t.voltageInPrecent;
+        if (socEst && socEstSent)   mqttSent.socEstimate      = t.socEstimate;
+        if (vStateSent)             mqttSent.vState           = t.vState;
+        if (tStateSent)             mqttSent.tState           = t.tState;
+        if (chargerSent)            mqttSent.chargerOn        = t.chargerOn;
+        if (heaterSent)             mqttSent.heaterOn         = t.heaterOn;
+    #endif
+}
+
+/*
+    "battery/<name>/" into mqttTopic, fields are appended after it by publishField().
+*/
+void Battery::setTopicBase() {
+    int n = snprintf(mqttTopic, sizeof(mqttTopic), "battery/%s/", battery.name.c_str());
+    mqttTopicBase = n < 0 ? 0 : constrain(size_t(n), size_t(0), sizeof(mqttTopic) - 1);
+}
+
+/*
+    Format one value into the fixed topic / payload buffers and publish it.
+    Same text as the old String(value) payloads: integers plain, floats with 2 decimals.
+*/
+bool Battery::publishField(const char* field, const char* format, ...) {
+    #ifdef MQTT_ENABLED
+        snprintf(mqttTopic + mqttTopicBase, sizeof(mqttTopic) - mqttTopicBase, "%s", field);
+
+        va_list args;
+        va_start(args, format);
+        vsnprintf(mqttPayload, sizeof(mqttPayload), format, args);
+        va_end(args);
+
+        return mqtt.publish(mqttTopic, mqttPayload);
+    #else
+        return false;
+    #endif
+}
+
+/*
+    Loop timing per stage on battery/<name>/timing/<stage>, as JSON with the log2 histogram.
+*/
+void Battery::publishLoopStats() {
+    #ifdef MQTT_ENABLED
+        char topic[64];
+        char payload[256];
+
+        for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+            snprintf(topic, sizeof(topic), "battery/%s/timing/%s", battery.name.c_str(), LoopStats::name(LoopStage(i)));
+            LoopStats::formatJson(LoopStage(i), payload, sizeof(payload));
+            mqtt.publish(topic, payload);
+        }
+    #endif
+}
+
 void Battery::mqttSetup() {
     #ifdef MQTT_ENABLED
-    preferences.begin("btry", true);
-        battery.mqtt.enable     = preferences.getBool("mqtten");
-        battery.mqtt.server     = preferences.getString("mqttip");
-        battery.mqtt.port       = preferences.getInt("mqttport", 1883);
-        battery.mqtt.username   = preferences.getString("mqttusr");
-        battery.mqtt.password   = preferences.getString("mqttpass");
-    preferences.end();
-    mqtt.setServer(battery.mqtt.server.c_str(), uint16_t(battery.mqtt.port));
+    if (!settings.isDirty(MQTT)) loadSettings(MQTT);   // a change not yet in flash is newer
+
+    snprintf(mqttHost, sizeof(mqttHost), "%s", battery.mqtt.server.c_str());
+    mqtt.setServer(mqttHost, uint16_t(battery.mqtt.port));
+    mqtt.setBufferSize(512);        // room for the timing histograms
+    mqtt.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+    mqtt.setCallback([this](char* topic, uint8_t* payload, unsigned int length) {
+        onMqttMessage(topic, payload, length);
+    });
     battery.mqtt.setup = true;
     #endif
 }
 
+/*
+    MQTT link state machine, called every comms pass. Does at most one
+    mqtt.connect() per call and only once the backoff has run out; without
+    WiFi it only checks again every MQTT_BACKOFF_MIN_MS, rejoining is
+    WifiLink's job. The broker backoff doubles per failure up to
+    MQTT_BACKOFF_MAX_MS and the retry lands randomly in its second half, so a
+    fleet that lost the broker at the same moment does not reconnect in
+    lockstep.
+    Returns true while connected.
+*/
+bool Battery::mqttConnect() {
+    #ifdef MQTT_ENABLED
+    uint32_t now = millis();
+
+    if (mqtt.connected()) {
+        if (battery.link.state != LINK_UP) mqttLinkUp();
+        return true;
+    }
+
+    if (battery.link.state == LINK_UP) {
+        battery.link.drops++;
+        battery.link.nextAttempt = now;         // first retry right away
+    }
+    else if (battery.link.state == LINK_DOWN) {
+        battery.link.nextAttempt = now;         // first try right away, whatever millis() is
+    }
+    battery.link.state = LINK_BACKOFF;
+
+    if (int32_t(now - battery.link.nextAttempt) < 0) return false;
+
+    bool wifi = WiFi.isConnected();
+    if (wifi) {
+        uint32_t start = millis();
+        battery.link.attempts++;
+        bool ok = mqtt.connect(battery.name.c_str(), battery.mqtt.username.c_str(), battery.mqtt.password.c_str());
+
+        uint32_t took = millis() - start;
+        battery.link.connectMs += took;
+        if (took > battery.link.maxConnectMs) battery.link.maxConnectMs = took;
+
+        if (ok) {
+            mqttLinkUp();
+            return true;
+        }
+        battery.link.failures++;
+    }
+    else {
+        // WifiLink relinks in well under a second: poll for it at the shortest
+        // period instead of growing the backoff through a long outage
+        battery.link.wifiRetries++;
+        battery.link.nextAttempt = now + MQTT_BACKOFF_MIN_MS;
+        return false;
+    }
+
+    uint32_t backoff = battery.link.backoffMs * 2;
+    battery.link.backoffMs = constrain(backoff, uint32_t(MQTT_BACKOFF_MIN_MS), uint32_t(MQTT_BACKOFF_MAX_MS));
+    battery.link.nextAttempt = millis() + battery.link.backoffMs / 2 + random(battery.link.backoffMs / 2 + 1);
+
+    #ifdef DEBUG
+    Serial.printf("MQTT %s failed (%d), retry in %lu ms\n", wifi ? "connect" : "WiFi", mqtt.state(),
+                  (unsigned long)(battery.link.nextAttempt - millis()));
+    #endif
+    #endif
+    return false;
+}
+
+/*
+    Fresh connection: reset the backoff, subscribe to the command topics and
+    send a keyframe on the next handleMqtt() pass.
+*/
+void Battery::mqttLinkUp() {
+    #ifdef MQTT_ENABLED
+    battery.link.state = LINK_UP;
+    battery.link.backoffMs = 0;
+    battery.mqtt.lastMessageTime = millis() - MQTT_KEYFRAME_MS - 1;
+
+    setTopicBase();
+    snprintf(mqttTopic + mqttTopicBase, sizeof(mqttTopic) - mqttTopicBase, "set/#");
+    mqtt.subscribe(mqttTopic);
+    #endif
+}
+
 void Battery::handleMqtt() {
+    LOOP_TIMER(STAGE_MQTT);
+
     #ifdef MQTT_ENABLED
     
     if(!battery.mqtt.setup)  mqttSetup();
 
     if(battery.mqtt.enable) { 
+        if (!mqttConnect()) return;
+
         mqtt.loop();
-        if (millis() - battery.mqtt.lastMessageTime > 60000 ) {
+        applyMqttCommands();
+        if (millis() - battery.mqtt.lastMessageTime > MQTT_KEYFRAME_MS ) {
             battery.mqtt.lastMessageTime = millis();
-            if(WiFi.isConnected()) {
-                if(mqtt.connected()) publishBatteryData();
-                else mqtt.connect(battery.name.c_str(), battery.mqtt.username.c_str(), battery.mqtt.password.c_str());
-            }
-            else WiFi.reconnect();
+            publishBatteryData();
+            publishLoopStats();
+            publishLinkStats();
+            publishSettingsStats();
+        }
+        else publishDelta();
+        publishJournal();
+    }
+
+    #endif
+}
+
+/*
+    NVS flash write counters on battery/<name>/nvs, sent with every keyframe.
+*/
+void Battery::publishSettingsStats() {
+    #ifdef MQTT_ENABLED
+        const settingsStats& st = settings.getStats();
+        setTopicBase();
+        snprintf(mqttTopic + mqttTopicBase, sizeof(mqttTopic) - mqttTopicBase, "nvs");
+        snprintf(mqttState, sizeof(mqttState), "{\"commits\":%lu,\"writes\":%lu,\"skipped\":%lu}",
+                 (unsigned long)st.commits, (unsigned long)st.writes, (unsigned long)st.skipped);
+        mqtt.publish(mqttTopic, mqttState);
+    #endif
+}
+
+/*
+    Requested journal dump on battery/<name>/journal, one record per message,
+    newest first, a few per pass so the comms loop stays responsive.
+*/
+void Battery::publishJournal() {
+    #ifdef MQTT_ENABLED
+    journalRecord recs[4];
+    if (!journalDump) return;
+
+    uint16_t n = journal.newest(recs, journalDump < 4 ? journalDump : 4, journalDumpBelow);
+    setTopicBase();
+    snprintf(mqttTopic + mqttTopicBase, sizeof(mqttTopic) - mqttTopicBase, "journal");
+    for (uint16_t i = 0; i < n; i++) {
+        const journalRecord& r = recs[i];
+        snprintf(mqttState, sizeof(mqttState),
+                 "{\"seq\":%lu,\"boot\":%u,\"t\":%lu,\"event\":\"%s\",\"arg\":%u,\"value\":%ld}",
+                 (unsigned long)r.seq, r.boot, (unsigned long)r.seconds, Journal::eventName(r.type),
+                 r.arg, (long)r.value);
+        mqtt.publish(mqttTopic, mqttState);
+    }
+    journalDump -= n;
+    if (n) journalDumpBelow = recs[n - 1].seq;
+    if (n < 4) journalDump = 0;                 // journal holds no more
+    #endif
+}
+
+/*
+    Remote control: battery/<name>/set/<field> with the new value as payload, the
+    field names are the ones publishBatteryData() uses. Control settings go to
+    the control task by key and through the same setter as the web UI's, so
+    the same limits apply; the rest are applied here on the comms task.
+*/
+struct mqttSetter {
+    const char* field;
+    SettingKey  key;                        // marked dirty when applied
+    bool (*apply)(Battery& b, int value);   // nullptr: control setting, queued
+};
+
+static const mqttSetter mqttSetters[] = {
+    {"voltBoost",        SET_VOLT_BOOST,    nullptr},
+    {"tempBoost",        SET_TEMP_BOOST,    nullptr},
+    {"ecoVoltPrecent",   SET_ECO_VOLT,      nullptr},
+    {"boostVoltPrecent", SET_BOOST_VOLT,    nullptr},
+    {"ecoTemp",          SET_ECO_TEMP,      nullptr},
+    {"boostTemp",        SET_BOOST_TEMP,    nullptr},
+    {"chrgr",            SET_CHRGR,         nullptr},
+    {"capct",            SET_CAPCT,         nullptr},
+    {"resistance",       SET_RESISTANCE,    nullptr},
+    {"tempRes",          SET_TEMP_RES,      nullptr},
+    {"voltFilter",       SET_VOLT_FILTER,   nullptr},
+    {"tempFilter",       SET_TEMP_FILTER,   nullptr},
+    {"chemistry",        SET_CHEMISTRY,     nullptr},
+    {"hystWarning",      SET_HYST_WARNING,  nullptr},
+    {"hystLovv",         SET_HYST_LOVV,     nullptr},
+    {"hystEco",          SET_HYST_ECO,      nullptr},
+    {"hystBoost",        SET_HYST_BOOST,    nullptr},
+    {"hystFull",         SET_HYST_FULL,     nullptr},
+    {"chrgrMinOn",       SET_CHRGR_MIN_ON,  nullptr},
+    {"chrgrMinOff",      SET_CHRGR_MIN_OFF, nullptr},
+    {"quickStart",       SET_QUICK_START,   nullptr},
+    {"calPoint",         SET_CALIBRATION, [](Battery& b, int v) { return v > 0 && b.addCalibrationPoint(uint32_t(v)); }},
+    {"calClear",         SET_CALIBRATION, [](Battery& b, int v) { if (v) b.clearCalibration(); return v != 0; }},
+    // not a setting
+    {"journal",          SETTING_COUNT,  [](Battery& b, int v) { return b.requestJournalDump(v); }},
+};
+
+static const uint8_t mqttSetterCount = sizeof(mqttSetters) / sizeof(mqttSetters[0]);
+
+/*
+    PubSubClient callback, runs inside mqtt.loop(). Only looks the field up and
+    copies the payload into the fixed command queue: no heap, no NVS.
+*/
+void Battery::onMqttMessage(char* topic, uint8_t* payload, unsigned int length) {
+    setTopicBase();
+    snprintf(mqttTopic + mqttTopicBase, sizeof(mqttTopic) - mqttTopicBase, "set/");
+    size_t prefix = strlen(mqttTopic);
+    if (strncmp(topic, mqttTopic, prefix) != 0) return;
+
+    const char* field = topic + prefix;
+    uint8_t i = 0;
+    while (i < mqttSetterCount && strcmp(field, mqttSetters[i].field) != 0) i++;
+
+    if (i == mqttSetterCount || length == 0 || length >= MQTT_CMD_VALUE_LEN || mqttCmdCount == MQTT_CMD_QUEUE) {
+        battery.link.rejected++;
+        return;
+    }
+
+    mqttCommand& cmd = mqttCmdQueue[(mqttCmdHead + mqttCmdCount) % MQTT_CMD_QUEUE];
+    cmd.index = i;
+    memcpy(cmd.value, payload, length);
+    cmd.value[length] = '\0';
+    mqttCmdCount++;
+}
+
+/*
+    Apply queued commands, or hand them to the control task, and mark the
+    changed settings for the debounced NVS commit. Once the control task has
+    taken everything queued, a keyframe shows the sender the values that were
+    taken and the link stats count the values its setters refused.
+*/
+void Battery::applyMqttCommands() {
+    while (mqttCmdCount) {
+        mqttCommand& cmd = mqttCmdQueue[mqttCmdHead];
+        mqttCmdHead = (mqttCmdHead + 1) % MQTT_CMD_QUEUE;
+        mqttCmdCount--;
+
+        const mqttSetter& setter = mqttSetters[cmd.index];
+        char* end;
+        long value = strtol(cmd.value, &end, 10);
+        bool ok = end != cmd.value && *end == '\0';
+
+        if (ok && !setter.apply) {
+            ok = queueControl(setter.key, int32_t(value), true);
         }
+        else if (ok) {
+            ok = setter.apply(*this, int(value));
+            if (ok) markSettingDirty(setter.key);
+        }
+
+        if (ok) {
+            battery.link.commands++;
+            mqttKeyframeDue = true;
+        }
+        else battery.link.rejected++;
+
+        #ifdef DEBUG
+        Serial.printf("MQTT set %s = %s\n", setter.field, cmd.value);
+        #endif
+    }
+
+    if (mqttKeyframeDue && controlDone.load(std::memory_order_acquire) == controlQueued) {
+        uint32_t refused = mqttRefused.exchange(0);
+        battery.link.commands -= refused;
+        battery.link.rejected += refused;
+        battery.mqtt.lastMessageTime = millis() - MQTT_KEYFRAME_MS - 1;
+        mqttKeyframeDue = false;
     }
+}
 
+/*
+    Reconnect metrics on battery/<name>/mqtt/link, sent with every keyframe.
+*/
+void Battery::publishLinkStats() {
+    #ifdef MQTT_ENABLED
+        setTopicBase();
+        snprintf(mqttTopic + mqttTopicBase, sizeof(mqttTopic) - mqttTopicBase, "mqtt/link");
+        snprintf(mqttState, sizeof(mqttState),
+            "{\"attempts\":%lu,\"failures\":%lu,\"drops\":%lu,\"wifiRetries\":%lu,\"connectMs\":%lu,\"maxConnectMs\":%lu,"
+            "\"commands\":%lu,\"rejected\":%lu}",
+            (unsigned long)battery.link.attempts, (unsigned long)battery.link.failures, (unsigned long)battery.link.drops,
+            (unsigned long)battery.link.wifiRetries, (unsigned long)battery.link.connectMs, (unsigned long)battery.link.maxConnectMs,
+            (unsigned long)battery.link.commands, (unsigned long)battery.link.rejected);
+        mqtt.publish(mqttTopic, mqttState);
     #endif
 }
 
@@ -1572,6 +2298,17 @@ bool Battery::setMqttState(bool status) {
     }
 }
 
+uint8_t Battery::getMqttFormat() {
+    return battery.mqtt.format;
+}
+
+bool Battery::setMqttFormat(uint8_t format) {
+    format &= MQTT_FIELDS | MQTT_STATE;
+    if (!format) return false;
+    battery.mqtt.format = format;
+    return true;
+}
+
 bool Battery::getTelegramEn() {
     return battery.telegram.enable;
 }
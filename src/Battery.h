@@ -18,6 +18,15 @@
 #include <cmath>
 #include <WiFiClient.h>
 #include "BatteryState.h"
+#include "LoopStats.h"
+#include "Snapshot.h"
+#include "Settings.h"
+#include "AdcSampler.h"
+#include "Calibration.h"
+#include "ControlTable.h"
+#include "StateLog.h"
+#include "Journal.h"
+#include "Mailbox.h"
 #include <esp_adc_cal.h>
 #include <WiFiClientSecure.h>
 #include <HTTPClient.h>
@@ -28,6 +37,7 @@
 /* ______________________________________ */
 #define MQTT_ENABLED
 #define VERSION_2
+#define RTOS_TASKS              // control and comms in their own FreeRTOS tasks
 // #define TELEGRAM_ENABLED
 
 
@@ -61,25 +71,55 @@
 #define USE_CLIENTSSL false  
 
 #define V_REF 1121
-#define MOVING_AVG_SIZE 5
 #define EEPROM_OFFSET 100
 #define EEPROM_SIZE 512
 #define ADC_CHANNEL ADC1_CHANNEL_3
 #define ADC_ATTEN ADC_ATTEN_DB_11
+#define TEMP_INTERVAL 1500      // ms between DS18B20 conversions
+#define TEMP_POLL_MS 10         // ms between conversion-ready polls
+#define ADC_SETTLE_MS 6         // divider settle time before a voltage window
+#define ADC_SETTLE_MAX_MS 50
+#define ADC_SAMPLE_TIMEOUT_MS (4 * ADC_WINDOW * 1000 / ADC_SAMPLE_RATE + 1)  // a few windows, then give up
+
+// FreeRTOS tasks, see Battery::startControlTask() and commsTask() in main.cpp
+#define CONTROL_TASK_CORE 1
+#define CONTROL_TASK_PRIORITY 5
+#define CONTROL_TASK_STACK 8192
+#define CONTROL_TASK_PERIOD_MS 10
+#define CONTROL_CMD_QUEUE 16        // setting changes waiting for the control task
+#define COMMS_TASK_CORE 0
+#define COMMS_TASK_PRIORITY 2
+#define COMMS_TASK_STACK 8192
+#define COMMS_TASK_PERIOD_MS 5
+
+// MQTT topic / payload buffers, publishing never touches the heap
+#define MQTT_TOPIC_LEN 64
+#define MQTT_PAYLOAD_LEN 32
+#define MQTT_HOST_LEN 64        // broker name or address
+#define MQTT_STATE_LEN 480      // battery/<name>/state JSON
+
+// Change driven MQTT: full keyframe every MQTT_KEYFRAME_MS, in between only values
+// that moved past their deadband. State, charger and heater changes go out at once.
+#define MQTT_KEYFRAME_MS 60000
+#define MQTT_DEADBAND_TEMP 0.2  // degC
+#define MQTT_DEADBAND_SOC 1     // %
+
+// MQTT reconnect: one connect() per attempt, retried after an exponential
+// backoff with jitter so a dead broker costs one short block per period
+#define MQTT_BACKOFF_MIN_MS 1000
+#define MQTT_BACKOFF_MAX_MS 120000
+#define MQTT_SOCKET_TIMEOUT_S 2  // PubSubClient wait for CONNACK, default is 15 s
+
+// battery/<name>/set/<field> commands, queued by the callback, applied by handleMqtt()
+#define MQTT_CMD_QUEUE 8
+#define MQTT_CMD_VALUE_LEN 16
+
+// Web UI changes, queued by the AsyncTCP callbacks, applied by commsLoop()
+#define UI_CHANGE_QUEUE 16      // the setup page's Save queues nine at once
+#define UI_CHANGE_VALUE_LEN 65  // longest text setting + 1, a WPA passphrase is 63
 
 #define MYTZ "EET-2EEST-3,M3.5.0/03:00:00,M10.5.0/04:00:00"
 
-// Add this enum definition before the Battery class
-enum SettingsType {
-    SETUP,
-    WIFI,
-    HTTP,
-    MQTT,
-    TELEGRAM,
-    PID,
-    ALL
-};
-
 class Battery {
 public:   
     // Static method to get the instance of the class
@@ -89,12 +129,34 @@ public:
     }
     void initBatteryState() {
         battery = batteryState();
+        ledsApplied = LED_KEEP;
+        redApplied = -1;
+        stateLog.clear();
+        stateLogView.write(stateLog);
     }
 
-    batteryState getBatteryState() {
+    // Control task only, other tasks use getTelemetry()
+    const batteryState& getBatteryState() const {
         return battery;
     }
 
+    // Consistent copy of the latest control step, safe from any task, no heap
+    batteryTelemetry getTelemetry() const {
+        return telemetry.read();
+    }
+    uint32_t getTelemetryVersion() const {
+        return telemetry.version();
+    }
+    void publishTelemetry();        // control task only
+
+    // State changes recorded by handleBatteryControl(), safe from any task
+    StateLog getStateLog() const {
+        return stateLogView.read();
+    }
+    uint32_t getStateLogVersion() const {
+        return stateLogView.version();
+    }
+
     // Add batteryState as a public member
     batteryState battery;
 
@@ -115,6 +177,7 @@ public:
 
     bool setup_done = false;
     unsigned long dallasTime = 0;
+    uint8_t adcSettleMs = ADC_SETTLE_MS;
 
     // PID variables
     //float pidInput, pidOutput, pidSetpoint;
@@ -122,12 +185,15 @@ public:
     //float ki = 0.02;
     //float kd = 0.02;
 
-    void loop();
+    void loop();                // control and comms in one go, single task mode
+    void controlLoop();         // sensors, state machine, charger and heater
+    void commsLoop();           // MQTT
+    void startControlTask();
     void setup();
     bool init();
     void batteryInit();
     void resetSettings(bool reset);
-    void startUpInit();
+    bool startUpInit();             // one step of the commissioning window, true when over
     bool heaterInit();
     void ledcInit();
     
@@ -136,21 +202,44 @@ public:
 
     void readTemperature();
     void handleBatteryControl();    // Main control logic for battery
-    void saveSettings(SettingsType type);
+    void applyControl(const controlAction& action);     // see ControlTable.h
+    void saveSettings(SettingsType type);       // marks the group dirty, see Settings.h
     void loadSettings(SettingsType type);
+    void loadGroup(SettingsType type, const settingsBlob* blob);
+    void markSettingDirty(SettingKey key);
+    bool commitSettings(bool force = false);    // debounced flash write of dirty keys
+    const settingsStats& getSettingsStats();
+
+    // From the web UI: queued here, applied and saved by the comms task, which
+    // alone touches the strings and the preferences. False when the queue is full.
+    bool queueSetting(SettingKey key, const String& value);
+    bool queueReset();                          // resetSettings(true) on the comms task
+    const adcSamplerStats& getAdcStats() const { return sampler.getStats(); }
 
     float getTemperature();         // Returns the current battery temperature
     int getBatteryDODprecent();
 
     int getVoltageInPercentage(uint32_t milliVoltage);
+    uint8_t getStateOfCharge();     // fused estimate, voltage only until the first reading
     float btryToVoltage(int precent); 
     
+    // Setters of the settings the control task reads: control task only. The
+    // web UI and MQTT go through queueSetting() / set/<field> instead, the
+    // change reaches controlLoop() through the control command queue.
     bool setPidP(float pidP);
     int getPidP();
     void runTune();
 
     bool getChargerStatus();
-    void charger(bool state);
+    void charger(bool state);               // immediate, safety paths
+    void chargerRequest(bool state);        // honours the minimum on / off time
+
+    uint8_t getHysteresis(uint8_t vState);
+    bool setHysteresis(uint8_t vState, int percent);
+    uint16_t getChargerMinOn();
+    bool setChargerMinOn(int seconds);
+    uint16_t getChargerMinOff();
+    bool setChargerMinOff(int seconds);
 
     uint8_t getNominalString();
     bool setNominalString(uint8_t size);
@@ -167,6 +256,35 @@ public:
     uint8_t getBoostTemp();
     bool setBoostTemp(int boostTemp);
 
+    uint8_t getTempResolution();
+    bool setTempResolution(uint8_t bits);
+
+    uint8_t getChemistry();
+    bool setChemistry(uint8_t chemistry);    // Chemistry, see OcvTable.h
+
+    uint8_t getVoltageFilter();
+    bool setVoltageFilter(uint8_t mode);     // FilterMode
+    uint8_t getTemperatureFilter();
+    bool setTemperatureFilter(uint8_t mode);
+
+    // Voltage calibration against a reference meter, see Calibration.h
+    bool addCalibrationPoint(uint32_t milliVolt);
+    void clearCalibration();
+    uint8_t getCalibrationPoints();
+
+    bool getQuickStart();
+    void setQuickStart(bool skip);          // no commissioning window with a stored size
+
+    // Flash event journal, see Journal.h. startJournal() from setup(), the rest comms side
+    bool startJournal(uint8_t resetReason);
+    uint16_t readJournal(journalRecord* out, uint16_t max, uint32_t below = UINT32_MAX);
+    const journalStats& getJournalStats() const { return journal.stats(); }
+    bool requestJournalDump(int count);     // newest count records to battery/<name>/journal
+    void printJournal(uint16_t count);
+
+    uint8_t getAdcSettle();
+    bool setAdcSettle(uint8_t ms);
+
     bool activateTemperatureBoost(bool value);
     bool getActivateTemperatureBoost();
     
@@ -197,12 +315,23 @@ public:
     void updateHeaterPID();
     void controlHeaterPWM();
 
-    void publishBatteryData();
+    void publishBatteryData();      // keyframe, every field
+    void publishDelta();            // only fields past their deadband
+    void publishLoopStats();
 
     void mqttSetup();
+    bool mqttConnect();             // one step of the reconnect state machine
     void handleMqtt();
+    void publishLinkStats();
+    void publishSettingsStats();
+    void publishJournal();          // a few records of a requested dump per pass
+    void onMqttMessage(char* topic, uint8_t* payload, unsigned int length);
+    void applyMqttCommands();
     bool getMqttState();
     bool setMqttState(bool status);
+    uint8_t getMqttFormat();
+    bool setMqttFormat(uint8_t format);
+    size_t formatState(char* buf, size_t len);     // battery/<name>/state JSON
 
     bool getTelegramEn();
     bool setTelegramEn(bool status);
@@ -239,6 +368,26 @@ public:
     };
 
     BatteryLoop currentState = STARTUP;
+    LedPattern ledsApplied = LED_KEEP;      // blinker pattern set by applyControl()
+    int8_t redApplied = -1;                 // red LED level set by applyControl(), -1 = none yet
+
+    Snapshot<batteryTelemetry> telemetry;
+    StateLog stateLog;                      // control task
+    Snapshot<StateLog> stateLogView;        // what getStateLog() returns
+    uint32_t uptimeS = 0;                   // for the log, millis() wraps after 49 days
+    uint32_t uptimeMs = 0;
+    uint32_t uptimeLast = 0;
+    uint32_t uptimeSeconds();
+    Journal journal;
+    uint16_t journalDump = 0;               // records of the dump still to send
+    uint32_t journalDumpBelow = 0;          // next page: records older than this seq
+    bool tempFault = false;                 // journal the DS18B20 dropping out once
+    SettingsStore settings;
+    AdcSampler sampler;
+    void predictSoc();
+    void correctSoc();
+    Snapshot<VoltageCalibration> calibration;       // battery.calibration for readVoltage()
+    static void controlTask(void* param);
 
     float stuneInput = 0;
     float stuneOutput = 0;
@@ -261,6 +410,45 @@ public:
     WiFiClient espClient;
     PubSubClient mqtt;
 
+    char mqttHost[MQTT_HOST_LEN];           // PubSubClient keeps this pointer, not a copy
+    char mqttTopic[MQTT_TOPIC_LEN];         // "battery/<name>/" + field
+    char mqttPayload[MQTT_PAYLOAD_LEN];
+    size_t mqttTopicBase = 0;               // length of the "battery/<name>/" prefix
+    char mqttState[MQTT_STATE_LEN];
+    batteryTelemetry mqttSent = {};         // values as last published, for the deadbands
+
+    struct uiChange {
+        SettingKey  key;                    // SETTING_COUNT: factory reset
+        char        value[UI_CHANGE_VALUE_LEN];
+    };
+    Mailbox<uiChange, UI_CHANGE_QUEUE> uiChanges;   // AsyncTCP -> comms
+    void applyUiChanges();
+    bool applySetting(SettingKey key, const char* value);
+
+    struct controlCommand {
+        SettingKey  key;
+        bool        mqtt;                   // a set/<field> command, for the link stats
+        int32_t     value;
+    };
+    Mailbox<controlCommand, CONTROL_CMD_QUEUE> controlCmds;     // comms -> control
+    uint32_t controlQueued = 0;                     // comms: commands pushed
+    std::atomic<uint32_t> controlDone{0};           // control: commands taken or refused
+    std::atomic<uint32_t> mqttRefused{0};           // control: set/<field> values a setter refused
+    bool mqttKeyframeDue = false;                   // comms: answer the commands once applied
+    bool queueControl(SettingKey key, int32_t value, bool mqtt);
+    void applyControlCommands();
+
+    struct mqttCommand {
+        uint8_t     index;                  // entry in the command table
+        char        value[MQTT_CMD_VALUE_LEN];
+    } mqttCmdQueue[MQTT_CMD_QUEUE];
+    uint8_t mqttCmdHead = 0;
+    uint8_t mqttCmdCount = 0;
+    uint32_t mqttSentVersion = 0;           // telemetry version checked by publishDelta()
+    void setTopicBase();
+    void mqttLinkUp();
+    bool publishField(const char* field, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
     float lastVoltage = 0.0;
     float lastTemperature = 0.0;
 
@@ -288,6 +476,7 @@ public:
         adc1_config_width(ADC_WIDTH_12Bit);
         adc1_config_channel_atten(ADC_CHANNEL, ADC_ATTEN);
         esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN, ADC_WIDTH_BIT_12, V_REF, &characteristics);
+        sampler.begin(ADC_CHANNEL, ADC_ATTEN);
 
         heaterPID.SetMode(QuickPID::Control::manual);
         heaterPID.SetOutputLimits(0, 254);
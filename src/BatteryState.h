@@ -3,6 +3,10 @@
 #define BATTERY_STATE_H
 
 #include <Arduino.h> // Include necessary libraries
+#include "Filter.h"
+#include "OcvTable.h"
+#include "SocEstimator.h"
+#include "Calibration.h"
 
 // Forward declarations for state types
 enum VoltageState {
@@ -14,6 +18,19 @@ enum VoltageState {
     FULL                   
 };
 
+/*
+    Hysteresis per VoltageState, in %: a state is only left downwards once the
+    state of charge is this far below its lower edge, see Battery::getVoltageState().
+    ALERT has no state below it.
+*/
+constexpr uint8_t vStateHystDefault[FULL + 1] = {0, 2, 2, 3, 3, 5};
+#define VSTATE_HYST_MAX 20          // %
+
+// Minimum time the charger output stays on / off, see Battery::chargerRequest()
+#define CHARGER_MIN_ON_S 60
+#define CHARGER_MIN_OFF_S 60
+#define CHARGER_DWELL_MAX_S 3600
+
 enum TempState {
     SUBZERO        ,
     COLD           ,
@@ -25,6 +42,53 @@ enum TempState {
     UNKNOWN_TEMP     
 };
 
+// What publishBatteryData() sends, bit flags
+enum MqttFormat : uint8_t {
+    MQTT_FIELDS     = 0x01,     // battery/<name>/<field>, one value per topic
+    MQTT_STATE      = 0x02      // battery/<name>/state, everything in one JSON
+};
+
+// Voltage measurement, see Battery::readVoltage()
+enum AdcPhase : uint8_t {
+    ADC_IDLE,               // waiting for the next interval
+    ADC_SETTLING,           // divider switched on, not sampled yet
+    ADC_SAMPLING            // DMA filling the window
+};
+
+// MQTT broker connection, see Battery::mqttConnect()
+enum LinkState : uint8_t {
+    LINK_DOWN,              // not tried yet / MQTT disabled
+    LINK_BACKOFF,           // waiting for the next attempt
+    LINK_UP                 // connected
+};
+
+
+/*
+    Telemetry the control task hands to MQTT and the web UI each period.
+    Plain data only, it is copied through a Snapshot (see Snapshot.h).
+*/
+struct batteryTelemetry {
+    uint32_t        time;                // millis() of the control step
+    uint32_t        milliVoltage;        // Voltage in millivolts
+    uint8_t         voltageInPrecent;    // Voltage percentage
+    uint8_t         sizeApprx;           // Approximate size
+    uint8_t         initLevel;           // Battery loop state
+    bool            init;                // Battery size check passed
+    float           temperature;         // Current temperature
+    VoltageState    vState;              // Current voltage state
+    TempState       tState;              // Current temperature state
+    bool            chargerOn;           // Charger output
+    bool            heaterOn;            // Heater enabled
+    float           pidOutput;           // Heater PWM output
+    float           pidSetpoint;         // Heater target temperature
+    bool            stuneRun;            // sTune running
+    bool            stuneDone;           // sTune done
+    uint16_t        socEstimate;         // Fused state of charge, 0.01 %
+    uint8_t         socConfidence;       // 0 .. 100 %
+    uint16_t        chargeEta;           // Minutes to the eco / boost target, SOC_ETA_UNKNOWN
+    uint32_t        chargerToggles;      // Charger output changes since boot
+    uint32_t        adcAvg;              // Filtered raw ADC, 0 until the first window
+};
 
 struct batteryState {
 private:
@@ -33,6 +97,7 @@ public:
     // Member variables
     String          name;                // Name of the battery
     uint8_t         size;                // Size of the battery
+    uint8_t         chemistry;           // Chemistry, picks the OCV curve
     bool            init;                // Init of the battery
     uint8_t         initLevel;           // Init level of the battery
     uint8_t         initError;           // Init error of the battery
@@ -41,8 +106,10 @@ public:
     uint8_t         wantedTemp;          // Desired temperature
     uint32_t        milliVoltage;        // Voltage in millivolts
     uint8_t         voltageInPrecent;    // Voltage percentage
+    SocEstimator    soc;                 // Coulomb counting fused with voltageInPrecent
     uint8_t         ecoVoltPrecent;      // Eco voltage percentage
     uint8_t         boostVoltPrecent;    // Boost voltage percentage
+    uint8_t         vHyst[FULL + 1];     // Hysteresis per voltage state, %
     uint8_t         capct;               // Capacity
     bool            voltBoost;           // Flag for voltage boost
     bool            tempBoost;           // Flag for temperature boost
@@ -61,6 +128,11 @@ public:
         bool        enable;         // Enable/disable charger
         uint32_t    time;           // Last message time
         bool        startupSave;    // Startup save
+        uint16_t    minOn;          // s the output stays on once switched on
+        uint16_t    minOff;         // s the output stays off once switched off
+        uint32_t    switchTime;     // millis() of the last output change
+        uint32_t    toggles;        // Output changes
+        uint32_t    held;           // Requests deferred by minOn / minOff
     } chrgr;
 
     struct startup {
@@ -69,6 +141,7 @@ public:
         uint32_t    time;           // Last message time
         uint32_t    startupTimer;   // Startup timer
         uint32_t    buttonTime;
+        bool        skip;           // No window when NVS already has a valid size
     } startup;
 
     // Nested struct for timer
@@ -127,8 +200,24 @@ public:
         String      server;         // MQTT server
         uint16_t    port;           // MQTT port
         uint32_t    lastMessageTime; // Last message time
+        uint8_t     format;         // MqttFormat bits
     } mqtt;
 
+    // Nested struct for the MQTT reconnect state machine and its metrics
+    struct broker {
+        LinkState   state;          // Connection state
+        uint32_t    backoffMs;      // Current backoff, doubles per failure
+        uint32_t    nextAttempt;    // millis() of the next connect attempt
+        uint32_t    attempts;       // connect() calls
+        uint32_t    failures;       // connect() calls that failed
+        uint32_t    drops;          // Lost connections
+        uint32_t    wifiRetries;    // attempts skipped, no WiFi
+        uint32_t    connectMs;      // Total time blocked in connect()
+        uint32_t    maxConnectMs;   // Longest single connect()
+        uint32_t    commands;       // battery/<name>/set/... messages applied
+        uint32_t    rejected;       // Unknown field, bad value or queue full
+    } link;
+
     // Nested struct for Telegram
     struct tg {
         bool        enable;         // Enable/disable Telegram
@@ -172,21 +261,36 @@ public:
         uint8_t     runTimes;      // lets avarage the runs of the PID
     } stune;
 
+    // Nested struct for the DS18B20 conversion state machine
+    struct ds18b20 {
+        uint8_t     resolution;     // Sensor resolution, 9..12 bit
+        bool        setup;          // Resolution and async mode applied
+        bool        pending;        // Conversion requested, result not read yet
+        uint32_t    pollTime;       // Last conversion-ready poll
+        uint8_t     filterMode;     // FilterMode for battery.temperature
+        RunningFilter<float, TEMP_FILTER_LEN, double> filter;
+    } ds;
+
     struct adc {
-        uint32_t    raw;        // Raw ADC value
+        uint32_t    raw;        // Oversampled ADC window, 1/ADC_OVERSAMPLE counts
         uint32_t    cal;        // Calibrated ADC value
         uint32_t    time;       // Last message time
-        uint32_t    index;      // Index
-        uint32_t    sum;        // Sum
-        uint32_t    avg;        // Average
-        uint8_t     mAvg;                           // integer div by zero!
-        uint32_t    readings[5];
+        uint32_t    avg;        // Filtered raw, what milliVoltage comes from
+        bool        gate;       // divider switched on for the running window
+        uint8_t     phase;      // AdcPhase
+        uint8_t     filterMode; // FilterMode for avg
+        RunningFilter<uint32_t, VOLTAGE_FILTER_LEN> filter;
+        uint32_t    sampleTime; // ADC_SAMPLING entered
+        uint32_t    timeouts;   // windows given up after ADC_SAMPLE_TIMEOUT_MS
     } adc;
 
+    VoltageCalibration calibration;     // comms side, the control task reads a Snapshot of it
+
   // Public constructor to initialize batteryState with default values
     batteryState()
         : error(0),
           size(0), 
+          chemistry(CHEM_NMC),
           init(false),
           initError(0),
           initWarning(0),
@@ -204,7 +308,7 @@ public:
           capct(10),     
           lastMessageTime(0),
           sizeApprx(0),
-          chrgr{1, false, 0}, // Initialize charger struct
+          chrgr{1, false, 0, false, CHARGER_MIN_ON_S, CHARGER_MIN_OFF_S, 0, 0, 0}, // Initialize charger struct
           timer{0, 0, 0, 0, 5000}, // Initialize timer struct
           heater{
               0,    // time
@@ -227,9 +331,10 @@ public:
           },
           wlan{false, "", "", 0}, // Initialize WiFi struct
           http{false, "", ""}, // Initialize HTTP struct
-          mqtt{false, false, "", "", "", 1883, 0}, // Initialize MQTT struct
+          mqtt{false, false, "", "", "", 1883, 0, MQTT_FIELDS}, // Initialize MQTT struct
+          link{LINK_DOWN, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, // Initialize MQTT link struct
           telegram{false,false, "", 922951523, 0, "922951523"}, // Initialize Telegram struct 
-          startup{false, false, 0, 10000, 0}, // Initialize startup struct
+          startup{false, false, 0, 10000, 0, false}, // Initialize startup struct
           stune{
                 0,              // timeNow
                 600,            // lenTime
@@ -260,9 +365,12 @@ public:
                 1           // runtime: lets avarage the runs of the PID
               
           },
-          adc{0, 0, 0, 0, 0, 0, 5, {0, 0, 0, 0, 0}}, // Initialize adc struct with correct types
+          ds{12, false, false, 0, FILTER_NONE, {}}, // Initialize DS18B20 struct, 12 bit, unfiltered
+          adc{0, 0, 0, 0, false, ADC_IDLE, FILTER_MEAN, {}, 0, 0}, // Initialize adc struct with correct types
           starUpInit(false)
-    {}
+    {
+        memcpy(vHyst, vStateHystDefault, sizeof(vHyst));
+    }
 
 };
 
@@ -0,0 +1,107 @@
+#include "Calibration.h"
+#include "Settings.h"
+#include <cstddef>
+
+/*
+    Add a point, or replace one that is closer than CAL_MIN_SPAN. Returns
+    false when the table is full or milliVolt does not lie between the
+    neighbouring points, which would give a segment that slopes down.
+*/
+bool VoltageCalibration::add(uint32_t raw, uint32_t milliVolt) {
+    if (raw == 0 || milliVolt == 0) return false;
+
+    uint8_t i = 0;
+    while (i < count && points[i].raw + CAL_MIN_SPAN <= raw) i++;
+
+    bool replace = i < count && points[i].raw < raw + CAL_MIN_SPAN;
+    uint8_t above = replace ? i + 1 : i;
+    if (i > 0 && milliVolt <= points[i - 1].milliVolt) return false;
+    if (above < count && milliVolt >= points[above].milliVolt) return false;
+
+    if (replace) {
+        points[i] = {raw, milliVolt};           // re-measured the same level
+    }
+    else {
+        if (count == CAL_POINTS) return false;
+        memmove(&points[i + 1], &points[i], (count - i) * sizeof(calPoint));
+        points[i] = {raw, milliVolt};
+        count++;
+    }
+    build();
+    return true;
+}
+
+void VoltageCalibration::clear() {
+    count = 0;
+    segmentCount = 0;
+}
+
+void VoltageCalibration::build() {
+    if (count == 1) {
+        // gain only, through zero
+        segments[0] = {0, 0, int32_t((uint64_t(points[0].milliVolt) << CAL_SLOPE_SHIFT) / points[0].raw)};
+        segmentCount = 1;
+        return;
+    }
+
+    segmentCount = count - 1;
+    for (uint8_t i = 0; i < segmentCount; i++) {
+        int64_t dv = int64_t(points[i + 1].milliVolt) - points[i].milliVolt;
+        int64_t dr = int64_t(points[i + 1].raw) - points[i].raw;
+        segments[i] = {points[i].raw, int32_t(points[i].milliVolt), int32_t(dv * (1 << CAL_SLOPE_SHIFT) / dr)};
+    }
+}
+
+uint32_t VoltageCalibration::toMilliVolts(uint32_t raw) const {
+    if (!segmentCount) return 0;
+
+    uint8_t i = 0;
+    while (i + 1 < segmentCount && raw >= segments[i + 1].raw) i++;
+
+    const calSegment& s = segments[i];
+    int64_t mv = s.milliVolt + (((int64_t(raw) - s.raw) * s.slope + (1 << (CAL_SLOPE_SHIFT - 1))) >> CAL_SLOPE_SHIFT);
+    return mv > 0 ? uint32_t(mv) : 0;
+}
+
+/*
+    Load the table from the open namespace. The blob is fixed size, a partial
+    or foreign one is dropped as a whole.
+*/
+bool VoltageCalibration::load(Preferences& prefs) {
+    calBlob blob;
+    clear();
+
+    if (prefs.getBytesLength(CAL_KEY) != sizeof(blob)) return false;
+    if (prefs.getBytes(CAL_KEY, &blob, sizeof(blob)) != sizeof(blob)) return false;
+    if (blob.version != CAL_VERSION || blob.count > CAL_POINTS) return false;
+    if (blob.crc != SettingsStore::crc32(&blob, offsetof(calBlob, crc))) return false;
+
+    for (uint8_t i = 0; i < blob.count; i++) {
+        calPoint p;
+        memcpy(&p, &blob.points[i], sizeof(p));
+        add(p.raw, p.milliVolt);
+    }
+    return true;
+}
+
+/*
+    Write the table to the open namespace unless it is already there. An
+    empty table removes the key.
+*/
+bool VoltageCalibration::save(Preferences& prefs) const {
+    if (!count) return prefs.isKey(CAL_KEY) && prefs.remove(CAL_KEY);
+
+    calBlob blob, stored;
+    memset(&blob, 0, sizeof(blob));
+    blob.version = CAL_VERSION;
+    blob.count = count;
+    memcpy(blob.points, points, count * sizeof(calPoint));
+    blob.crc = SettingsStore::crc32(&blob, offsetof(calBlob, crc));
+
+    if (prefs.getBytesLength(CAL_KEY) == sizeof(stored) &&
+        prefs.getBytes(CAL_KEY, &stored, sizeof(stored)) == sizeof(stored) &&
+        memcmp(&stored, &blob, sizeof(blob)) == 0) return false;
+
+    prefs.putBytes(CAL_KEY, &blob, sizeof(blob));
+    return true;
+}
@@ -0,0 +1,77 @@
+// Calibration.h
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+/*
+    Per-unit voltage calibration: filtered ADC reading -> pack millivolts.
+
+    Each point pairs the ADC value (1/ADC_OVERSAMPLE counts, battery.adc.avg)
+    with the voltage a reference meter showed at the same time, so the table
+    covers the divider ratio, V_REF and the ADC's own non-linearity in one go.
+    Points are kept sorted and add() precomputes one segment per interval
+    with a fixed-point slope, so the lookup in readVoltage() is a short scan
+    and one multiply. Below the first or above the last point the nearest
+    segment is extended; a single point is a gain through zero.
+
+    Each point has to read higher than the one below it, so no segment can
+    slope down. The table lives under its own NVS key and is saved through
+    the settings commit like any other key (SET_CALIBRATION), but it belongs
+    to the board, not to the user's settings, so resetSettings() leaves it
+    alone.
+*/
+
+#define CAL_POINTS 8
+#define CAL_KEY "vcal"
+#define CAL_VERSION 1
+#define CAL_MIN_SPAN 256            // raw units (16 ADC counts) between points, closer ones replace
+#define CAL_SLOPE_SHIFT 16          // slope is mV per raw unit in Q16
+
+struct calPoint {
+    uint32_t    raw;                // 1/ADC_OVERSAMPLE counts
+    uint32_t    milliVolt;          // reference meter
+};
+
+struct calSegment {
+    uint32_t    raw;                // segment start
+    int32_t     milliVolt;          // value at the start
+    int32_t     slope;              // Q16 mV per raw unit
+};
+
+struct __attribute__((packed)) calBlob {
+    uint8_t     version;            // CAL_VERSION
+    uint8_t     count;
+    calPoint    points[CAL_POINTS];
+    uint32_t    crc;                // CRC-32 of everything above
+};
+
+/*
+    Plain data, so the control task can get it through a Snapshot.
+*/
+class VoltageCalibration {
+public:
+    VoltageCalibration() : count(0), segmentCount(0) {}
+
+    bool add(uint32_t raw, uint32_t milliVolt);
+    void clear();
+    bool active() const { return count > 0; }
+    uint8_t size() const { return count; }
+    const calPoint& point(uint8_t i) const { return points[i]; }
+
+    uint32_t toMilliVolts(uint32_t raw) const;
+
+    bool load(Preferences& prefs);          // false: no valid table stored
+    bool save(Preferences& prefs) const;    // false: flash already holds this table
+
+private:
+    uint8_t     count;
+    uint8_t     segmentCount;
+    calPoint    points[CAL_POINTS];
+    calSegment  segments[CAL_POINTS];
+
+    void build();
+};
+
+#endif // CALIBRATION_H
@@ -0,0 +1,159 @@
+// ControlTable.h
+#ifndef CONTROL_TABLE_H
+#define CONTROL_TABLE_H
+
+#include <stdint.h>
+#include "BatteryState.h"
+
+/*
+    What handleBatteryControl() does in each VoltageState x TempState.
+
+    The rules are written down as two short tables, one row per voltage state
+    and one per temperature state. The constexpr constructor of ControlTable
+    merges them into one action per combination, so the control step is a
+    single lookup into flash and the whole table can be checked by
+    static_assert and by the host tests.
+
+        const controlAction& a = controlTable.at(battery.vState, battery.tState);
+
+    Battery::applyControl() then drives the charger, LEDs and heater setpoint,
+    touching an output only when it differs from what was applied last time.
+*/
+
+#define HEATER_SAFE_SETPOINT 2      // degC, heater target while too hot
+
+enum ChargerCmd : uint8_t {
+    CHG_KEEP,               // leave the output as it is
+    CHG_ON,                 // chargerRequest(true)
+    CHG_OFF,                // chargerRequest(false)
+    CHG_BOOST,              // on while voltBoost is set, off otherwise
+    CHG_CUT                 // charger(false) at once, no dwell
+};
+
+enum LedPattern : uint8_t {
+    LED_KEEP,               // leave the blinkers as they are
+    LED_ALERT,
+    LED_WARNING,
+    LED_LOVV,
+    LED_ECO,
+    LED_BOOST,
+    LED_FULL,
+    LED_PATTERNS
+};
+
+enum HeaterTarget : uint8_t {
+    HEAT_KEEP,              // leave the setpoint as it is
+    HEAT_ECO,               // ecoTemp
+    HEAT_BY_BOOST,          // boostTemp with tempBoost, ecoTemp otherwise
+    HEAT_SAFE               // HEATER_SAFE_SETPOINT
+};
+
+enum ControlFlag : uint8_t {
+    CTRL_RED_LED        = 0x01,     // red LED on, heater range
+    CTRL_CLEAR_VBOOST   = 0x02,     // voltage boost reached, clear it
+    CTRL_CLEAR_TBOOST   = 0x04,     // temperature boost reached, clear it
+    CTRL_CHECK_TUNE     = 0x08,     // flag sTune if far off boostTemp
+    CTRL_RESTART        = 0x10      // sensor lost: heater manual, back to STARTUP
+};
+
+struct ledTiming {
+    uint16_t    yellowOn;
+    uint16_t    yellowOff;
+    uint16_t    greenOn;
+    uint16_t    greenOff;
+};
+
+struct controlAction {
+    ChargerCmd      charger;
+    LedPattern      leds;
+    HeaterTarget    heater;
+    uint8_t         flags;          // ControlFlag bits
+};
+
+// Blinker delays per pattern, ms
+constexpr ledTiming ledTimings[LED_PATTERNS] = {
+    {   0,    0,    0,    0},       // LED_KEEP, not used
+    {1000,    0, 1000,    0},       // LED_ALERT
+    {1000, 1000, 1000,    0},       // LED_WARNING
+    {1000, 1000, 1000, 1000},       // LED_LOVV
+    {2000,    0,    0, 1000},       // LED_ECO
+    {2000,    0, 1000, 1000},       // LED_BOOST
+    {2000,    0,  500,  500}        // LED_FULL
+};
+
+struct voltageRule {
+    ChargerCmd      charger;        // while the temperature allows charging
+    LedPattern      leds;
+    LedPattern      ledsCut;        // while it does not
+    uint8_t         flags;
+};
+
+struct tempRule {
+    bool            cut;            // charger off regardless of the voltage
+    HeaterTarget    heater;
+    uint8_t         flags;
+};
+
+constexpr voltageRule voltageRules[FULL + 1] = {
+    {CHG_ON,    LED_ALERT,      LED_KEEP,       0},                     // ALERT
+    {CHG_ON,    LED_WARNING,    LED_KEEP,       0},                     // WARNING
+    {CHG_ON,    LED_LOVV,       LED_LOVV,       0},                     // LOVV
+    {CHG_ON,    LED_ECO,        LED_ECO,        0},                     // ECO
+    {CHG_BOOST, LED_BOOST,      LED_BOOST,      0},                     // BOOST
+    {CHG_OFF,   LED_FULL,       LED_FULL,       CTRL_CLEAR_VBOOST}      // FULL
+};
+
+constexpr tempRule tempRules[UNKNOWN_TEMP + 1] = {
+    {true,      HEAT_KEEP,      0},                                     // SUBZERO
+    {false,     HEAT_ECO,       CTRL_RED_LED},                          // COLD
+    {false,     HEAT_BY_BOOST,  CTRL_RED_LED},                          // ECO_TEMP
+    {false,     HEAT_BY_BOOST,  CTRL_RED_LED},                          // ECO_READY
+    {false,     HEAT_BY_BOOST,  CTRL_RED_LED},                          // BOOST_TEMP
+    {false,     HEAT_BY_BOOST,  CTRL_RED_LED | CTRL_CLEAR_TBOOST},      // BOOST_READY
+    {true,      HEAT_SAFE,      CTRL_CHECK_TUNE},                       // TEMP_WARNING
+    {true,      HEAT_KEEP,      CTRL_RESTART}                           // UNKNOWN_TEMP
+};
+
+class ControlTable {
+public:
+    constexpr ControlTable() : actions() {
+        for (uint8_t v = 0; v <= FULL; v++) {
+            for (uint8_t t = 0; t <= UNKNOWN_TEMP; t++) {
+                const voltageRule& vr = voltageRules[v];
+                const tempRule& tr = tempRules[t];
+                actions[v][t] = {
+                    tr.cut ? CHG_CUT : vr.charger,
+                    tr.cut ? vr.ledsCut : vr.leds,
+                    tr.heater,
+                    uint8_t(vr.flags | tr.flags)
+                };
+            }
+        }
+    }
+
+    constexpr const controlAction& at(VoltageState v, TempState t) const {
+        return actions[v][t];
+    }
+
+    // Every state where the temperature forbids charging cuts the charger
+    constexpr bool safe() const {
+        for (uint8_t v = 0; v <= FULL; v++) {
+            for (uint8_t t = 0; t <= UNKNOWN_TEMP; t++) {
+                if (tempRules[t].cut && actions[v][t].charger != CHG_CUT) return false;
+                if (v == FULL && actions[v][t].charger == CHG_ON) return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    controlAction actions[FULL + 1][UNKNOWN_TEMP + 1];
+};
+
+constexpr ControlTable controlTable;
+
+static_assert(controlTable.safe(), "charger must be off when too cold, too hot or full");
+static_assert(controlTable.at(ECO, ECO_TEMP).charger == CHG_ON, "eco charges");
+static_assert(controlTable.at(BOOST, SUBZERO).charger == CHG_CUT, "subzero cuts");
+
+#endif // CONTROL_TABLE_H
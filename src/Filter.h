@@ -0,0 +1,89 @@
+// Filter.h
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+#include <algorithm>
+
+/*
+    Ring buffer filter with a compile-time length.
+
+    push() keeps a running sum and an exponential average up to date, so the
+    mean over 16 samples costs the same two additions as over 4. The mode is
+    passed to value() instead of being stored, so it can come straight from a
+    setting and be switched at any time without losing the history.
+
+        RunningFilter<uint32_t, VOLTAGE_FILTER_LEN> filter;
+        filter.push(raw);
+        uint32_t avg = filter.value(FILTER_MEAN);
+*/
+
+#define VOLTAGE_FILTER_LEN 16       // oversampled ADC windows, one per readVoltage() interval
+#define TEMP_FILTER_LEN 8           // DS18B20 conversions, one per TEMP_INTERVAL
+#define FILTER_MEDIAN_LEN 5         // newest samples the median looks at
+#define FILTER_EMA_ALPHA 0.125f
+
+enum FilterMode : uint8_t {
+    FILTER_NONE,            // latest sample
+    FILTER_MEAN,            // running mean of the whole window
+    FILTER_MEDIAN,          // median of the newest FILTER_MEDIAN_LEN, drops single spikes
+    FILTER_EMA,             // exponential, FILTER_EMA_ALPHA
+    FILTER_MODES
+};
+
+template <typename T, uint8_t N, typename Sum = T>
+class RunningFilter {
+    static_assert(N >= FILTER_MEDIAN_LEN, "window shorter than the median");
+
+public:
+    RunningFilter() { reset(); }
+
+    void reset() {
+        head = 0;
+        count = 0;
+        sum = 0;
+        ema = 0;
+    }
+
+    void push(T sample) {
+        if (count == N) sum -= ring[head];
+        else count++;
+
+        ring[head] = sample;
+        sum += sample;
+        head = (head + 1) % N;
+        ema = count == 1 ? float(sample) : ema + (float(sample) - ema) * FILTER_EMA_ALPHA;
+    }
+
+    T value(uint8_t mode) const {
+        if (count == 0) return T();
+
+        switch (mode) {
+            case FILTER_MEAN:   return T(sum / count);
+            case FILTER_MEDIAN: return median();
+            case FILTER_EMA:    return T(ema);
+            default:            return latest();
+        }
+    }
+
+    T latest() const { return ring[(head + N - 1) % N]; }
+    uint8_t size() const { return count; }
+
+private:
+    T       ring[N];
+    Sum     sum;
+    float   ema;
+    uint8_t head;           // next slot to write
+    uint8_t count;
+
+    T median() const {
+        uint8_t n = count < FILTER_MEDIAN_LEN ? count : FILTER_MEDIAN_LEN;
+        T newest[FILTER_MEDIAN_LEN];
+
+        for (uint8_t i = 0; i < n; i++) newest[i] = ring[(head + N - 1 - i) % N];
+        std::nth_element(newest, newest + n / 2, newest + n);
+        return newest[n / 2];
+    }
+};
+
+#endif // FILTER_H
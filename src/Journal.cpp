@@ -0,0 +1,212 @@
+#include "Journal.h"
+#include "Settings.h"
+#include <cstddef>
+
+bool Journal::begin(uint8_t resetReason, uint32_t seconds) {
+    counters.mounted = LittleFS.begin(true);
+    if (!counters.mounted) {
+        Serial.println("Journal: LittleFS mount failed");
+        return false;
+    }
+    LittleFS.mkdir(JOURNAL_DIR);
+    recover();
+
+    log(JRN_BOOT, resetReason, int32_t(counters.recovered), seconds);
+    service();
+    return true;
+}
+
+bool Journal::log(JournalEvent type, uint8_t arg, int32_t value, uint32_t seconds) {
+    uint16_t h = head.load(std::memory_order_relaxed);
+    uint16_t next = (h + 1) % JOURNAL_QUEUE;
+    if (next == tail.load(std::memory_order_acquire)) {
+        lost++;
+        return false;
+    }
+    queue[h] = {seconds, value, type, arg};
+    head.store(next, std::memory_order_release);
+    return true;
+}
+
+void Journal::service() {
+    uint16_t h = head.load(std::memory_order_acquire);
+    uint16_t t = tail.load(std::memory_order_relaxed);
+    bool urgent = false;
+
+    while (t != h) {
+        const entry& e = queue[t];
+        if (counters.mounted) append(e);
+        urgent |= e.type == JRN_BOOT || e.type == JRN_FAULT;
+        lastSeconds = e.seconds;
+        t = (t + 1) % JOURNAL_QUEUE;
+    }
+    tail.store(t, std::memory_order_release);
+
+    uint32_t missed = lost.exchange(0);
+    if (missed) {
+        counters.dropped += missed;
+        if (counters.mounted) append({lastSeconds, int32_t(missed), JRN_DROPPED, 0});
+        urgent = true;
+    }
+
+    if (pending && (urgent || millis() - lastFlush >= JOURNAL_FLUSH_MS)) flush();
+}
+
+/*
+    Newest first, walking the segments backwards from the one being written.
+    Every record has to be older than the one returned before it, which also
+    keeps out whatever a torn or reused segment still holds.
+*/
+uint16_t Journal::newest(journalRecord* out, uint16_t max, uint32_t below) {
+    if (!counters.mounted || !max) return 0;
+    if (pending) flush();
+
+    uint16_t n = 0;
+    if (below > nextSeq) below = nextSeq;
+    char path[32];
+
+    for (uint8_t i = 0; i < JOURNAL_SEGMENTS && n < max; i++) {
+        segmentPath((segment + JOURNAL_SEGMENTS - i) % JOURNAL_SEGMENTS, path, sizeof(path));
+        File f = LittleFS.open(path, FILE_READ);
+        if (!f) continue;
+
+        for (int32_t k = int32_t(f.size() / sizeof(journalRecord)) - 1; k >= 0 && n < max; k--) {
+            journalRecord r;
+            f.seek(k * sizeof(r));
+            if (f.read(reinterpret_cast<uint8_t*>(&r), sizeof(r)) != sizeof(r)) continue;
+            if (!valid(r) || r.seq >= below) continue;
+            below = r.seq;
+            out[n++] = r;
+        }
+        f.close();
+    }
+    return n;
+}
+
+const char* Journal::eventName(uint8_t type) {
+    switch (type) {
+        case JRN_BOOT:      return "boot";
+        case JRN_VSTATE:    return "vState";
+        case JRN_TSTATE:    return "tState";
+        case JRN_CHARGER:   return "charger";
+        case JRN_FAULT:     return "fault";
+        case JRN_DROPPED:   return "dropped";
+        default:            return "unknown";
+    }
+}
+
+bool Journal::valid(const journalRecord& r) {
+    return r.seq && r.type < JRN_EVENTS && r.crc == SettingsStore::crc32(&r, offsetof(journalRecord, crc));
+}
+
+/*
+    Find the segment with the newest record and carry on from there.
+*/
+void Journal::recover() {
+    uint32_t newestSeq = 0;
+    uint16_t newestBoot = 0;
+    bool newestTorn = false;
+    char path[32];
+
+    counters.recovered = 0;
+    reopen = false;
+    for (uint8_t s = 0; s < JOURNAL_SEGMENTS; s++) {
+        segmentPath(s, path, sizeof(path));
+        File f = LittleFS.open(path, FILE_READ);
+        if (!f) continue;
+
+        uint16_t count = 0;
+        uint32_t last = 0;
+        uint16_t boot = 0;
+        journalRecord r;
+        while (count < JOURNAL_SEGMENT_RECORDS &&
+               f.read(reinterpret_cast<uint8_t*>(&r), sizeof(r)) == sizeof(r) &&
+               valid(r) && r.seq > last) {
+            last = r.seq;
+            boot = r.boot;
+            count++;
+        }
+        bool torn = f.size() != count * sizeof(r);
+        f.close();
+
+        counters.recovered += count;
+        if (torn) counters.torn++;
+        if (count && last > newestSeq) {
+            newestSeq = last;
+            newestBoot = boot;
+            newestTorn = torn;
+            segment = s;
+            used = count;
+        }
+    }
+
+    if (!newestSeq) {
+        // blank partition: start at segment 0
+        segment = JOURNAL_SEGMENTS - 1;
+        nextSeq = 1;
+        counters.boot = 0;
+        rotate();
+        counters.rotations = 0;
+        return;
+    }
+
+    nextSeq = newestSeq + 1;
+    counters.boot = newestBoot + 1;
+    if (newestTorn || used >= JOURNAL_SEGMENT_RECORDS) rotate();
+    else {
+        segmentPath(segment, path, sizeof(path));
+        file = LittleFS.open(path, FILE_APPEND);
+    }
+}
+
+/*
+    Move on to the next segment. When it can not be opened the journal stays
+    on it and the next append() tries again, rather than giving up for good.
+*/
+void Journal::rotate() {
+    char path[32];
+    if (file) {
+        file.flush();
+        file.close();
+    }
+    if (!reopen) {
+        segment = (segment + 1) % JOURNAL_SEGMENTS;
+        counters.rotations++;
+    }
+    segmentPath(segment, path, sizeof(path));
+    file = LittleFS.open(path, FILE_WRITE);     // drops the oldest segment
+    reopen = !file;
+    used = 0;
+    pending = 0;
+}
+
+void Journal::append(const entry& e) {
+    if (used >= JOURNAL_SEGMENT_RECORDS || !file) rotate();
+    if (!file) {
+        counters.failed++;
+        return;
+    }
+
+    journalRecord r = {nextSeq, e.seconds, counters.boot, e.type, e.arg, e.value, 0};
+    r.crc = SettingsStore::crc32(&r, offsetof(journalRecord, crc));
+    if (file.write(reinterpret_cast<const uint8_t*>(&r), sizeof(r)) != sizeof(r)) {
+        counters.failed++;
+        used = JOURNAL_SEGMENT_RECORDS;         // never append behind a partial record
+        return;
+    }
+    nextSeq++;
+    used++;
+    pending++;
+    counters.written++;
+}
+
+void Journal::flush() {
+    if (file) file.flush();
+    pending = 0;
+    lastFlush = millis();
+    counters.flushes++;
+}
+
+void Journal::segmentPath(uint8_t s, char* buf, size_t len) {
+    snprintf(buf, len, JOURNAL_DIR "/seg%u.bin", s);
+}
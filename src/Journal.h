@@ -0,0 +1,126 @@
+// Journal.h
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <atomic>
+
+/*
+    Event journal on the LittleFS partition, kept across resets and power loss.
+
+    Fixed 20-byte records, each with a sequence number that never repeats and
+    its own CRC, appended to one of JOURNAL_SEGMENTS files. A full segment
+    moves on to the next one, which is truncated: the oldest segment is the
+    one given up, so flash use is fixed and the writes walk over all of them.
+
+    log() only puts the event into a RAM queue, it never touches flash and is
+    safe from the control task. service() on the comms side writes the queue
+    out. Routine records (state changes, charger) are synced at most every
+    JOURNAL_FLUSH_MS to spare the flash, boots and faults at once.
+
+    begin() scans every segment: the newest valid record gives the next
+    sequence and boot number. A segment whose tail did not verify (power lost
+    mid-write) is left as it is, up to its last good record, and writing goes
+    on in the next segment.
+*/
+
+#define JOURNAL_DIR "/journal"
+#define JOURNAL_SEGMENTS 4
+#define JOURNAL_SEGMENT_RECORDS 200     // 4000 bytes, about one flash block
+#define JOURNAL_QUEUE 32                // control -> comms, events
+#define JOURNAL_FLUSH_MS 10000
+#define JOURNAL_DUMP_MAX 64             // records per MQTT request
+
+enum JournalEvent : uint8_t {
+    JRN_BOOT,                   // arg: reset reason, value: records recovered
+    JRN_VSTATE,                 // arg: VoltageState, value: previous one
+    JRN_TSTATE,                 // arg: TempState, value: previous one
+    JRN_CHARGER,                // arg: on, value: pack mV
+    JRN_FAULT,                  // arg: JournalFault, value: detail
+    JRN_DROPPED,                // value: events lost to a full queue
+    JRN_EVENTS
+};
+
+enum JournalFault : uint8_t {
+    FAULT_TEMP_LOST,            // DS18B20 not answering
+    FAULT_TEMP_BACK,            // and answering again
+    FAULT_SENSOR_RESTART        // control went back to STARTUP, value: TempState
+};
+
+struct __attribute__((packed)) journalRecord {
+    uint32_t    seq;            // 1, 2, ... across reboots
+    uint32_t    seconds;        // uptime when it happened
+    uint16_t    boot;           // boot number, 0 on a fresh partition
+    uint8_t     type;           // JournalEvent
+    uint8_t     arg;
+    int32_t     value;
+    uint32_t    crc;            // CRC-32 of everything above
+};
+
+struct journalStats {
+    uint32_t    recovered;      // valid records found by begin()
+    uint32_t    torn;           // segments with a bad tail
+    uint32_t    written;
+    uint32_t    flushes;
+    uint32_t    rotations;
+    uint32_t    dropped;        // queue full
+    uint32_t    failed;         // short writes
+    uint16_t    boot;
+    bool        mounted;
+};
+
+class Journal {
+public:
+    // Mount (formatting a blank partition), recover, write the boot record.
+    // Before the tasks start.
+    bool begin(uint8_t resetReason, uint32_t seconds);
+
+    // Any time, from one task (control); false when the queue is full
+    bool log(JournalEvent type, uint8_t arg, int32_t value, uint32_t seconds);
+
+    // Comms side: queue -> flash
+    void service();
+
+    // Comms side: newest records first, only those older than sequence `below`.
+    // Pass the last seq returned to page on, records added meanwhile do not shift it.
+    uint16_t newest(journalRecord* out, uint16_t max, uint32_t below = UINT32_MAX);
+
+    uint32_t nextSequence() const { return nextSeq; }
+
+    const journalStats& stats() const { return counters; }
+
+    static const char* eventName(uint8_t type);
+    static bool valid(const journalRecord& r);
+
+private:
+    struct entry {
+        uint32_t    seconds;
+        int32_t     value;
+        uint8_t     type;
+        uint8_t     arg;
+    };
+
+    entry queue[JOURNAL_QUEUE];
+    std::atomic<uint16_t> head{0};      // written by log()
+    std::atomic<uint16_t> tail{0};      // written by service()
+    std::atomic<uint32_t> lost{0};
+
+    File        file;
+    uint8_t     segment = 0;
+    uint16_t    used = 0;               // records in the current segment
+    uint16_t    pending = 0;            // written since the last flush
+    bool        reopen = false;         // rotate() could not open the segment, try it again
+    uint32_t    nextSeq = 1;
+    uint32_t    lastFlush = 0;
+    uint32_t    lastSeconds = 0;
+    journalStats counters = {};
+
+    void recover();
+    void rotate();
+    void append(const entry& e);
+    void flush();
+    static void segmentPath(uint8_t s, char* buf, size_t len);
+};
+
+#endif // JOURNAL_H
@@ -0,0 +1,52 @@
+#include "LabelView.h"
+#include "Settings.h"
+#include <cstdarg>
+
+bool LabelView::set(uint16_t id, const char* fmt, ...) {
+    char buf[UI_LABEL_LEN];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    return setText(id, buf);
+}
+
+bool LabelView::setText(uint16_t id, const char* text) {
+    size_t len = strlen(text);
+    uint32_t crc = SettingsStore::crc32(text, len);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        slot* s = find(id);
+
+        if (s && s->valid && s->len == uint16_t(len) && s->crc == crc) {
+            counters.skips++;
+            return false;
+        }
+        if (s) *s = {id, uint16_t(len), crc, true};
+        counters.pushes++;
+    }
+    sink(id, text);
+    return true;
+}
+
+void LabelView::invalidate(uint16_t id) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (uint8_t i = 0; i < used; i++) {
+        if (slots[i].id == id) slots[i].valid = false;
+    }
+}
+
+void LabelView::invalidateAll() {
+    std::lock_guard<std::mutex> guard(lock);
+    for (uint8_t i = 0; i < used; i++) slots[i].valid = false;
+}
+
+// Slot for id, a new one the first time; nullptr once the table is full. Caller holds lock.
+LabelView::slot* LabelView::find(uint16_t id) {
+    for (uint8_t i = 0; i < used; i++) {
+        if (slots[i].id == id) return &slots[i];
+    }
+    if (used == UI_LABEL_SLOTS) return nullptr;
+    slots[used] = {id, 0, 0, false};
+    return &slots[used++];
+}
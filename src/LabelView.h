@@ -0,0 +1,69 @@
+// LabelView.h
+#ifndef LABEL_VIEW_H
+#define LABEL_VIEW_H
+
+#include <Arduino.h>
+#include <mutex>
+
+/*
+    Change filter in front of ESPUI.updateLabel().
+
+    Every updateLabel() sends a websocket frame to each open browser, whether
+    the text changed or not. LabelView formats into a fixed buffer, keeps a
+    CRC-32 and length of the last text pushed per control and only hands the
+    text to the sink when that differs:
+
+        labels.set(tempLabel, "%.1f ℃", t.temperature);
+
+    A browser that connects later still sees everything: ESPUI sends it the
+    stored value of every control when the page loads.
+
+    Controls beyond UI_LABEL_SLOTS are pushed every time, never dropped.
+
+    The slot table is locked, so any task may call in, but the sink runs
+    outside the lock. Pushes should come from one task (uiLoop()); ESPUI
+    callbacks on the AsyncTCP task only invalidate() and let it catch up.
+*/
+
+#define UI_LABEL_SLOTS 32
+#define UI_LABEL_LEN 96             // formatted text, longer is cut
+
+typedef void (*LabelSink)(uint16_t id, const char* text);
+
+struct labelStats {
+    uint32_t    pushes;             // texts handed to the sink
+    uint32_t    skips;              // unchanged, not sent
+};
+
+class LabelView {
+public:
+    explicit LabelView(LabelSink sink) : sink(sink) {}
+
+    // Returns true when the text was pushed
+    bool set(uint16_t id, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+    bool setText(uint16_t id, const char* text);
+
+    // Push this control (or all of them) on the next set, whatever it holds
+    void invalidate(uint16_t id);
+    void invalidateAll();
+
+    const labelStats& stats() const { return counters; }
+
+private:
+    struct slot {
+        uint16_t    id;
+        uint16_t    len;
+        uint32_t    crc;
+        bool        valid;
+    };
+
+    LabelSink   sink;
+    slot        slots[UI_LABEL_SLOTS] = {};
+    uint8_t     used = 0;
+    labelStats  counters = {};
+    std::mutex  lock;
+
+    slot* find(uint16_t id);
+};
+
+#endif // LABEL_VIEW_H
@@ -0,0 +1,88 @@
+#include "LoopStats.h"
+
+static stageStats stats[STAGE_COUNT];
+
+static const char* const stageNames[STAGE_COUNT] = {
+    "loop",
+    "battery",
+    "voltage",
+    "temperature",
+    "control",
+    "mqtt",
+    "heater",
+    "ui"
+};
+
+void LoopStats::record(LoopStage stage, uint32_t us) {
+    stageStats& s = stats[stage];
+
+    if (s.count == 0 || us < s.minUs) s.minUs = us;
+    if (us > s.maxUs) s.maxUs = us;
+    s.count++;
+    s.totalUs += us;
+    s.hist[bucket(us)]++;
+}
+
+void LoopStats::reset() {
+    memset(stats, 0, sizeof(stats));
+}
+
+const stageStats& LoopStats::get(LoopStage stage) {
+    return stats[stage];
+}
+
+uint32_t LoopStats::mean(LoopStage stage) {
+    const stageStats& s = stats[stage];
+    return s.count ? uint32_t(s.totalUs / s.count) : 0;
+}
+
+const char* LoopStats::name(LoopStage stage) {
+    return stage < STAGE_COUNT ? stageNames[stage] : "?";
+}
+
+/*
+    log2 bucket: 0-1 us -> 0, 2-3 us -> 1, 4-7 us -> 2 ...
+*/
+uint8_t LoopStats::bucket(uint32_t us) {
+    uint8_t b = 31 - __builtin_clz(us | 1);
+    return b < LOOP_HIST_BUCKETS ? b : LOOP_HIST_BUCKETS - 1;
+}
+
+size_t LoopStats::formatSummary(LoopStage stage, char* buf, size_t len) {
+    const stageStats& s = stats[stage];
+    int n = snprintf(buf, len, "mean %lu / max %lu us  (n %lu)",
+                     (unsigned long)mean(stage), (unsigned long)s.maxUs, (unsigned long)s.count);
+    return n < 0 ? 0 : size_t(n);
+}
+
+size_t LoopStats::formatJson(LoopStage stage, char* buf, size_t len) {
+    const stageStats& s = stats[stage];
+    int n = snprintf(buf, len, "{\"n\":%lu,\"min\":%lu,\"mean\":%lu,\"max\":%lu,\"hist\":[",
+                     (unsigned long)s.count, (unsigned long)s.minUs, (unsigned long)mean(stage), (unsigned long)s.maxUs);
+
+    for (uint8_t i = 0; i < LOOP_HIST_BUCKETS && n > 0 && size_t(n) < len; i++) {
+        n += snprintf(buf + n, len - n, i ? ",%lu" : "%lu", (unsigned long)s.hist[i]);
+    }
+    if (n > 0 && size_t(n) < len) n += snprintf(buf + n, len - n, "]}");
+    return n < 0 ? 0 : size_t(n);
+}
+
+void LoopStats::print() {
+    Serial.println("stage           count      min     mean      max  [us]");
+
+    for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+        const stageStats& s = stats[i];
+        if (!s.count) continue;
+
+        Serial.printf("%-12s %9lu %8lu %8lu %8lu\n", stageNames[i], (unsigned long)s.count,
+                      (unsigned long)s.minUs, (unsigned long)mean(LoopStage(i)), (unsigned long)s.maxUs);
+
+        Serial.print("   ");
+        for (uint8_t b = 0; b < LOOP_HIST_BUCKETS; b++) {
+            if (!s.hist[b]) continue;
+            if (b == LOOP_HIST_BUCKETS - 1) Serial.printf(" >=%lu:%lu", 1UL << b, (unsigned long)s.hist[b]);
+            else Serial.printf(" <%lu:%lu", 2UL << b, (unsigned long)s.hist[b]);
+        }
+        Serial.println();
+    }
+}
@@ -0,0 +1,75 @@
+// LoopStats.h
+#ifndef LOOP_STATS_H
+#define LOOP_STATS_H
+
+#include <Arduino.h>
+
+/*
+    Loop latency instrumentation.
+
+    Every stage of the superloop gets min / max / mean and a log2 histogram of
+    its run time in microseconds: bucket i counts calls that took 2^i .. 2^(i+1)-1 us,
+    the last bucket takes everything longer. All storage is a fixed static table,
+    recording is a handful of integer ops and never allocates.
+
+        void Battery::readVoltage(...) {
+            LOOP_TIMER(STAGE_VOLTAGE);
+            ...
+        }
+*/
+
+#define LOOP_HIST_BUCKETS 24        // 1 us .. 8 s and over
+
+enum LoopStage {
+    STAGE_LOOP,             // Arduino loop() in main.cpp
+    STAGE_BATTERY,          // Battery::loop()
+    STAGE_VOLTAGE,          // readVoltage()
+    STAGE_TEMPERATURE,      // readTemperature()
+    STAGE_CONTROL,          // handleBatteryControl()
+    STAGE_MQTT,             // handleMqtt()
+    STAGE_HEATER,           // controlHeaterPWM()
+    STAGE_UI,               // ESPUI label updates
+    STAGE_COUNT
+};
+
+struct stageStats {
+    uint32_t    count;                      // Calls recorded
+    uint32_t    minUs;                      // Fastest call
+    uint32_t    maxUs;                      // Slowest call
+    uint64_t    totalUs;                    // Sum for the mean
+    uint32_t    hist[LOOP_HIST_BUCKETS];    // log2 buckets
+};
+
+class LoopStats {
+public:
+    static void record(LoopStage stage, uint32_t us);
+    static void reset();
+
+    static const stageStats& get(LoopStage stage);
+    static uint32_t mean(LoopStage stage);
+    static const char* name(LoopStage stage);
+    static uint8_t bucket(uint32_t us);
+
+    // "mean 12 / max 6021 us  (n 1234)" for a UI label
+    static size_t formatSummary(LoopStage stage, char* buf, size_t len);
+    // {"n":..,"min":..,"mean":..,"max":..,"hist":[..]} for MQTT
+    static size_t formatJson(LoopStage stage, char* buf, size_t len);
+    // Table of all stages with their non-empty buckets on Serial
+    static void print();
+};
+
+class ScopedTimer {
+public:
+    explicit ScopedTimer(LoopStage stage) : stage(stage), start(micros()) {}
+    ~ScopedTimer() { LoopStats::record(stage, micros() - start); }
+
+private:
+    LoopStage   stage;
+    uint32_t    start;
+};
+
+#define LOOP_TIMER_CAT(a, b) a##b
+#define LOOP_TIMER_NAME(line) LOOP_TIMER_CAT(loopTimer_, line)
+#define LOOP_TIMER(stage) ScopedTimer LOOP_TIMER_NAME(__LINE__)(stage)
+
+#endif // LOOP_STATS_H
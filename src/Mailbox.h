@@ -0,0 +1,47 @@
+// Mailbox.h
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <atomic>
+#include <stdint.h>
+
+/*
+    Single producer, single consumer queue of POD entries between two tasks.
+
+    The producer owns head, the consumer tail; each publishes its index with
+    a release store after touching the slot, so the other side never sees a
+    half written entry. One slot stays empty to tell full from empty, a
+    Mailbox<T, 8> holds 7 entries. push() on a full queue drops the entry and
+    returns false, nobody ever waits.
+*/
+template <typename T, uint8_t N>
+class Mailbox {
+public:
+    bool push(const T& item) {                  // producer task only
+        uint8_t h = head.load(std::memory_order_relaxed);
+        uint8_t next = (h + 1) % N;
+        if (next == tail.load(std::memory_order_acquire)) return false;
+        items[h] = item;
+        head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {                         // consumer task only
+        uint8_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        item = items[t];
+        tail.store((t + 1) % N, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    T items[N];
+    std::atomic<uint8_t> head{0};
+    std::atomic<uint8_t> tail{0};
+};
+
+#endif // MAILBOX_H
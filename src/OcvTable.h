@@ -0,0 +1,139 @@
+// OcvTable.h
+#ifndef OCV_TABLE_H
+#define OCV_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+    Open circuit voltage <-> state of charge, per cell and per chemistry.
+
+    Each curve is a short list of (mV, %) points. The constexpr constructor
+    precomputes a Q16 slope for every segment in both directions, so a lookup
+    is a binary search over OCV_POINTS entries plus one multiply, and the
+    whole table, slopes included, is built by the compiler into flash.
+
+        uint16_t soc = ocvCurve(CHEM_NMC).socTenths(3800);     // 500, 50.0 %
+        uint16_t mv  = ocvCurve(CHEM_NMC).milliVolts(500);     // 3800
+
+    The curves are typical resting voltages for the chemistry, good enough to
+    put the eco / boost thresholds on the plateau where they belong. They are
+    not a substitute for coulomb counting under load.
+*/
+
+#define OCV_POINTS 13
+#define OCV_SHIFT 16
+
+enum Chemistry : uint8_t {
+    CHEM_NMC,               // Li-ion NMC / NCA, 3.0 .. 4.2 V
+    CHEM_LFP,               // LiFePO4, 2.5 .. 3.6 V, flat plateau
+    CHEM_LTO,               // Lithium titanate, 1.8 .. 2.8 V
+    CHEM_COUNT
+};
+
+struct ocvPoint {
+    uint16_t    milliVolt;
+    uint8_t     soc;        // percent
+};
+
+class OcvCurve {
+public:
+    constexpr OcvCurve(const ocvPoint (&p)[OCV_POINTS]) : points(), socSlope(), mvSlope() {
+        for (size_t i = 0; i < OCV_POINTS; i++) {
+            points[i] = p[i];
+            if (i + 1 == OCV_POINTS) break;
+            int32_t dv = int32_t(p[i + 1].milliVolt) - p[i].milliVolt;
+            int32_t ds = (int32_t(p[i + 1].soc) - p[i].soc) * 10;
+            socSlope[i] = dv > 0 ? (ds << OCV_SHIFT) / dv : 0;
+            mvSlope[i] = ds > 0 ? (dv << OCV_SHIFT) / ds : 0;
+        }
+    }
+
+    // Both columns strictly rising, 0 % first and 100 % last
+    constexpr bool valid() const {
+        if (points[0].soc != 0 || points[OCV_POINTS - 1].soc != 100) return false;
+        for (size_t i = 1; i < OCV_POINTS; i++) {
+            if (points[i].milliVolt <= points[i - 1].milliVolt || points[i].soc <= points[i - 1].soc) return false;
+        }
+        return true;
+    }
+
+    // State of charge in 0.1 %, clamped to 0 .. 1000
+    constexpr uint16_t socTenths(uint32_t cellMilliVolt) const {
+        if (cellMilliVolt <= points[0].milliVolt) return 0;
+        if (cellMilliVolt >= points[OCV_POINTS - 1].milliVolt) return 1000;
+
+        size_t i = segment(cellMilliVolt, true);
+        int32_t d = int32_t(cellMilliVolt) - points[i].milliVolt;
+        return uint16_t(points[i].soc * 10 + ((d * socSlope[i] + (1 << (OCV_SHIFT - 1))) >> OCV_SHIFT));
+    }
+
+    // Cell voltage at a state of charge in 0.1 %
+    constexpr uint16_t milliVolts(uint32_t tenths) const {
+        if (tenths == 0) return points[0].milliVolt;
+        if (tenths >= 1000) return points[OCV_POINTS - 1].milliVolt;
+
+        size_t i = segment(tenths, false);
+        int32_t d = int32_t(tenths) - points[i].soc * 10;
+        return uint16_t(points[i].milliVolt + ((d * mvSlope[i] + (1 << (OCV_SHIFT - 1))) >> OCV_SHIFT));
+    }
+
+    // Q16 tenths of % per mV around a cell voltage, flat parts of the curve are steep here
+    constexpr int32_t slope(uint32_t cellMilliVolt) const {
+        if (cellMilliVolt <= points[0].milliVolt) return socSlope[0];
+        if (cellMilliVolt >= points[OCV_POINTS - 1].milliVolt) return socSlope[OCV_POINTS - 2];
+        return socSlope[segment(cellMilliVolt, true)];
+    }
+
+    constexpr uint16_t minMilliVolts() const { return points[0].milliVolt; }
+    constexpr uint16_t maxMilliVolts() const { return points[OCV_POINTS - 1].milliVolt; }
+
+private:
+    ocvPoint    points[OCV_POINTS];
+    int32_t     socSlope[OCV_POINTS];       // Q16 tenths of % per mV, segment i .. i + 1
+    int32_t     mvSlope[OCV_POINTS];        // Q16 mV per tenth of %
+
+    // Last point at or below x, by voltage or by tenths of %
+    constexpr size_t segment(uint32_t x, bool byVoltage) const {
+        size_t lo = 0, hi = OCV_POINTS - 1;
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            uint32_t key = byVoltage ? points[mid].milliVolt : points[mid].soc * 10u;
+            if (key <= x) lo = mid;
+            else hi = mid;
+        }
+        return lo;
+    }
+};
+
+constexpr ocvPoint ocvNmc[OCV_POINTS] = {
+    {3000, 0}, {3300, 2}, {3450, 5}, {3550, 10}, {3620, 20}, {3680, 30}, {3740, 40},
+    {3800, 50}, {3870, 60}, {3940, 70}, {4020, 80}, {4100, 90}, {4200, 100}
+};
+
+constexpr ocvPoint ocvLfp[OCV_POINTS] = {
+    {2500, 0}, {2900, 3}, {3100, 7}, {3200, 12}, {3250, 20}, {3280, 30}, {3295, 40},
+    {3305, 50}, {3315, 60}, {3325, 70}, {3335, 80}, {3380, 95}, {3600, 100}
+};
+
+constexpr ocvPoint ocvLto[OCV_POINTS] = {
+    {1800, 0}, {2000, 5}, {2150, 10}, {2250, 20}, {2300, 30}, {2340, 40}, {2380, 50},
+    {2420, 60}, {2460, 70}, {2520, 80}, {2600, 90}, {2680, 97}, {2800, 100}
+};
+
+constexpr OcvCurve ocvCurves[CHEM_COUNT] = {
+    OcvCurve(ocvNmc),
+    OcvCurve(ocvLfp),
+    OcvCurve(ocvLto)
+};
+
+static_assert(ocvCurves[CHEM_NMC].valid() && ocvCurves[CHEM_LFP].valid() && ocvCurves[CHEM_LTO].valid(),
+              "OCV curves must rise from 0 % to 100 %");
+static_assert(ocvCurves[CHEM_NMC].socTenths(3800) == 500, "NMC lookup");
+static_assert(ocvCurves[CHEM_NMC].milliVolts(500) == 3800, "NMC inverse lookup");
+
+inline const OcvCurve& ocvCurve(uint8_t chemistry) {
+    return ocvCurves[chemistry < CHEM_COUNT ? chemistry : uint8_t(CHEM_NMC)];
+}
+
+#endif // OCV_TABLE_H
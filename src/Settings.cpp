@@ -0,0 +1,385 @@
+#include "Settings.h"
+#include <cstddef>
+
+#define FIELD(member) [](batteryState& b) -> void* { return &b.member; }
+
+/*
+    One row per setting, in SettingKey order. The keys and value types are the
+    ones the firmware has always used; packed rows are read from those keys only
+    to migrate a unit that has no settings blob yet.
+*/
+static const settingDef settingDefs[SETTING_COUNT] = {
+    {"myname",      KIND_STRING,    SETUP,      true,   FIELD(name)},
+    {"size",        KIND_U8,        SETUP,      true,   FIELD(size)},
+    {"chrgr",       KIND_U8,        SETUP,      true,   FIELD(chrgr.current)},
+    {"capct",       KIND_U8,        SETUP,      true,   FIELD(capct)},
+    {"temperature", KIND_FLOAT,     SETUP,      true,   FIELD(temperature)},
+    {"currentVolt", KIND_U8,        SETUP,      true,   FIELD(voltageInPrecent)},
+    {"ecoVolt",     KIND_U8,        SETUP,      true,   FIELD(ecoVoltPrecent)},
+    {"boostVolt",   KIND_U8,        SETUP,      true,   FIELD(boostVoltPrecent)},
+    {"resistance",  KIND_U8,        SETUP,      true,   FIELD(heater.resistance)},
+    {"boostTemp",   KIND_U8,        SETUP,      true,   FIELD(heater.boostTemp)},
+    {"ecoTemp",     KIND_U8,        SETUP,      true,   FIELD(heater.ecoTemp)},
+    {"maxPower",    KIND_U8,        SETUP,      true,   FIELD(heater.powerLimit)},
+    {"tempRes",     KIND_U8,        SETUP,      true,   FIELD(ds.resolution)},
+    {"tboost",      KIND_BOOL,      SETUP,      true,   FIELD(tempBoost)},
+    {"vboost",      KIND_BOOL,      SETUP,      true,   FIELD(voltBoost)},
+    {"vfilter",     KIND_U8,        SETUP,      true,   FIELD(adc.filterMode)},
+    {"tfilter",     KIND_U8,        SETUP,      true,   FIELD(ds.filterMode)},
+    {"chem",        KIND_U8,        SETUP,      true,   FIELD(chemistry)},
+    {"hystWarn",    KIND_U8,        SETUP,      true,   FIELD(vHyst[WARNING])},
+    {"hystLovv",    KIND_U8,        SETUP,      true,   FIELD(vHyst[LOVV])},
+    {"hystEco",     KIND_U8,        SETUP,      true,   FIELD(vHyst[ECO])},
+    {"hystBoost",   KIND_U8,        SETUP,      true,   FIELD(vHyst[BOOST])},
+    {"hystFull",    KIND_U8,        SETUP,      true,   FIELD(vHyst[FULL])},
+    {"chrgrOn",     KIND_U16,       SETUP,      true,   FIELD(chrgr.minOn)},
+    {"chrgrOff",    KIND_U16,       SETUP,      true,   FIELD(chrgr.minOff)},
+    {"quickStart",  KIND_BOOL,      SETUP,      true,   FIELD(startup.skip)},
+
+    {"wssid",       KIND_STRING,    WIFI,       false,  FIELD(wlan.ssid)},
+    {"wpass",       KIND_STRING,    WIFI,       false,  FIELD(wlan.pass)},
+
+    {"httpen",      KIND_BOOL,      HTTP,       true,   FIELD(http.enable)},
+    {"httpusr",     KIND_STRING,    HTTP,       false,  FIELD(http.username)},
+    {"httppass",    KIND_STRING,    HTTP,       false,  FIELD(http.password)},
+
+    {"mqtten",      KIND_BOOL,      MQTT,       true,   FIELD(mqtt.enable)},
+    {"mqttip",      KIND_STRING,    MQTT,       false,  FIELD(mqtt.server)},
+    {"mqttport",    KIND_U16,       MQTT,       true,   FIELD(mqtt.port)},
+    {"mqttusr",     KIND_STRING,    MQTT,       false,  FIELD(mqtt.username)},
+    {"mqttpass",    KIND_STRING,    MQTT,       false,  FIELD(mqtt.password)},
+    {"mqttfmt",     KIND_U8,        MQTT,       true,   FIELD(mqtt.format)},
+
+    {"tgen",        KIND_BOOL,      TELEGRAM,   true,   FIELD(telegram.enable)},
+    {"tgtoken",     KIND_STRING,    TELEGRAM,   false,  FIELD(telegram.token)},
+    {"tgusr",       KIND_I32,       TELEGRAM,   true,   FIELD(telegram.chatId)},
+
+    {"pidP",        KIND_FLOAT,     PID,        true,   FIELD(heater.pidP)},
+    {"pidI",        KIND_FLOAT,     PID,        true,   FIELD(heater.pidI)},
+    {"pidD",        KIND_FLOAT,     PID,        true,   FIELD(heater.pidD)},
+    {"tuneOk",      KIND_BOOL,      PID,        true,   FIELD(stune.done)},
+    {"heatOn",      KIND_BOOL,      PID,        true,   FIELD(heater.enable)},
+
+    {CAL_KEY,       KIND_CAL,       ALL,        false,  FIELD(calibration)},
+};
+
+#undef FIELD
+
+const settingDef& SettingsStore::def(SettingKey key) {
+    return settingDefs[key];
+}
+
+void SettingsStore::markDirty(SettingKey key) {
+    if (key >= SETTING_COUNT) return;
+    dirtyTime = millis();
+    dirtyMask.fetch_or(1ULL << key);
+}
+
+void SettingsStore::markPacked() {
+    uint64_t mask = 0;
+    for (uint8_t i = 0; i < SETTING_COUNT; i++) {
+        if (settingDefs[i].packed) mask |= 1ULL << i;
+    }
+    dirtyTime = millis();
+    dirtyMask.fetch_or(mask);
+}
+
+void SettingsStore::markGroup(SettingsType group) {
+    uint64_t mask = 0;
+    for (uint8_t i = 0; i < SETTING_COUNT; i++) {
+        if (group == ALL || settingDefs[i].group == group) mask |= 1ULL << i;
+    }
+    dirtyTime = millis();
+    dirtyMask.fetch_or(mask);
+}
+
+bool SettingsStore::isDirty(SettingsType group) const {
+    uint64_t mask = dirtyMask.load();
+    for (uint8_t i = 0; i < SETTING_COUNT; i++) {
+        if ((mask & (1ULL << i)) && (group == ALL || settingDefs[i].group == group)) return true;
+    }
+    return false;
+}
+
+bool SettingsStore::commit(Preferences& prefs, batteryState& b, bool force) {
+    if (!pending()) return false;
+    if (!force && millis() - dirtyTime < SETTINGS_DEBOUNCE_MS) return false;
+
+    uint64_t mask = dirtyMask.exchange(0);
+
+    if (!prefs.begin(SETTINGS_NAMESPACE, false)) {
+        dirtyMask.fetch_or(mask);       // try again next time
+        return false;
+    }
+    bool blob = false;
+    for (uint8_t i = 0; i < SETTING_COUNT; i++) {
+        if (!(mask & (1ULL << i))) continue;
+        if (settingDefs[i].packed) {
+            blob = true;
+            continue;
+        }
+        if (write(prefs, settingDefs[i], b)) stats.writes++;
+        else stats.skipped++;
+    }
+    if (blob) {
+        if (writeBlob(prefs, b)) stats.writes++;
+        else stats.skipped++;
+    }
+    prefs.end();
+    stats.commits++;
+
+    #ifdef DEBUG
+    Serial.printf("Settings commit: %lu writes, %lu skipped in total\n",
+                  (unsigned long)stats.writes, (unsigned long)stats.skipped);
+    #endif
+    return true;
+}
+
+/*
+    Write one key unless flash already holds the same value. Returns true if it was written.
+*/
+bool SettingsStore::write(Preferences& prefs, const settingDef& d, batteryState& b) {
+    void* p = d.field(b);
+    bool stored = prefs.isKey(d.key);
+
+    switch (d.kind) {
+        case KIND_U8: {
+            uint8_t v = *static_cast<uint8_t*>(p);
+            if (stored && prefs.getUChar(d.key) == v) return false;
+            prefs.putUChar(d.key, v);
+            break;
+        }
+        case KIND_U16: {
+            uint16_t v = *static_cast<uint16_t*>(p);
+            if (stored && prefs.getUShort(d.key) == v) return false;
+            prefs.putUShort(d.key, v);
+            break;
+        }
+        case KIND_I32: {
+            int32_t v = *static_cast<int32_t*>(p);
+            if (stored && prefs.getInt(d.key) == v) return false;
+            prefs.putInt(d.key, v);
+            break;
+        }
+        case KIND_BOOL: {
+            bool v = *static_cast<bool*>(p);
+            if (stored && prefs.getBool(d.key) == v) return false;
+            prefs.putBool(d.key, v);
+            break;
+        }
+        case KIND_FLOAT: {
+            float v = *static_cast<float*>(p);
+            if (stored && prefs.getFloat(d.key) == v) return false;
+            prefs.putFloat(d.key, v);
+            break;
+        }
+        case KIND_STRING: {
+            const String& v = *static_cast<String*>(p);
+            if (stored && prefs.getString(d.key) == v) return false;
+            prefs.putString(d.key, v);
+            break;
+        }
+        case KIND_CAL:
+            if (!static_cast<VoltageCalibration*>(p)->save(prefs)) return false;
+            break;
+    }
+    return true;
+}
+
+/*
+    Replace the blob in one putBytes(), unless it already holds these values.
+*/
+bool SettingsStore::writeBlob(Preferences& prefs, batteryState& b) {
+    settingsBlob blob, stored;
+    pack(b, blob);
+
+    if (prefs.getBytesLength(SETTINGS_BLOB_KEY) == sizeof(stored) &&
+        prefs.getBytes(SETTINGS_BLOB_KEY, &stored, sizeof(stored)) == sizeof(stored) &&
+        memcmp(&blob, &stored, sizeof(blob)) == 0) return false;
+
+    prefs.putBytes(SETTINGS_BLOB_KEY, &blob, sizeof(blob));
+    return true;
+}
+
+BlobStatus SettingsStore::readBlob(Preferences& prefs, settingsBlob& blob) {
+    size_t len = prefs.getBytesLength(SETTINGS_BLOB_KEY);
+    if (len == 0) return BLOB_MISSING;
+    if (len > sizeof(blob)) return BLOB_BAD_LENGTH;
+
+    memset(&blob, 0, sizeof(blob));
+    if (prefs.getBytes(SETTINGS_BLOB_KEY, &blob, sizeof(blob)) != len) return BLOB_BAD_LENGTH;
+    if (blob.version == 0 || blob.version > SETTINGS_BLOB_VERSION) return BLOB_BAD_VERSION;
+    if (len != blob.length || len != blobLength(blob.version)) return BLOB_BAD_LENGTH;
+
+    // older versions are shorter, their CRC sits right after their last field
+    size_t crcAt = len - sizeof(blob.crc);
+    uint32_t crc;
+    memcpy(&crc, reinterpret_cast<uint8_t*>(&blob) + crcAt, sizeof(crc));
+    if (crc != crc32(&blob, crcAt)) return BLOB_BAD_CRC;
+
+    if (blob.version == SETTINGS_BLOB_VERSION) return BLOB_OK;
+    upgrade(blob, blob.version);
+    return BLOB_UPGRADED;
+}
+
+/*
+    Size of each blob version, settingsBlob only ever grows at the end.
+*/
+size_t SettingsStore::blobLength(uint8_t version) {
+    switch (version) {
+        case 1:     return offsetof(settingsBlob, voltFilter) + sizeof(uint32_t);
+        case 2:     return offsetof(settingsBlob, chemistry) + sizeof(uint32_t);
+        case 3:     return offsetof(settingsBlob, vHyst) + sizeof(uint32_t);
+        case 4:     return offsetof(settingsBlob, quickStart) + sizeof(uint32_t);
+        case 5:     return sizeof(settingsBlob);
+        default:    return 0;
+    }
+}
+
+/*
+    Defaults for the fields an older blob does not have, one case per version.
+*/
+void SettingsStore::upgrade(settingsBlob& blob, uint8_t from) {
+    size_t valid = blobLength(from) - sizeof(blob.crc);
+    memset(reinterpret_cast<uint8_t*>(&blob) + valid, 0, sizeof(blob) - valid);
+
+    switch (from) {
+        case 1:
+            blob.voltFilter = FILTER_MEAN;
+            blob.tempFilter = FILTER_NONE;
+            // fall through
+        case 2:
+            blob.chemistry = CHEM_NMC;
+            // fall through
+        case 3:
+            memcpy(blob.vHyst, vStateHystDefault, sizeof(blob.vHyst));
+            blob.chrgrMinOn = CHARGER_MIN_ON_S;
+            blob.chrgrMinOff = CHARGER_MIN_OFF_S;
+            // fall through
+        case 4:
+            blob.quickStart = false;
+            // fall through
+        default:
+            break;
+    }
+    blob.version = SETTINGS_BLOB_VERSION;
+    blob.length = sizeof(blob);
+    blob.crc = crc32(&blob, offsetof(settingsBlob, crc));
+}
+
+/*
+    RAM -> blob, with the same limits saveSettings() always put on the values it stored.
+*/
+void SettingsStore::pack(const batteryState& b, settingsBlob& blob) {
+    memset(&blob, 0, sizeof(blob));
+    blob.version        = SETTINGS_BLOB_VERSION;
+    blob.length         = sizeof(blob);
+    strncpy(blob.name, b.name.c_str(), sizeof(blob.name) - 1);
+    blob.size           = constrain(b.size, 0, 21);
+    blob.chrgr          = constrain(b.chrgr.current, 0, 15);
+    blob.capct          = b.capct;
+    blob.temperature    = constrain(b.temperature, float(-40), float(40));
+    blob.currentVolt    = constrain(b.voltageInPrecent, 1, 100);
+    blob.ecoVolt        = constrain(b.ecoVoltPrecent, 1, 100);
+    blob.boostVolt      = constrain(b.boostVoltPrecent, 1, 100);
+    blob.resistance     = b.heater.resistance;
+    blob.boostTemp      = constrain(b.heater.boostTemp, 1, 40);
+    blob.ecoTemp        = constrain(b.heater.ecoTemp, 1, 30);
+    blob.maxPower       = constrain(b.heater.powerLimit, 1, 255);
+    blob.tempRes        = b.ds.resolution;
+    blob.tempBoost      = b.tempBoost;
+    blob.voltBoost      = b.voltBoost;
+    blob.httpEnable     = b.http.enable;
+    blob.mqttEnable     = b.mqtt.enable;
+    blob.mqttPort       = b.mqtt.port;
+    blob.mqttFormat     = b.mqtt.format;
+    blob.tgEnable       = b.telegram.enable;
+    blob.tgChat         = b.telegram.chatId;
+    blob.pidP           = b.heater.pidP;
+    blob.pidI           = b.heater.pidI;
+    blob.pidD           = b.heater.pidD;
+    blob.tuneOk         = b.stune.done;
+    blob.heatOn         = b.heater.enable;
+    blob.voltFilter     = b.adc.filterMode;
+    blob.tempFilter     = b.ds.filterMode;
+    blob.chemistry      = b.chemistry;
+    memcpy(blob.vHyst, b.vHyst, sizeof(blob.vHyst));
+    blob.chrgrMinOn     = b.chrgr.minOn;
+    blob.chrgrMinOff    = b.chrgr.minOff;
+    blob.quickStart     = b.startup.skip;
+    blob.crc            = crc32(&blob, offsetof(settingsBlob, crc));
+}
+
+/*
+    Copy one group (or ALL) from a checked blob into RAM.
+*/
+void SettingsStore::unpack(const settingsBlob& blob, batteryState& b, SettingsType group) {
+    bool all = group == ALL;
+
+    if (all || group == SETUP) {
+        char name[SETTINGS_NAME_LEN];
+        memcpy(name, blob.name, sizeof(name));
+        name[sizeof(name) - 1] = '\0';
+
+        // same limits as the per-key load, size and temperature as saveSettings() kept them
+        b.name              = name;
+        b.size              = constrain(blob.size, 0, 21);
+        b.chrgr.current     = constrain(blob.chrgr, 1, 5);
+        b.capct             = constrain(blob.capct, 1, 255);
+        b.temperature       = constrain(blob.temperature, float(-40), float(40));
+        b.voltageInPrecent  = constrain(blob.currentVolt, 5, 100);
+        b.ecoVoltPrecent    = constrain(blob.ecoVolt, 50, 255);
+        b.boostVoltPrecent  = constrain(blob.boostVolt, 50, 255);
+        b.heater.resistance = blob.resistance;
+        b.heater.boostTemp  = constrain(blob.boostTemp, 5, 40);
+        b.heater.ecoTemp    = constrain(blob.ecoTemp, 5, 30);
+        b.heater.powerLimit = constrain(blob.maxPower, 1, 255);
+        b.ds.resolution     = constrain(blob.tempRes, 9, 12);
+        b.tempBoost         = blob.tempBoost;
+        b.voltBoost         = blob.voltBoost;
+        b.adc.filterMode    = blob.voltFilter < FILTER_MODES ? blob.voltFilter : uint8_t(FILTER_MEAN);
+        b.ds.filterMode     = blob.tempFilter < FILTER_MODES ? blob.tempFilter : uint8_t(FILTER_NONE);
+        b.chemistry         = blob.chemistry < CHEM_COUNT ? blob.chemistry : uint8_t(CHEM_NMC);
+        for (uint8_t i = 0; i <= FULL; i++) {
+            b.vHyst[i]      = blob.vHyst[i] <= VSTATE_HYST_MAX ? blob.vHyst[i] : vStateHystDefault[i];
+        }
+        b.chrgr.minOn       = blob.chrgrMinOn <= CHARGER_DWELL_MAX_S ? blob.chrgrMinOn : CHARGER_MIN_ON_S;
+        b.chrgr.minOff      = blob.chrgrMinOff <= CHARGER_DWELL_MAX_S ? blob.chrgrMinOff : CHARGER_MIN_OFF_S;
+        b.startup.skip      = blob.quickStart;
+    }
+    if (all || group == HTTP) {
+        b.http.enable       = blob.httpEnable;
+    }
+    if (all || group == MQTT) {
+        b.mqtt.enable       = blob.mqttEnable;
+        b.mqtt.port         = blob.mqttPort ? blob.mqttPort : 1883;
+        b.mqtt.format       = blob.mqttFormat & (MQTT_FIELDS | MQTT_STATE);
+        if (!b.mqtt.format) b.mqtt.format = MQTT_FIELDS;
+    }
+    if (all || group == TELEGRAM) {
+        b.telegram.enable   = blob.tgEnable;
+        b.telegram.chatId   = blob.tgChat;
+    }
+    if (all || group == PID) {
+        b.heater.pidP       = blob.pidP;
+        b.heater.pidI       = blob.pidI;
+        b.heater.pidD       = blob.pidD;
+        b.stune.done        = blob.tuneOk;
+        b.heater.enable     = blob.heatOn;
+    }
+}
+
+/*
+    CRC-32 (IEEE 802.3, reflected), bitwise: the blob is ~80 bytes and only
+    checked at boot and on save, not worth a 1 kB table.
+*/
+uint32_t SettingsStore::crc32(const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (len--) {
+        crc ^= *p++;
+        for (uint8_t i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
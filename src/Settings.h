@@ -0,0 +1,217 @@
+// Settings.h
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <atomic>
+#include "BatteryState.h"
+
+/*
+    Persistent settings with per-key dirty bits.
+
+    Changing a setting only marks its key dirty. Once nothing has changed for
+    SETTINGS_DEBOUNCE_MS, commit() opens the namespace once and writes the
+    dirty keys, skipping any whose stored value is already the same, so a
+    burst of UI clicks costs one flash write per key that really changed.
+
+        batt.battery.heater.ecoTemp = 25;
+        batt.markSettingDirty(SET_ECO_TEMP);
+
+    The name and all numeric settings live packed in one versioned, CRC-32
+    protected blob (settingsBlob, key "cfg"): boot reads them with a single
+    getBytes() and a save replaces them in one NVS write, so a brown-out can
+    not leave half of a PID update behind. Credentials, SSID and the broker
+    address stay in their own keys. Units without a valid blob are loaded
+    from the old per-key layout and migrated (see Battery::loadSettings()).
+    New settings are appended to the blob in a new version: an older blob is
+    still accepted, upgrade() fills in the fields it did not have yet.
+*/
+
+#define SETTINGS_NAMESPACE "btry"
+#define SETTINGS_DEBOUNCE_MS 2000   // quiet time before dirty keys hit flash
+#define SETTINGS_BLOB_KEY "cfg"
+#define SETTINGS_BLOB_VERSION 5     // bump and extend SettingsStore::upgrade() when settingsBlob grows
+#define SETTINGS_NAME_LEN 32
+
+enum SettingsType {
+    SETUP,
+    WIFI,
+    HTTP,
+    MQTT,
+    TELEGRAM,
+    PID,
+    ALL
+};
+
+enum SettingKey : uint8_t {
+    // SETUP
+    SET_NAME,
+    SET_SIZE,
+    SET_CHRGR,
+    SET_CAPCT,
+    SET_TEMPERATURE,
+    SET_CURRENT_VOLT,
+    SET_ECO_VOLT,
+    SET_BOOST_VOLT,
+    SET_RESISTANCE,
+    SET_BOOST_TEMP,
+    SET_ECO_TEMP,
+    SET_MAX_POWER,
+    SET_TEMP_RES,
+    SET_TEMP_BOOST,
+    SET_VOLT_BOOST,
+    SET_VOLT_FILTER,
+    SET_TEMP_FILTER,
+    SET_CHEMISTRY,
+    SET_HYST_WARNING,
+    SET_HYST_LOVV,
+    SET_HYST_ECO,
+    SET_HYST_BOOST,
+    SET_HYST_FULL,
+    SET_CHRGR_MIN_ON,
+    SET_CHRGR_MIN_OFF,
+    SET_QUICK_START,
+    // WIFI
+    SET_WIFI_SSID,
+    SET_WIFI_PASS,
+    // HTTP
+    SET_HTTP_EN,
+    SET_HTTP_USER,
+    SET_HTTP_PASS,
+    // MQTT
+    SET_MQTT_EN,
+    SET_MQTT_SERVER,
+    SET_MQTT_PORT,
+    SET_MQTT_USER,
+    SET_MQTT_PASS,
+    SET_MQTT_FORMAT,
+    // TELEGRAM
+    SET_TG_EN,
+    SET_TG_TOKEN,
+    SET_TG_CHAT,
+    // PID
+    SET_PID_P,
+    SET_PID_I,
+    SET_PID_D,
+    SET_TUNE_OK,
+    SET_HEAT_ON,
+    // board, in no group: resetSettings() keeps it
+    SET_CALIBRATION,
+    SETTING_COUNT
+};
+
+enum SettingKind : uint8_t {
+    KIND_U8,        // uint8_t,  putUChar
+    KIND_U16,       // uint16_t, putUShort
+    KIND_I32,       // 32 bit,   putInt
+    KIND_BOOL,      // bool,     putBool
+    KIND_FLOAT,     // float,    putFloat
+    KIND_STRING,    // String,   putString
+    KIND_CAL        // VoltageCalibration, its own blob, see Calibration.h
+};
+
+struct settingDef {
+    const char*     key;                        // NVS key, also the legacy key of packed settings
+    SettingKind     kind;
+    SettingsType    group;
+    bool            packed;                     // stored in settingsBlob, not under its own key
+    void*           (*field)(batteryState& b);  // where the value lives in RAM
+};
+
+struct __attribute__((packed)) settingsBlob {
+    uint8_t     version;                    // SETTINGS_BLOB_VERSION
+    uint8_t     length;                     // sizeof(settingsBlob)
+    char        name[SETTINGS_NAME_LEN];
+    uint8_t     size;
+    uint8_t     chrgr;
+    uint8_t     capct;
+    float       temperature;
+    uint8_t     currentVolt;
+    uint8_t     ecoVolt;
+    uint8_t     boostVolt;
+    uint8_t     resistance;
+    uint8_t     boostTemp;
+    uint8_t     ecoTemp;
+    uint8_t     maxPower;
+    uint8_t     tempRes;
+    bool        tempBoost;
+    bool        voltBoost;
+    bool        httpEnable;
+    bool        mqttEnable;
+    uint16_t    mqttPort;
+    uint8_t     mqttFormat;
+    bool        tgEnable;
+    uint32_t    tgChat;
+    float       pidP;
+    float       pidI;
+    float       pidD;
+    bool        tuneOk;
+    bool        heatOn;
+    // version 2
+    uint8_t     voltFilter;
+    uint8_t     tempFilter;
+    // version 3
+    uint8_t     chemistry;
+    // version 4
+    uint8_t     vHyst[FULL + 1];
+    uint16_t    chrgrMinOn;
+    uint16_t    chrgrMinOff;
+    // version 5
+    bool        quickStart;
+    uint32_t    crc;                        // CRC-32 of everything above
+};
+
+enum BlobStatus : uint8_t {
+    BLOB_OK,
+    BLOB_UPGRADED,          // older version, valid, new fields got their defaults
+    BLOB_MISSING,           // never written, per-key layout
+    BLOB_BAD_LENGTH,
+    BLOB_BAD_VERSION,
+    BLOB_BAD_CRC
+};
+
+struct settingsStats {
+    uint32_t    commits;    // namespace open / close rounds
+    uint32_t    writes;     // keys written to flash, the blob counts as one
+    uint32_t    skipped;    // dirty keys that already had the stored value
+};
+
+class SettingsStore {
+public:
+    SettingsStore() : dirtyMask(0), dirtyTime(0), stats{0, 0, 0} {}
+
+    static const settingDef& def(SettingKey key);
+
+    void markDirty(SettingKey key);
+    void markGroup(SettingsType group);     // ALL marks every key
+    void markPacked();                      // every key in the blob
+    void clear() { dirtyMask = 0; }
+    bool isDirty(SettingKey key) const { return dirtyMask.load() & (1ULL << key); }
+    bool isDirty(SettingsType group) const;
+    bool pending() const { return dirtyMask.load() != 0; }
+
+    // Write the dirty keys once the debounce window has passed, or right away with force
+    bool commit(Preferences& prefs, batteryState& b, bool force = false);
+
+    // Single read of the whole blob, checks length, version and CRC
+    BlobStatus readBlob(Preferences& prefs, settingsBlob& blob);
+    static size_t blobLength(uint8_t version);
+
+    static void pack(const batteryState& b, settingsBlob& blob);
+    static void unpack(const settingsBlob& blob, batteryState& b, SettingsType group);
+    static uint32_t crc32(const void* data, size_t len);
+
+    const settingsStats& getStats() const { return stats; }
+
+private:
+    std::atomic<uint64_t>   dirtyMask;
+    uint32_t                dirtyTime;      // millis() of the last markDirty()
+    settingsStats           stats;
+
+    bool write(Preferences& prefs, const settingDef& d, batteryState& b);
+    bool writeBlob(Preferences& prefs, batteryState& b);
+    static void upgrade(settingsBlob& blob, uint8_t from);
+};
+
+#endif // SETTINGS_H
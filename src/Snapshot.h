@@ -0,0 +1,66 @@
+// Snapshot.h
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <atomic>
+#include <cstring>
+
+/*
+    Single writer, many reader snapshot of a POD struct.
+
+    Two buffers, each guarded by its own sequence number (seqlock). The writer
+    fills the buffer readers are not looking at, then publishes it by bumping
+    the write count, so a reader copies the latest finished value while the
+    next one is being written next to it. A reader only has to retry when the
+    writer laps it, i.e. finishes two writes during a single copy.
+
+    Write n goes to buffer n & 1 and leaves its sequence at n + (n & 1), so a
+    reader that picked the buffer from a stale count notices it holds a newer
+    write and starts over: reads never go back a version.
+
+    Nobody takes a lock, nothing allocates and the writer never waits.
+*/
+template <typename T>
+class Snapshot {
+public:
+    Snapshot() : count(0), buf() {
+        seq[0] = 0;
+        seq[1] = 0;
+    }
+
+    void write(const T& value) {
+        uint32_t n = count.load(std::memory_order_relaxed) + 1;
+        uint8_t  i = n & 1;
+        uint32_t s = seq[i].load(std::memory_order_relaxed);
+
+        seq[i].store(s + 1, std::memory_order_relaxed);         // odd: in progress
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&buf[i], &value, sizeof(T));
+        seq[i].store(s + 2, std::memory_order_release);         // even: done
+        count.store(n, std::memory_order_release);
+    }
+
+    T read() const {
+        T value;
+        for (;;) {
+            uint32_t n = count.load(std::memory_order_acquire);
+            uint8_t  i = n & 1;
+            uint32_t s = seq[i].load(std::memory_order_acquire);
+            if (s != n + i) continue;               // being written, or past write n
+
+            memcpy(&value, &buf[i], sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq[i].load(std::memory_order_relaxed) == s) return value;
+        }
+    }
+
+    // Number of completed writes
+    uint32_t version() const { return count.load(std::memory_order_acquire); }
+
+private:
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> seq[2];
+    T buf[2];
+};
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,82 @@
+#include "SocEstimator.h"
+
+#define SOC_FULL 10000
+#define SOC_VARIANCE_MAX (uint32_t(SOC_SIGMA_NO_CONFIDENCE) * SOC_SIGMA_NO_CONFIDENCE)
+
+void SocEstimator::reset() {
+    value = 0;
+    var = SOC_VARIANCE_MAX;
+    started = false;
+    lastTime = 0;
+    charge = 0;
+    pendingMs = 0;
+}
+
+void SocEstimator::predict(uint32_t now, bool charging, uint8_t currentA, uint8_t capacityAh) {
+    uint32_t dt = now - lastTime;
+    lastTime = now;
+    if (!started) return;
+
+    if (charging && currentA && capacityAh) {
+        // 0.01 % of capacityAh is capacityAh * 360 A*ms, times the efficiency in %
+        uint32_t step = uint32_t(capacityAh) * 360 * 100;
+        uint64_t total = uint64_t(charge) + uint64_t(currentA) * dt * SOC_CHARGE_EFFICIENCY;
+        value += int32_t(total / step);
+        charge = uint32_t(total % step);
+        if (value > SOC_FULL) value = SOC_FULL;
+    }
+
+    pendingMs += dt;
+    if (pendingMs >= 1000) {
+        uint64_t grown = var + uint64_t(charging ? SOC_Q_CHARGING : SOC_Q_IDLE) * (pendingMs / 1000);
+        var = grown > SOC_VARIANCE_MAX ? SOC_VARIANCE_MAX : uint32_t(grown);
+        pendingMs %= 1000;
+    }
+}
+
+void SocEstimator::correct(uint16_t voltageSoc, uint32_t sigma) {
+    if (sigma < SOC_SIGMA_MIN) sigma = SOC_SIGMA_MIN;
+    uint64_t r = uint64_t(sigma) * sigma;
+
+    if (!started) {
+        value = voltageSoc;
+        var = r > SOC_VARIANCE_MAX ? SOC_VARIANCE_MAX : uint32_t(r);
+        started = true;
+        return;
+    }
+
+    // Kalman gain in Q16
+    int64_t gain = (int64_t(var) << 16) / int64_t(var + r);
+    value += int32_t((gain * (int32_t(voltageSoc) - value)) / 65536);
+    var -= uint32_t((gain * var) >> 16);
+
+    if (value < 0) value = 0;
+    if (value > SOC_FULL) value = SOC_FULL;
+}
+
+uint8_t SocEstimator::confidence() const {
+    if (!started) return 0;
+
+    // integer square root of the variance: standard deviation in 0.01 %
+    uint32_t sigma = 0, rest = var;
+    for (uint32_t bit = 1u << 30; bit; bit >>= 2) {
+        if (rest >= sigma + bit) {
+            rest -= sigma + bit;
+            sigma = (sigma >> 1) + bit;
+        }
+        else sigma >>= 1;
+    }
+    if (sigma >= SOC_SIGMA_NO_CONFIDENCE) return 0;
+    return uint8_t(100 - sigma * 100 / SOC_SIGMA_NO_CONFIDENCE);
+}
+
+uint16_t SocEstimator::etaMinutes(uint8_t targetPercent, uint8_t currentA, uint8_t capacityAh) const {
+    if (!started || !currentA) return SOC_ETA_UNKNOWN;
+
+    int32_t remaining = int32_t(targetPercent) * 100 - value;
+    if (remaining <= 0) return 0;
+
+    // hours = remaining / 10000 * capacity / (current * efficiency / 100)
+    uint32_t minutes = uint32_t(remaining) * capacityAh * 3 / (5u * currentA * SOC_CHARGE_EFFICIENCY);
+    return minutes >= SOC_ETA_UNKNOWN ? SOC_ETA_UNKNOWN - 1 : uint16_t(minutes);
+}
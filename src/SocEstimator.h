@@ -0,0 +1,61 @@
+// SocEstimator.h
+#ifndef SOC_ESTIMATOR_H
+#define SOC_ESTIMATOR_H
+
+#include <stdint.h>
+
+/*
+    State of charge from coulomb counting and the OCV curve, fused by a
+    scalar Kalman filter in fixed point.
+
+    predict() integrates the configured charger current over the time the
+    charger is on, so the estimate moves smoothly while charging, and grows
+    the uncertainty: slowly while charging (known current), faster while
+    idle (the load is not measured). correct() pulls the estimate towards
+    the voltage based SoC, weighted by how much that reading can be trusted:
+    little while charging (the terminal voltage rides above OCV) and on flat
+    parts of the curve, where a few mV of noise are several percent.
+
+    All values are in 0.01 % (0 .. 10000), variances in (0.01 %)^2.
+*/
+
+#define SOC_CHARGE_EFFICIENCY 95        // % of the charger current that ends up stored
+#define SOC_Q_CHARGING 4                // variance growth per second, charger on
+#define SOC_Q_IDLE 25                   // variance growth per second, charger off
+#define SOC_SIGMA_REST_MV 8             // per cell voltage noise at rest
+#define SOC_SIGMA_CHARGING_MV 60        // per cell offset while charging
+#define SOC_SIGMA_MIN 50                // voltage SoC is never trusted below 0.5 %
+#define SOC_SIGMA_NO_CONFIDENCE 2000    // 20 % standard deviation reads as 0 % confidence
+#define SOC_ETA_UNKNOWN 0xFFFF
+
+class SocEstimator {
+public:
+    SocEstimator() { reset(); }
+
+    void reset();
+
+    // Coulomb counting up to now, charger current in A, capacity in Ah
+    void predict(uint32_t now, bool charging, uint8_t currentA, uint8_t capacityAh);
+
+    // Voltage based SoC and its standard deviation, both in 0.01 %
+    void correct(uint16_t voltageSoc, uint32_t sigma);
+
+    bool ready() const { return started; }
+    uint16_t soc() const { return uint16_t(value); }
+    uint8_t percent() const { return uint8_t((value + 50) / 100); }
+    uint32_t variance() const { return var; }
+    uint8_t confidence() const;
+
+    // Minutes of charging to reach target %, SOC_ETA_UNKNOWN without a current
+    uint16_t etaMinutes(uint8_t targetPercent, uint8_t currentA, uint8_t capacityAh) const;
+
+private:
+    int32_t     value;
+    uint32_t    var;
+    bool        started;        // first voltage reading seen
+    uint32_t    lastTime;       // last predict()
+    uint32_t    charge;         // A*ms*% not yet worth 0.01 %
+    uint32_t    pendingMs;      // time not yet added to the variance
+};
+
+#endif // SOC_ESTIMATOR_H
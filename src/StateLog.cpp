@@ -0,0 +1,62 @@
+#include "StateLog.h"
+#include <stdio.h>
+
+void StateLog::append(StateKind kind, uint8_t state, uint8_t previous, uint32_t seconds) {
+    events[head] = {seconds, kind, state, previous, 0};
+    head = (head + 1) % STATE_LOG_SIZE;
+    if (count < STATE_LOG_SIZE) count++;
+    total++;
+}
+
+const stateEvent& StateLog::at(uint8_t age) const {
+    return events[(head + STATE_LOG_SIZE - 1 - age) % STATE_LOG_SIZE];
+}
+
+uint8_t StateLog::render(char* names, size_t namesLen, char* times, size_t timesLen, uint8_t last) const {
+    size_t n = 0, t = 0;
+    uint8_t written = 0;
+    if (!namesLen || !timesLen) return 0;
+    names[0] = 0;
+    times[0] = 0;
+
+    if (last > count) last = count;
+    for (int age = last - 1; age >= 0; age--) {
+        const stateEvent& e = at(age);
+        int nl = snprintf(names + n, namesLen - n, "%s\n", name(e.kind, e.state));
+        int tl = snprintf(times + t, timesLen - t, "%lu min\n", (unsigned long)(e.seconds / 60));
+        if (nl < 0 || tl < 0 || n + nl >= namesLen || t + tl >= timesLen) {
+            names[n] = 0;               // keep whole lines only
+            times[t] = 0;
+            break;
+        }
+        n += nl;
+        t += tl;
+        written++;
+    }
+    return written;
+}
+
+const char* StateLog::name(StateKind kind, uint8_t state) {
+    if (kind == LOG_VSTATE) {
+        switch (state) {
+            case ALERT:     return "ALERT";
+            case WARNING:   return "WARNING";
+            case LOVV:      return "Low Voltage";
+            case ECO:       return "Eco Voltage";
+            case BOOST:     return "Boost Voltage";
+            case FULL:      return "Full Battery";
+            default:        return "UNKNOWN";
+        }
+    }
+    switch (state) {
+        case SUBZERO:       return "SUBZERO TEMP WARNING";
+        case COLD:          return "Cold Temp";
+        case ECO_TEMP:      return "Eco Temp";
+        case ECO_READY:     return "Eco Temp Ready";
+        case BOOST_TEMP:    return "Boost Temp";
+        case BOOST_READY:   return "Boost Temp Ready";
+        case TEMP_WARNING:  return "Temp Warning";
+        case UNKNOWN_TEMP:  return "UNKNOWN TEMP ALERT";
+        default:            return "COLD";
+    }
+}
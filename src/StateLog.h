@@ -0,0 +1,59 @@
+// StateLog.h
+#ifndef STATE_LOG_H
+#define STATE_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "BatteryState.h"
+
+/*
+    Voltage / temperature state changes, newest STATE_LOG_SIZE of them.
+
+    Fixed ring of 8-byte records: append() overwrites the oldest one, so the
+    log costs the same after a minute and after a year. handleBatteryControl()
+    records every change as it happens, plain data so the UI gets it through a
+    Snapshot like the telemetry.
+
+        stateEvent e = log.at(0);       // newest
+*/
+
+#define STATE_LOG_SIZE 32
+
+enum StateKind : uint8_t {
+    LOG_VSTATE,
+    LOG_TSTATE
+};
+
+struct stateEvent {
+    uint32_t    seconds;            // since boot
+    StateKind   kind;
+    uint8_t     state;              // VoltageState or TempState
+    uint8_t     previous;
+    uint8_t     reserved;
+};
+
+class StateLog {
+public:
+    StateLog() : head(0), count(0), total(0), events() {}
+
+    void append(StateKind kind, uint8_t state, uint8_t previous, uint32_t seconds);
+    void clear() { head = 0; count = 0; total = 0; }
+
+    uint8_t size() const { return count; }
+    uint32_t appended() const { return total; }     // including overwritten ones
+    const stateEvent& at(uint8_t age) const;        // 0 = newest, age < size()
+
+    // Oldest first, the newest `last` events: one state name per line in
+    // names, "12 min" per line in times. Returns the events written.
+    uint8_t render(char* names, size_t namesLen, char* times, size_t timesLen, uint8_t last) const;
+
+    static const char* name(StateKind kind, uint8_t state);
+
+private:
+    uint8_t     head;               // next slot to write
+    uint8_t     count;
+    uint32_t    total;
+    stateEvent  events[STATE_LOG_SIZE];
+};
+
+#endif // STATE_LOG_H
@@ -0,0 +1,219 @@
+#include "WifiLink.h"
+#include "Settings.h"
+#include <cstddef>
+
+WifiLink* WifiLink::instance = nullptr;
+
+/*
+    Runs in the WiFi driver's task: only flag what happened, loop() acts on it.
+*/
+void WifiLink::onEvent(arduino_event_id_t event) {
+    if (!instance) return;
+    switch (event) {
+        case ARDUINO_EVENT_WIFI_STA_GOT_IP:         instance->events |= EV_GOT_IP; break;
+        case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+        case ARDUINO_EVENT_WIFI_STA_LOST_IP:        instance->events |= EV_LOST; break;
+        default: break;
+    }
+}
+
+void WifiLink::begin(const char* ssid, const char* pass, const char* hostname, const char* hotspot) {
+    instance = this;
+    WiFi.onEvent(onEvent);
+
+    strncpy(this->ssid, ssid ? ssid : "", sizeof(this->ssid) - 1);
+    strncpy(this->pass, pass ? pass : "", sizeof(this->pass) - 1);
+    this->hotspot = hotspot;
+    everLinked = false;
+    hotspotUp = false;
+    events = 0;
+
+    WiFi.setHostname(hostname);
+    WiFi.setAutoReconnect(false);       // loop() decides how to rejoin
+    joinStart = millis();
+
+    if (!this->ssid[0]) openHotspot();
+    else if (loadCache()) fastJoin();
+    else scanJoin();
+}
+
+void WifiLink::loop() {
+    uint8_t ev = events.exchange(0);
+    uint32_t now = millis();
+
+    // both bits in one pass: the driver's current state says which came last
+    if ((ev & EV_GOT_IP) && WiFi.isConnected()) linkUp();
+
+    if ((ev & EV_LOST) && state == WIFI_LINKED && !WiFi.isConnected()) {
+        counters.drops++;
+        joinStart = now;
+        if (haveCache) fastJoin();
+        else scanJoin();
+        return;
+    }
+
+    switch (state) {
+        case WIFI_FAST_JOIN:
+            if (now - phaseStart >= WIFI_FAST_MS) {
+                counters.fastMisses++;
+                scanJoin();
+            }
+            break;
+
+        case WIFI_SCAN_JOIN:
+            if (now - phaseStart >= WIFI_JOIN_MS) {
+                if (!everLinked) openHotspot();
+                else if (haveCache) fastJoin();
+                else scanJoin();
+            }
+            break;
+
+        case WIFI_LINKED:
+            if (renewing && now - phaseStart >= WIFI_JOIN_MS) {
+                counters.renewMisses++;
+                joinStart = now;
+                scanJoin();
+            }
+            break;
+
+        case WIFI_HOTSPOT:
+            if (ssid[0] && now - phaseStart >= WIFI_RETRY_MS) {
+                if (haveCache) fastJoin();
+                else scanJoin();
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+void WifiLink::forget() {
+    haveCache = false;
+    memset(&cache, 0, sizeof(cache));
+
+    Preferences prefs;
+    if (!prefs.begin(SETTINGS_NAMESPACE, false)) return;
+    prefs.remove(WIFI_CACHE_KEY);
+    prefs.end();
+}
+
+void WifiLink::fastJoin() {
+    renewing = false;
+    WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+    WiFi.begin(ssid, pass, cache.channel, cache.bssid);
+    state = WIFI_FAST_JOIN;
+    phaseStart = millis();
+}
+
+void WifiLink::scanJoin() {
+    renewing = false;
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);     // back to DHCP
+    WiFi.begin(ssid, pass);
+    state = WIFI_SCAN_JOIN;
+    phaseStart = millis();
+}
+
+/*
+    Soft AP next to the station, so loop() can keep retrying the access
+    point. Called again after every failed retry, the AP is only set up once.
+*/
+void WifiLink::openHotspot() {
+    WiFi.disconnect();
+    if (!hotspotUp) {
+        WiFi.mode(WIFI_AP_STA);
+        WiFi.softAPConfig(IPAddress(192, 168, 1, 1), IPAddress(192, 168, 1, 1), IPAddress(255, 255, 255, 0));
+        WiFi.softAP(hotspot);
+        hotspotUp = true;
+    }
+    state = WIFI_HOTSPOT;
+    phaseStart = millis();
+}
+
+void WifiLink::closeHotspot() {
+    if (!hotspotUp) return;
+    WiFi.softAPdisconnect(false);
+    WiFi.mode(WIFI_STA);
+    hotspotUp = false;
+}
+
+void WifiLink::linkUp() {
+    if (state == WIFI_LINKED && renewing) {
+        renewing = false;
+        counters.renews++;
+        saveCache();
+        return;
+    }
+
+    bool fast = state == WIFI_FAST_JOIN;
+    if (fast) counters.fastJoins++;
+    else if (state == WIFI_SCAN_JOIN) counters.scanJoins++;
+    else return;                        // stale event from a join already given up
+
+    counters.lastJoinMs = millis() - joinStart;
+    state = WIFI_LINKED;
+    everLinked = true;
+    closeHotspot();
+
+    if (fast) renewLease();
+    else saveCache();
+}
+
+/*
+    Back to DHCP without leaving the access point, the address stays usable
+    until the server answers with GOT_IP.
+*/
+void WifiLink::renewLease() {
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+    renewing = true;
+    phaseStart = millis();
+}
+
+bool WifiLink::loadCache() {
+    Preferences prefs;
+    wifiCache blob;
+    haveCache = false;
+
+    if (!prefs.begin(SETTINGS_NAMESPACE, true)) return false;
+    bool ok = prefs.getBytesLength(WIFI_CACHE_KEY) == sizeof(blob) &&
+              prefs.getBytes(WIFI_CACHE_KEY, &blob, sizeof(blob)) == sizeof(blob);
+    prefs.end();
+
+    if (!ok || blob.version != WIFI_CACHE_VERSION) return false;
+    if (blob.crc != SettingsStore::crc32(&blob, offsetof(wifiCache, crc))) return false;
+    if (!blob.channel || !blob.ip) return false;
+
+    cache = blob;
+    haveCache = true;
+    return true;
+}
+
+/*
+    Remember the access point and lease just joined. Written only when they
+    differ from the cache, so a stable network costs no flash wear.
+*/
+void WifiLink::saveCache() {
+    const uint8_t* bssid = WiFi.BSSID();
+    if (!bssid) return;
+
+    wifiCache blob = {};
+    blob.version = WIFI_CACHE_VERSION;
+    memcpy(blob.bssid, bssid, sizeof(blob.bssid));
+    blob.channel = uint8_t(WiFi.channel());
+    blob.ip = WiFi.localIP();
+    blob.gateway = WiFi.gatewayIP();
+    blob.subnet = WiFi.subnetMask();
+    blob.dns = WiFi.dnsIP();
+    blob.crc = SettingsStore::crc32(&blob, offsetof(wifiCache, crc));
+
+    if (haveCache && memcmp(&blob, &cache, sizeof(blob)) == 0) return;
+
+    Preferences prefs;
+    if (!prefs.begin(SETTINGS_NAMESPACE, false)) return;
+    prefs.putBytes(WIFI_CACHE_KEY, &blob, sizeof(blob));
+    prefs.end();
+
+    cache = blob;
+    haveCache = true;
+    counters.cacheWrites++;
+}
@@ -0,0 +1,132 @@
+// WifiLink.h
+#ifndef WIFI_LINK_H
+#define WIFI_LINK_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <WiFi.h>
+#include <atomic>
+
+/*
+    Station bring-up without blocking the caller.
+
+    begin() only starts the association and returns; the WiFi driver reports
+    back through onEvent() and loop(), called from the comms side, moves the
+    link along. Control runs from the first millisecond either way.
+
+    Every join that gets an address stores the access point's BSSID, channel
+    and the lease under its own NVS key. The next begin() (after a reset or a
+    power blip) asks for exactly that radio on exactly that channel with the
+    old address set statically, which skips the channel scan and DHCP: a
+    few hundred ms instead of several seconds. If that does not answer
+    within WIFI_FAST_MS the link falls back to a normal scan + DHCP join and
+    the cache is rewritten from whatever it finds.
+
+    The DHCP server never hears about an address used statically, so once
+    a fast join is up the station switches back to DHCP on the same
+    association: the lease is renewed in the background and the cache
+    follows whatever the server hands out. If no lease comes within
+    WIFI_JOIN_MS the link rejoins with a scan + DHCP join rather than keep
+    an address the server may already have given to someone else.
+
+    NVS rather than RTC memory: RTC slow memory does not survive a real
+    power loss, which is exactly the case worth being fast for.
+
+        FAST_JOIN --timeout--> SCAN_JOIN --timeout, never linked--> HOTSPOT
+            \                     |                                  |
+             +----- GOT_IP ------> LINKED --disconnect--> FAST_JOIN  |
+             ^                                                        |
+             +------------- every WIFI_RETRY_MS, AP stays up --------+
+
+    The hotspot runs as AP+STA: after a site power cut the router often
+    boots slower than the first join, so the station keeps trying in the
+    background and the AP goes away once it links. A link lost later never
+    opens the hotspot, it keeps alternating between the cached and the
+    scanning join until the access point is back.
+*/
+
+#define WIFI_CACHE_KEY "wcache"
+#define WIFI_CACHE_VERSION 1
+#define WIFI_FAST_MS 1500           // cached BSSID + static lease must be up by then
+#define WIFI_JOIN_MS 8000           // scan + DHCP join, then hotspot (at boot only)
+#define WIFI_RETRY_MS 30000         // station retry while the hotspot is up
+#define WIFI_SSID_LEN 33
+#define WIFI_PASS_LEN 65
+
+enum WifiPhase : uint8_t {
+    WIFI_IDLE,
+    WIFI_FAST_JOIN,                 // cached BSSID, channel and address
+    WIFI_SCAN_JOIN,                 // plain begin(), DHCP
+    WIFI_LINKED,
+    WIFI_HOTSPOT                    // soft AP, no station
+};
+
+struct __attribute__((packed)) wifiCache {
+    uint8_t     version;            // WIFI_CACHE_VERSION
+    uint8_t     bssid[6];
+    uint8_t     channel;
+    uint32_t    ip;                 // IPAddress order
+    uint32_t    gateway;
+    uint32_t    subnet;
+    uint32_t    dns;
+    uint32_t    crc;                // CRC-32 of everything above
+};
+
+struct wifiStats {
+    uint32_t    fastJoins;          // linked through the cache
+    uint32_t    scanJoins;          // linked through a scan
+    uint32_t    fastMisses;         // cache did not answer in time
+    uint32_t    drops;              // link lost after it was up
+    uint32_t    cacheWrites;
+    uint32_t    renews;             // DHCP lease renewed after a fast join
+    uint32_t    renewMisses;        // no lease in time, rejoined
+    uint32_t    lastJoinMs;         // begin() / drop -> GOT_IP
+};
+
+class WifiLink {
+public:
+    ~WifiLink() { if (instance == this) instance = nullptr; }
+
+    // hotspot: soft AP name when the station cannot join, empty ssid goes there at once
+    void begin(const char* ssid, const char* pass, const char* hostname, const char* hotspot);
+    void loop();
+
+    WifiPhase phase() const { return state; }
+    bool linked() const { return state == WIFI_LINKED; }
+    const wifiStats& stats() const { return counters; }
+    bool cached() const { return haveCache; }
+
+    // Forget the cached access point, the next join scans
+    void forget();
+
+private:
+    static WifiLink* instance;
+    static void onEvent(arduino_event_id_t event);
+
+    enum : uint8_t { EV_GOT_IP = 0x01, EV_LOST = 0x02 };
+    std::atomic<uint8_t> events{0};
+
+    WifiPhase   state = WIFI_IDLE;
+    bool        everLinked = false;
+    bool        hotspotUp = false;
+    bool        haveCache = false;
+    bool        renewing = false;   // linked on the cached address, DHCP running
+    uint32_t    phaseStart = 0;     // millis() the current join began
+    uint32_t    joinStart = 0;      // millis() the link was last wanted
+    char        ssid[WIFI_SSID_LEN] = {};
+    char        pass[WIFI_PASS_LEN] = {};
+    const char* hotspot = nullptr;
+    wifiCache   cache = {};
+    wifiStats   counters = {};
+
+    void fastJoin();
+    void scanJoin();
+    void openHotspot();
+    void closeHotspot();
+    void linkUp();
+    void renewLease();
+    bool loadCache();
+    void saveCache();
+};
+
+#endif // WIFI_LINK_H
@@ -1,4 +1,6 @@
 #include "Battery.h"
+#include "WifiLink.h"
+#include "LabelView.h"
 #include <Arduino.h>
 #include <EEPROM.h>
 #include <OneWire.h>
@@ -48,10 +50,15 @@
 #define SLOW_BOOT 0
 #define HOSTNAME "Helmi"
 #define FORCE_USE_HOTSPOT 0
-#define LOG_BUFFER 50
+#define LOG_UI_ENTRIES 10        // state changes shown on the Info tab
 
 // This is correct - external code needs the reference
 Battery& batt = Battery::getInstance();
+WifiLink wifiLink;
+bool mdnsStarted = false;
+
+// Periodic labels go through here, unchanged ones are not sent to the browsers
+LabelView labels([](uint16_t id, const char* text) { ESPUI.updateLabel(id, text); });
 
 
 // AsyncTelegram2* bot;
@@ -61,17 +68,11 @@ int tempest;
 int batteryInSeries;
 unsigned int mittausmillit = 0;  // battery voltage and heat reading millis()
 
-VoltageState previousVState;
-TempState previousTState;
-
-String wlanIpAddress;
+uint32_t stateLogShown = 0;       // getStateLogVersion() last rendered
 
 int previousVoltBoostState = 0;
 int previousTempBoostState = 0;
 
-String logEntries;
-String logTime;
-String logBuffet;
 
 //UI handles
 uint16_t tab1, tab2, tab3, tab4, tab5;
@@ -116,7 +117,7 @@ uint16_t wifi_ssid_text, wifi_pass_text, wifiLabelSSID, wifiLabelPass, wifiButto
 
 uint16_t httpPass, httpUser, httpEnable, httpButton;
 
-uint16_t mqttEnable, mqttUser, mqttPass, mqttIp, mqttUsername, mqttPassword, mqttIpaddr, mqttButton;
+uint16_t mqttEnable, mqttFormat, mqttUser, mqttPass, mqttIp, mqttUsername, mqttPassword, mqttIpaddr, mqttButton;
 
 uint16_t tgEnable, tgUser, tgToken, tgLabelUser, tgLabelToken, tgButton;
 
@@ -133,14 +134,15 @@ uint16_t autoSeriesDet, autoSeriesNum;
 
 uint16_t headerTimeLabel, headerTempLabel, headerVoltage, headerPrecent;
 
+uint16_t timingLabels[STAGE_COUNT], timingReset;
+
 String stored_ssid;
 String stored_pass;
 
-Preferences preferences;
-
 //Function Prototypes for ESPUI
-void connectWifi();
 void setUpUI();
+void uiLoop();
+void commsTask(void *param);
 void textCallback(Control *sender, int type);
 void paramCallback(Control* sender, int type, int param);
 void generalCallback(Control *sender, int type);
@@ -151,6 +153,7 @@ void boostVoltCallback(Control *sender, int type);
 
 void httpEnableCallback(Control *sender, int type);
 void mqttEnableCallback(Control *sender, int type);
+void mqttFormatCallback(Control *sender, int type);
 void telegramEnableCallback(Control *sender, int type);
 
 // Battery callbacks for Number input  --> Temperature
@@ -167,8 +170,6 @@ bool checkAndLogTState();
 bool checkAndLogVBoostState();
 bool checkAndLogTBoostState();
 
-String getVoltageStateName(VoltageState state);
-String getTempStateName(TempState state);
 
 String httpUserAcc = "batt";
 String httpPassAcc = "ass";
@@ -182,16 +183,22 @@ void setup() {
 
 	  Serial.begin(115200);
     batt.loadSettings(ALL);
+    batt.startJournal(esp_reset_reason());
     
-   WiFi.setHostname(batt.battery.name.c_str());  // needs to be before setUpUI!!   
-
 	while(!Serial);
 	if(SLOW_BOOT) delay(5000); //Delay booting to give time to connect a serial monitor
-	  connectWifi();
+	  // returns at once, uiLoop() brings the link up while control already runs
+	  wifiLink.begin(FORCE_USE_HOTSPOT ? "" : batt.battery.wlan.ssid.c_str(), batt.battery.wlan.pass.c_str(),
+	                 batt.battery.name.c_str(), HOSTNAME);   // hostname needs to be set before setUpUI!!
 	#if defined(ESP32)
 	  WiFi.setSleep(true); //For the ESP32: turn off sleeping to increase UI responsivness (at the cost of power use)
 	#endif
 	  setUpUI();
+
+	#ifdef RTOS_TASKS
+	  batt.startControlTask();
+	  xTaskCreatePinnedToCore(commsTask, "comms", COMMS_TASK_STACK, nullptr, COMMS_TASK_PRIORITY, nullptr, COMMS_TASK_CORE);
+	#endif
 }   
 void setUpUI() {
   ESPUI.setVerbosity(Verbosity::Quiet);
@@ -201,6 +208,7 @@ void setUpUI() {
     auto tab2 = ESPUI.addControl(Tab, "Setup", "Setup");
     auto wifitab = ESPUI.addControl(Tab, "wifitab", "WiFi");
     auto tgtab = ESPUI.addControl(Tab, "telegram", "Telegram");
+    auto timingtab = ESPUI.addControl(Tab, "timing", "Timing");
 
   /*-
    * Tab: Basic Controls
@@ -532,25 +540,23 @@ saveButton = ESPUI.addControl(Button, "Memory", "Save", None, group1, [](Control
         Serial.println("getControls..");
 
 
-        if(batt.setHostname(ESPUI.getControl(nameLabel)->value)) Serial.println("Hostname set");
-
-        if(batt.setNominalString(ESPUI.getControl(seriesConfigNum)->value.toInt())) Serial.println("Nominal string set");
+        if(batt.queueSetting(SET_NAME, ESPUI.getControl(nameLabel)->value)) Serial.println("Hostname set");
 
-        if(batt.setEcoTemp(ESPUI.getControl(ecoTempNum)->value.toInt())) Serial.println("Eco temp set");
+        if(batt.queueSetting(SET_SIZE, ESPUI.getControl(seriesConfigNum)->value)) Serial.println("Nominal string set");
 
-        if(batt.setEcoPrecentVoltage(ESPUI.getControl(ecoVoltNum)->value.toInt())) Serial.println("Eco precent voltage set");
+        if(batt.queueSetting(SET_ECO_TEMP, ESPUI.getControl(ecoTempNum)->value)) Serial.println("Eco temp set");
 
-        if(batt.setBoostTemp(ESPUI.getControl(boostTemp)->value.toInt())) Serial.println("Boost temp set");
+        if(batt.queueSetting(SET_ECO_VOLT, ESPUI.getControl(ecoVoltNum)->value)) Serial.println("Eco precent voltage set");
 
-        if(batt.setBoostPrecentVoltage(ESPUI.getControl(boostVolts)->value.toInt())) Serial.println("Boost precent voltage set");
+        if(batt.queueSetting(SET_BOOST_TEMP, ESPUI.getControl(boostTemp)->value)) Serial.println("Boost temp set");
 
-        if(batt.setCharger(ESPUI.getControl(text10)->value.toInt())) Serial.println("Charger set");
+        if(batt.queueSetting(SET_BOOST_VOLT, ESPUI.getControl(boostVolts)->value)) Serial.println("Boost precent voltage set");
 
-        if(batt.setResistance(ESPUI.getControl(heaterNum)->value.toInt())) Serial.println("Resistance set");
+        if(batt.queueSetting(SET_CHRGR, ESPUI.getControl(text10)->value)) Serial.println("Charger set");
 
-        if(batt.setCapacity(ESPUI.getControl(text12)->value.toInt())) Serial.println("Capacity set");
+        if(batt.queueSetting(SET_RESISTANCE, ESPUI.getControl(heaterNum)->value)) Serial.println("Resistance set");
 
-        batt.saveSettings(SETUP); 
+        if(batt.queueSetting(SET_CAPCT, ESPUI.getControl(text12)->value)) Serial.println("Capacity set");
 
       }
     }
@@ -651,10 +657,8 @@ auto  wifiLabel    = ESPUI.addControl(Label, "WLAN", "", Peterriver, wifitab, ge
         Serial.println(ESPUI.getControl(wifi_ssid_text)->value);
         Serial.println(ESPUI.getControl(wifi_pass_text)->value);
 
-        preferences.begin("btry", false); // "wifi" is the namespace, false means read/write
-        preferences.putString("wssid", ESPUI.getControl(wifi_ssid_text)->value);
-        preferences.putString("wpass", ESPUI.getControl(wifi_pass_text)->value);
-        preferences.end(); // Close Preferences  
+        batt.queueSetting(SET_WIFI_SSID, ESPUI.getControl(wifi_ssid_text)->value);
+        batt.queueSetting(SET_WIFI_PASS, ESPUI.getControl(wifi_pass_text)->value);
       }
       });
   ESPUI.setElementStyle(wifiButton,"width: 20%; text-align: center; font-size: medium; font-family: serif; margin-top: 20px; margin-bottom: 20px; border-radius: 15px;");
@@ -693,12 +697,9 @@ uint16_t httpButton = ESPUI.addControl(Button, "Memory", "Save", None, httpLabel
         Serial.println(ESPUI.getControl(httpPass)->value); 
         Serial.println(ESPUI.getControl(httpEnable)->value);
 
-        // Open Preferences with a namespace
-        preferences.begin("btry", false); // "wifi" is the namespace, false means read/write
-        preferences.putString("httpusr", ESPUI.getControl(httpUser)->value);
-        preferences.putString("httppass", ESPUI.getControl(httpPass)->value);
-        preferences.putBool("httpen", ESPUI.getControl(httpEnable)->value);
-        preferences.end(); // Close Preferences  
+        batt.queueSetting(SET_HTTP_USER, ESPUI.getControl(httpUser)->value);
+        batt.queueSetting(SET_HTTP_PASS, ESPUI.getControl(httpPass)->value);
+        batt.queueSetting(SET_HTTP_EN,   ESPUI.getControl(httpEnable)->value);
         } });
 
         ESPUI.setElementStyle(httpButton, "width: 20%; text-align: center; font-size: medium; font-family: serif; margin-top: 20px; margin-bottom: 20px; border-radius: 15px;");
@@ -714,6 +715,12 @@ uint16_t httpButton = ESPUI.addControl(Button, "Memory", "Save", None, httpLabel
                         ESPUI.setElementStyle(mqttEnable, "text-align: center; font-size: medium; font-family: serif; margin-top: 5px; margin-bottom: 5px;");
                           ESPUI.setElementStyle(ESPUI.addControl(Label, "emptyLine", "", None, mqttLabel), clearLabelStyle);
 
+// MQTT FORMAT: one JSON on battery/<name>/state instead of a topic per value
+                          ESPUI.setElementStyle(ESPUI.addControl(Label, "json", "Single JSON message", None, mqttLabel), "background-color: unset; width: 100%; text-align: center; font-size: small;");
+        mqttFormat   = ESPUI.addControl(Switcher, "JSON", "", None, mqttLabel, mqttFormatCallback);
+                        ESPUI.setElementStyle(mqttFormat, "text-align: center; font-size: medium; font-family: serif; margin-top: 5px; margin-bottom: 5px;");
+                          ESPUI.setElementStyle(ESPUI.addControl(Label, "emptyLine", "", None, mqttLabel), clearLabelStyle);
+
 // MQTT USERNAME
        mqttUsername = ESPUI.addControl(Label, "Username", "Username", Dark, mqttLabel);      
                         ESPUI.setElementStyle(mqttUsername, "background-color: unset; width: 25%; text-align: left; font-size: small;");
@@ -747,13 +754,9 @@ uint16_t httpButton = ESPUI.addControl(Button, "Memory", "Save", None, httpLabel
         Serial.println(ESPUI.getControl(mqttPass)->value);
         Serial.println(ESPUI.getControl(mqttIp)->value);
 
-                // Open Preferences with a namespace
-        preferences.begin("btry", false); // "btry" is the namespace, false means read/write
-        preferences.putString("mqttusr",  ESPUI.getControl(mqttUser)->value);
-        preferences.putString("mqttpass", ESPUI.getControl(mqttPass)->value);
-        preferences.putString("mqttip",   ESPUI.getControl(mqttIp)->value);
-        preferences.putBool("mqtten",   batt.battery.mqtt.enable);
-        preferences.end(); // Close Preferences  
+        batt.queueSetting(SET_MQTT_USER,   ESPUI.getControl(mqttUser)->value);
+        batt.queueSetting(SET_MQTT_PASS,   ESPUI.getControl(mqttPass)->value);
+        batt.queueSetting(SET_MQTT_SERVER, ESPUI.getControl(mqttIp)->value);
 
         } });
         ESPUI.setElementStyle(mqttButton, "width: 20%; text-align: center; font-size: medium; font-family: serif; margin-top: 20px; margin-bottom: 20px; border-radius: 15px;");
@@ -789,11 +792,8 @@ uint16_t tgButton = ESPUI.addControl(Button, "Memory", "Save", None, tgLabel, []
         Serial.println(ESPUI.getControl(tgUser)->value);  
         Serial.println(ESPUI.getControl(tgToken)->value); 
 
-        preferences.begin("btry", false); // "wifi" is the namespace, false means read/write
-        preferences.putString("tgusr",    ESPUI.getControl(tgUser)->value);
-        preferences.putString("tgtoken",  ESPUI.getControl(tgToken)->value);
-        preferences.putBool("tgen",       batt.battery.telegram.enable);
-        preferences.end(); // Close Preferences  
+        batt.queueSetting(SET_TG_CHAT,  ESPUI.getControl(tgUser)->value);
+        batt.queueSetting(SET_TG_TOKEN, ESPUI.getControl(tgToken)->value);
 
     } });
   ESPUI.setElementStyle(tgButton,"width: 20%; text-align: center; font-size: medium; font-family: serif; margin-top: 20px; margin-bottom: 20px; border-radius: 15px;");
@@ -807,10 +807,28 @@ auto  resetLabel    = ESPUI.addControl(Label, "Back toFactory Settings", "Reset
 resetButton         = ESPUI.addControl(Button, "Memory", "Reset", None, resetLabel, [](Control *sender, int type) {
                      if (type == B_UP) {
                        Serial.println("Resetting settings...");
-                       batt.resetSettings(true);
+                       batt.queueReset();
                      } });
                    ESPUI.setElementStyle(resetButton,"width: 20%; text-align: center; font-size: medium; font-family: serif; margin-top: 20px; margin-bottom: 20px; border-radius: 15px;");
   
+/*
+      Loop timing per stage, see LoopStats.h
+*/
+auto  timingLabel   = ESPUI.addControl(Label, "Loop Timing", "Loop Timing", Peterriver, timingtab);
+                      ESPUI.setElementStyle(timingLabel, "font-family: serif; background-color: unset; width: 100%; ");
+
+  for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+                      ESPUI.setElementStyle(ESPUI.addControl(Label, "", LoopStats::name(LoopStage(i)), None, timingLabel), "background-color: unset; width: 25%; text-align: left; font-size: small; ");
+    timingLabels[i] = ESPUI.addControl(Label, "", "-", None, timingLabel);
+                      ESPUI.setElementStyle(timingLabels[i], "background-color: unset; width: 75%; font-size: small; ");
+  }
+
+timingReset         = ESPUI.addControl(Button, "Timing", "Reset", None, timingLabel, [](Control *sender, int type) {
+                     if (type == B_UP) {
+                       LoopStats::reset();
+                     } });
+                   ESPUI.setElementStyle(timingReset,"width: 20%; text-align: center; font-size: medium; font-family: serif; margin-top: 20px; margin-bottom: 20px; border-radius: 15px;");
+
   /*
 
     Tab: WiFi Credentials
@@ -837,6 +855,7 @@ resetButton         = ESPUI.addControl(Button, "Memory", "Reset", None, resetLab
     ESPUI.updateSwitcher(voltSwitcher, batt.getActivateVoltageBoost());
     ESPUI.updateSwitcher(tempSwitcher, batt.getActivateTemperatureBoost());
     ESPUI.updateSwitcher(mqttEnable, batt.getMqttState());
+    ESPUI.updateSwitcher(mqttFormat, batt.getMqttFormat() & MQTT_STATE);
     ESPUI.updateSwitcher(tgEnable, batt.getTelegramEn());
     ESPUI.updateSwitcher(httpEnable, batt.getHttpEn());
 
@@ -877,16 +896,16 @@ void ecoVoltCallback(Control* sender, int type) {
    switch (type)
     {
     case S_ACTIVE:
-			if(batt.setEcoPrecentVoltage(sender->value.toInt()))
+			if(batt.queueSetting(SET_ECO_VOLT, sender->value))
         {
-          ESPUI.updateLabel(ecoVoltLabel, String(batt.btryToVoltage(sender->value.toInt()), 1));
+          labels.invalidate(ecoVoltLabel);                 // uiLoop() pushes the new value
 			   	Serial.print("Ecomode Voltage set to: ");
           Serial.print(batt.getEcoPrecentVoltage());
           Serial.println(" Precent");
         }
       else
       {
-          ESPUI.updateLabel(ecoVoltLabel, String(batt.getEcoPrecentVoltage(), 1));
+          labels.invalidate(ecoVoltLabel);
 			   	Serial.print("Ecomode Voltage set to: ");
           Serial.print(batt.getEcoPrecentVoltage());
           Serial.println(" Precent");
@@ -964,10 +983,10 @@ void selectBattery(Control* sender, int type) {
 void mqttEnabelCallBack(Control *sender, int type) {
         switch (type) {
     case S_ACTIVE:
-          batt.battery.mqtt.enable = true;
+          batt.queueSetting(SET_MQTT_EN, "1");
         break;
 	case S_INACTIVE:
-          batt.battery.mqtt.enable = false;
+          batt.queueSetting(SET_MQTT_EN, "0");
 		break;
   default:
       Serial.print(type);
@@ -981,16 +1000,10 @@ void mqttEnabelCallBack(Control *sender, int type) {
 void httpEnableCallback(Control *sender, int type) {
   switch (type) {
     case S_ACTIVE:
-          batt.battery.http.enable = true;
-            preferences.begin("btry", false);
-            preferences.putBool("httpen", true);
-            preferences.end();
+          batt.queueSetting(SET_HTTP_EN, "1");
         break;
 	case S_INACTIVE:
-          batt.battery.http.enable = false;
-            preferences.begin("btry", false);
-            preferences.putBool("httpen", false);
-            preferences.end();
+          batt.queueSetting(SET_HTTP_EN, "0");
 		break;
   default:
       Serial.print(type);
@@ -999,19 +1012,28 @@ void httpEnableCallback(Control *sender, int type) {
     }
 }
 
+void mqttFormatCallback(Control *sender, int type) {
+  switch (type) {
+    case S_ACTIVE:
+          batt.queueSetting(SET_MQTT_FORMAT, String(MQTT_STATE));
+        break;
+	case S_INACTIVE:
+          batt.queueSetting(SET_MQTT_FORMAT, String(MQTT_FIELDS));
+		break;
+  default:
+      Serial.print(type);
+      Serial.println("unknown type: MQTT format CB");
+      break;
+    }
+}
+
 void mqttEnableCallback(Control *sender, int type) {
   switch (type) {
     case S_ACTIVE:
-          batt.battery.mqtt.enable = true;
-            preferences.begin("btry", false);
-            preferences.putBool("mqtten", true);
-            preferences.end();
+          batt.queueSetting(SET_MQTT_EN, "1");
         break;
 	case S_INACTIVE:
-          batt.battery.mqtt.enable = false;
-            preferences.begin("btry", false);
-            preferences.putBool("mqtten", false);
-            preferences.end();
+          batt.queueSetting(SET_MQTT_EN, "0");
 		break;
   default:
       Serial.print(type);
@@ -1023,18 +1045,12 @@ void mqttEnableCallback(Control *sender, int type) {
 void telegramEnableCallback(Control *sender, int type) {
   switch (type) {
     case S_ACTIVE:
-          batt.battery.telegram.enable = true;
-            preferences.begin("btry", false);
-            preferences.putBool("tgen", true);
-            preferences.end();
+          batt.queueSetting(SET_TG_EN, "1");
 
             //telegramSetup();
         break;
 	case S_INACTIVE:
-          batt.battery.telegram.enable = false;
-            preferences.begin("btry", false);
-            preferences.putBool("tgen", false);
-            preferences.end();
+          batt.queueSetting(SET_TG_EN, "0");
 		break;
   default:
       Serial.print(type);
@@ -1049,21 +1065,21 @@ void telegramEnableCallback(Control *sender, int type) {
 void boostVoltCallback(Control* sender, int type) {
   switch (type) {
     case S_ACTIVE:
-			if(batt.setBoostPrecentVoltage(sender->value.toInt()))
+			if(batt.queueSetting(SET_BOOST_VOLT, sender->value))
         {
           int bootVoltLabel = sender->value.toInt();
           Serial.print("Boost Voltage set to: ");
           Serial.print(bootVoltLabel);
           Serial.print("  ");
           Serial.print(batt.btryToVoltage(sender->value.toInt()));
-          ESPUI.updateLabel(boostVoltLabel, String(batt.btryToVoltage(sender->value.toInt()), 1));
+          labels.invalidate(boostVoltLabel);               // uiLoop() pushes the new value
 			   	Serial.print("Boost VoltagePRecent set to: ");
           Serial.print(batt.getBoostPrecentVoltage());
           Serial.println(" V");
         }
       else 
       {
-          ESPUI.updateLabel(boostVoltLabel, String(batt.getBoostPrecentVoltage(), 2));
+          labels.invalidate(boostVoltLabel);
          	Serial.print("Boost VoltagePrecent set to: ");
           Serial.print(batt.getBoostPrecentVoltage());
           Serial.println(" V");
@@ -1085,7 +1101,7 @@ void boostVoltCallback(Control* sender, int type) {
 void ecoTempCallback(Control *sender, int type) {
   switch (type) {
     case S_ACTIVE:
-			if(batt.setEcoTemp(sender->value.toInt()))
+			if(batt.queueSetting(SET_ECO_TEMP, sender->value))
         {
 			   	Serial.print("Ecomode Temp set to: ");
           Serial.print(batt.getEcoTemp());
@@ -1115,7 +1131,7 @@ void ecoTempCallback(Control *sender, int type) {
 void boostTempCallback(Control *sender, int type) {
   switch (type) {
     case S_ACTIVE:
-			if(batt.setBoostTemp(sender->value.toInt()))
+			if(batt.queueSetting(SET_BOOST_TEMP, sender->value))
         {
 			   	Serial.print("Boost Temp set to: ");
           Serial.print(batt.getBoostTemp());
@@ -1144,13 +1160,13 @@ void boostTempCallback(Control *sender, int type) {
 void boostVoltageSwitcherCallback(Control *sender, int type) {
     switch (type)  {
     case S_ACTIVE:
-			if(batt.activateVoltageBoost(true))
+			if(batt.queueSetting(SET_VOLT_BOOST, "1"))
 			  Serial.print("Voltage Boost Activated: ");
         Serial.println(batt.getActivateVoltageBoost());
         // ESPUI.updateSwitcher(voltSwitcher, "1");
 		break;
 	case S_INACTIVE:
-      if(batt.activateVoltageBoost(false))
+      if(batt.queueSetting(SET_VOLT_BOOST, "0"))
 		    Serial.println("Voltage Boost Inactive: ");
         Serial.println(batt.getActivateVoltageBoost());
         // ESPUI.updateSwitcher(voltSwitcher, "0");
@@ -1168,7 +1184,7 @@ void boostVoltageSwitcherCallback(Control *sender, int type) {
 void  boostTempSwitcherCallback(Control *sender, int type) {
     switch (type)    {
     case S_ACTIVE: 
-	    if(batt.activateTemperatureBoost(true)) {
+	    if(batt.queueSetting(SET_TEMP_BOOST, "1")) {
         Serial.print("Temperature Boost Active: ");
         Serial.println(batt.getActivateTemperatureBoost());
         // ESPUI.updateSwitcher(tempSwitcher, "1");
@@ -1176,7 +1192,7 @@ void  boostTempSwitcherCallback(Control *sender, int type) {
         break;
 
     case S_INACTIVE:
-        if(batt.activateTemperatureBoost(false)) {
+        if(batt.queueSetting(SET_TEMP_BOOST, "0")) {
         	Serial.print("Temperature Boost Inactive: ");
           Serial.println(batt.getActivateTemperatureBoost());
           // ESPUI.updateSwitcher(tempSwitcher, "0");
@@ -1197,88 +1213,105 @@ unsigned long mqttmillis = 0;
 
 
 void loop() {
-
+  #ifdef RTOS_TASKS
+  vTaskDelete(NULL);    // control and comms have their own tasks, see setup()
+  #else
   batt.loop(); // Add battery.loop() here
+  uiLoop();
+  #endif
+}
+
+/*
+    Comms task on COMMS_TASK_CORE: MQTT, serial console and the web UI.
+    Reads battery data through the telemetry snapshot only.
+*/
+void commsTask(void *param) {
+  for (;;) {
+    batt.commsLoop();
+    uiLoop();
+    vTaskDelay(pdMS_TO_TICKS(COMMS_TASK_PERIOD_MS));
+  }
+}
+
+void uiLoop() {
+  LOOP_TIMER(STAGE_LOOP);
+
+  wifiLink.loop();
+  if (wifiLink.linked() && !mdnsStarted) {
+      mdnsStarted = true;
+      Serial.println(WiFi.localIP());
+      if (!MDNS.begin(batt.battery.name.c_str())) {
+          Serial.println("Error setting up MDNS responder!");
+      }
+  }
+
+  // Serial console: 't' prints the loop timing table, 'r' clears it, 'w' the WiFi joins,
+  // 'u' the label pushes, 'j' the newest journal records
+  if (Serial.available()) {
+      switch (Serial.read()) {
+          case 't': LoopStats::print(); break;
+          case 'r': LoopStats::reset(); break;
+          case 'w': {
+              const wifiStats& w = wifiLink.stats();
+              Serial.printf("wifi phase %u  fast %lu  scan %lu  miss %lu  drops %lu  writes %lu  renews %lu/%lu  last %lu ms\n",
+                            wifiLink.phase(), (unsigned long)w.fastJoins, (unsigned long)w.scanJoins,
+                            (unsigned long)w.fastMisses, (unsigned long)w.drops,
+                            (unsigned long)w.cacheWrites, (unsigned long)w.renews,
+                            (unsigned long)w.renewMisses, (unsigned long)w.lastJoinMs);
+              break;
+          }
+          case 'j': batt.printJournal(20); break;
+          case 'u':
+              Serial.printf("labels pushed %lu  unchanged %lu\n",
+                            (unsigned long)labels.stats().pushes, (unsigned long)labels.stats().skips);
+              break;
+      }
+  }
 
   if(millis() - mittausmillit >= 3000)
   {
+      LOOP_TIMER(STAGE_UI);
       mittausmillit = millis();
+      batteryTelemetry t = batt.getTelemetry();
 
-      if(batt.battery.voltBoost) 
-        {
-          ESPUI.updateLabel(chargerTimeFeedback, String(batt.calculateChargeTime(batt.battery.voltageInPrecent, batt.battery.boostVoltPrecent), 2) + " h");
-        }
-      else 
-        {
-          ESPUI.updateLabel(chargerTimeFeedback, String(batt.calculateChargeTime(batt.battery.voltageInPrecent, batt.battery.ecoVoltPrecent), 2) + " h");
-        }
-      
-
-      wlanIpAddress = WiFi.localIP().toString();
+      if(t.chargeEta == SOC_ETA_UNKNOWN) labels.setText(chargerTimeFeedback, "-- h");
+      else labels.set(chargerTimeFeedback, "%.2f h", t.chargeEta / 60.0f);              // fused SoC, eco or boost target
 
-      ESPUI.updateLabel(ipText, wlanIpAddress);                                               // stats -> ipaddr
-     
-      ESPUI.updateLabel(labelId, String(millis() / 60000) + " min");                          // stats -> uptime
+      IPAddress ip = WiFi.localIP();
+      labels.set(ipText, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);                     // stats -> ipaddr
 
-      ESPUI.updateLabel(voltLabel, String(batt.getBatteryDODprecent()) + " %");               // stats -> battery level 
+      labels.set(labelId, "%lu min", (unsigned long)(millis() / 60000));                 // stats -> uptime
 
-      ESPUI.updateLabel(tempLabel, String(batt.getTemperature(), 1) + " ℃");                   // stats -> battery temp 
+      labels.set(voltLabel, "%.1f %%  (%u %% conf.)", t.socEstimate / 100.0f, t.socConfidence);  // stats -> battery level
 
-      ESPUI.updateLabel(boostVoltLabel, String(batt.btryToVoltage(batt.battery.boostVoltPrecent), 0) + " V");
+      labels.set(tempLabel, "%.1f ℃", t.temperature);                                    // stats -> battery temp
 
-      ESPUI.updateLabel(quickPanelVoltage, String(batt.getCurrentVoltage(), 1) + " V");
-      ESPUI.updateLabel(chargerTimespan, String(batt.calculateChargeTime(batt.getEcoPrecentVoltage(), batt.getBoostPrecentVoltage()), 2) + " h");
-      ESPUI.updateLabel(autoSeriesNum, String(batt.getBatteryApprxSize()));
-      ESPUI.updateLabel(heatPow, String((batt.battery.heater.pidOutput / 255) * 100) + " %" + "    " + String(batt.battery.heater.maxPower * (batt.battery.heater.pidOutput / float(255))) + " W");
-      ESPUI.updateLabel(heatOn, String(batt.battery.init ? "Ok" : "Fail"));    //     " + String(float(batt.battery.heater.maxPower) * (float(batt.battery.heater.powerLimit) / float(255)), 1) + " W");
-      ESPUI.updateLabel(calibPass, String(batt.battery.stune.done ? "Ok" : "Fail") + "    ( P:" + String(batt.battery.heater.pidP) + " | I:" + String(batt.battery.heater.pidI) + " | D:" + String(batt.battery.heater.pidD) + ")    " + String(batt.battery.stune.run ? "Running" : ""));
-      ESPUI.updateLabel(ecoVoltLabel, String(batt.btryToVoltage(batt.getEcoPrecentVoltage()), 1) + " V");
-      ESPUI.updateLabel(boostVoltLabel, String(batt.btryToVoltage(batt.getBoostPrecentVoltage()), 1) + " V");
-      ESPUI.updateLabel(initLevel, String(batt.battery.initLevel) + " / 7");
+      labels.set(quickPanelVoltage, "%.1f V", t.milliVoltage / 1000.0f);
+      labels.set(chargerTimespan, "%.2f h", batt.calculateChargeTime(batt.getEcoPrecentVoltage(), batt.getBoostPrecentVoltage()));
+      labels.set(autoSeriesNum, "%u", t.sizeApprx);
+      labels.set(heatPow, "%.2f %%    %.2f W", (t.pidOutput / 255) * 100, batt.battery.heater.maxPower * (t.pidOutput / float(255)));
+      labels.setText(heatOn, t.init ? "Ok" : "Fail");
+      labels.set(calibPass, "%s    ( P:%.2f | I:%.2f | D:%.2f)    %s", t.stuneDone ? "Ok" : "Fail",
+                 batt.battery.heater.pidP, batt.battery.heater.pidI, batt.battery.heater.pidD, t.stuneRun ? "Running" : "");
+      labels.set(ecoVoltLabel, "%.1f V", batt.btryToVoltage(batt.getEcoPrecentVoltage()));
+      labels.set(boostVoltLabel, "%.1f V", batt.btryToVoltage(batt.getBoostPrecentVoltage()));
+      labels.set(initLevel, "%u / 7", t.initLevel);
    
 
-      // Check and log voltage state
-      if (batt.battery.vState != previousVState) {
-          logEntries += String(getVoltageStateName(batt.battery.vState)) + "\n";
-          logTime += String(millis() / 60000) + " min" + "\n";
-          previousVState = batt.battery.vState;
+      // State change log, rendered again only when the control task added to it
+      if (batt.getStateLogVersion() != stateLogShown) {
+          static char logNames[LOG_UI_ENTRIES * 24], logTimes[LOG_UI_ENTRIES * 16];
+          stateLogShown = batt.getStateLogVersion();
+          batt.getStateLog().render(logNames, sizeof(logNames), logTimes, sizeof(logTimes), LOG_UI_ENTRIES);
+          labels.setText(firstLogLabel, logNames);
+          labels.setText(firstLogTime, logTimes);
       }
-      // Check and log temperature state
-      if (batt.battery.tState != previousTState) {
-          logEntries += String(getTempStateName(batt.battery.tState)) + "\n";
-          logTime += String(millis() / 60000) + " min" + "\n";
-          previousTState = batt.battery.tState;
-      }
-
-      ESPUI.updateLabel(firstLogLabel, logEntries);
-      ESPUI.updateLabel(firstLogTime, logTime);
-    }
-}
-
-
-String getVoltageStateName(VoltageState state) {
-    switch (state) {
-        case ALERT: return "ALERT";
-        case WARNING: return "WARNING";
-        case LOVV: return "Low Voltage";
-        case ECO: return "Eco Voltage";
-        case BOOST: return "Boost Voltage";
-        case FULL: return "Full Battery";
-        default: return "UNKNOWN";
-    }
-}
 
-String getTempStateName(TempState state) {
-    switch (state) {
-        case SUBZERO: return "SUBZERO TEMP WARNING";
-        case COLD: return "Cold Temp";
-        case ECO_TEMP: return "Eco Temp";
-        case ECO_READY: return "Eco Temp Ready"; 
-        case BOOST_TEMP: return "Boost Temp";
-        case BOOST_READY: return "Boost Temp Ready";
-        case TEMP_WARNING: return "Temp Warning";
-        case UNKNOWN_TEMP: return "UNKNOWN TEMP ALERT";
-        default: return "COLD";
+      char timing[48];
+      for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+          LoopStats::formatSummary(LoopStage(i), timing, sizeof(timing));
+          labels.setText(timingLabels[i], timing);
+      }
     }
 }
 
@@ -1304,48 +1337,3 @@ void paramCallback(Control* sender, int type, int param)
     Serial.println(param);
 }
 
-
-
-  /*
-    Wifi connection for ESPUI
-  */
-  void connectWifi() {
-  	int connect_timeout;
-  	WiFi.setHostname(batt.battery.name.c_str());
-  	Serial.println("Begin wifi...");
-
-  	//Load credentials from EEPROM 
-  	if(!(FORCE_USE_HOTSPOT)) {
-  		yield();
- 			WiFi.begin(batt.battery.wlan.ssid.c_str(), batt.battery.wlan.pass.c_str());
-  		connect_timeout = 28; //7 seconds
-
-  		while (WiFi.status() != WL_CONNECTED && connect_timeout > 0) {
-  			delay(250);
-  			Serial.print(".");
-  			connect_timeout--;
-  		}
-  	}
-	
-	if (WiFi.status() == WL_CONNECTED) {
-		Serial.println(WiFi.localIP());
-		Serial.println("Wifi started");
-
-		if (!MDNS.begin(batt.battery.name.c_str())) {
-			Serial.println("Error setting up MDNS responder!");
-		}
-	} else {
-		Serial.println("\nCreating access point...");
-		WiFi.mode(WIFI_AP);
-		WiFi.softAPConfig(IPAddress(192, 168, 1, 1), IPAddress(192, 168, 1, 1), IPAddress(255, 255, 255, 0));
-		WiFi.softAP(HOSTNAME);
-
-		connect_timeout = 20;
-		do {
-			delay(250);
-			Serial.print(",");
-			connect_timeout--;
-		} while(connect_timeout);
-	}
-}
-
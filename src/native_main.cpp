@@ -0,0 +1,78 @@
+/*
+    Host runner for env:native.
+
+    Boots the Battery state machine on the simulated HAL with a 13S pack and
+    runs Battery::loop() for a stretch of simulated time, then prints the
+    LoopStats table. Stage times are real host CPU time plus whatever the
+    firmware spent in delay() or other blocking calls on the virtual clock.
+
+        pio run -e native && .pio/build/native/program [seconds]
+*/
+#ifndef PIO_UNIT_TESTING
+
+#include "Battery.h"
+#include <NativeHal.h>
+#include <cstdio>
+
+// 13S at ~4.0 V per cell through the 30.81 divider
+#define SIM_ADC_RAW 2188
+#define SIM_TEMPERATURE 15.0f
+#define SIM_STEP_MS 1
+
+static void factorySettings() {
+    Preferences nvs;
+    nvs.begin("btry", false);
+    nvs.putString("myname", "native");
+    nvs.putUChar("size", 13);
+    nvs.putUChar("capct", 20);
+    nvs.putUChar("chrgr", 2);
+    nvs.putUChar("ecoVolt", 70);
+    nvs.putUChar("boostVolt", 90);
+    nvs.putUChar("ecoTemp", 20);
+    nvs.putUChar("boostTemp", 30);
+    nvs.putUChar("resistance", 40);
+    nvs.putUChar("maxPower", 30);
+    nvs.putFloat("pidP", 1.0f);
+    nvs.putFloat("pidI", 0.01f);
+    nvs.putFloat("pidD", 0.2f);
+    nvs.putBool("tuneOk", true);
+    nvs.putBool("heatOn", true);
+    nvs.end();
+}
+
+int main(int argc, char **argv) {
+    unsigned long seconds = argc > 1 ? strtoul(argv[1], nullptr, 10) : 600;
+
+    sim::advanceMillis(1000);                   // boot, WiFi and UI setup
+    sim::setSerialEcho(false);
+    sim::setAdcRaw(ADC_CHANNEL, SIM_ADC_RAW);
+    sim::setTemperature(SIM_TEMPERATURE);
+    factorySettings();
+
+    Battery& batt = Battery::getInstance();
+    batt.setup();
+    batt.startJournal(1);                       // ESP_RST_POWERON
+    batt.battery.startup.startupSave = true;    // no one to press the save button
+
+    unsigned long end = millis() + seconds * 1000;
+
+    while (millis() < end) {
+        batt.loop();
+        sim::advanceMillis(SIM_STEP_MS);
+    }
+
+    sim::setSerialEcho(true);
+    printf("simulated %lu s\n", seconds);
+    LoopStats::print();
+    sim::setSerialEcho(false);
+    printf("state %u  %lu mV  %u %%  %.1f C  charger %s  heater duty %u\n",
+           batt.battery.initLevel, (unsigned long)batt.battery.milliVoltage, batt.battery.voltageInPrecent,
+           batt.battery.temperature, batt.battery.chrgr.enable ? "on" : "off", (unsigned)sim::hw().ledcDuty[PWM_CHANNEL]);
+    const journalStats& j = batt.getJournalStats();
+    printf("journal %lu records  %lu flushes  boot %u\n",
+           (unsigned long)j.written, (unsigned long)j.flushes, j.boot);
+    fflush(stdout);
+    return 0;
+}
+
+#endif // PIO_UNIT_TESTING
@@ -0,0 +1,1659 @@
+#include <gtest/gtest.h>
+#include <NativeHal.h>
+#include <thread>
+#include <new>
+#include "Battery.h"
+#include "WifiLink.h"
+#include "LabelView.h"
+#include "Journal.h"
+
+/*
+    Host tests for the Battery control logic, env:native only:
+
+        pio test -e native
+*/
+
+// Heap allocations on this process, for the allocation-free paths
+static std::atomic<uint32_t> heapAllocs(0);
+
+void* operator new(size_t size) {
+    heapAllocs++;
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+#pragma GCC diagnostic pop
+
+// 13S at ~4.0 V per cell through the 30.81 divider
+#define RAW_13S_4V0 2188
+
+class BatteryTest : public ::testing::Test {
+protected:
+    Battery& batt = Battery::getInstance();
+
+    void SetUp() override {
+        sim::reset();
+        sim::freezeClock(true);
+        sim::setSerialEcho(false);
+        sim::advanceMillis(60000);
+        batt.initBatteryState();
+        batt.dallasTime = 0;
+        batt.battery.size = 13;
+        batt.battery.startup.startupSave = true;
+        batt.clearCalibration();
+    }
+
+    // Run readVoltage() like the loop does until a window completes
+    bool measureVoltage(uint32_t interval = 0) {
+        uint32_t windows = batt.getAdcStats().windows;
+        for (int ms = 0; ms < 100; ms++) {
+            batt.readVoltage(interval);
+            if (batt.getAdcStats().windows != windows) return true;
+            sim::advanceMillis(1);
+        }
+        return false;
+    }
+};
+
+TEST_F(BatteryTest, ReadVoltageConvertsRawToMilliVolts) {
+    sim::setAdcRaw(ADC_CHANNEL, RAW_13S_4V0);
+
+    ASSERT_TRUE(measureVoltage());
+
+    EXPECT_NEAR(batt.battery.milliVoltage, 13 * 4000, 13 * 30);
+    EXPECT_EQ(batt.battery.sizeApprx, 13);
+    EXPECT_NEAR(batt.battery.voltageInPrecent, 78, 2);     // NMC curve, 4.0 V per cell
+}
+
+TEST_F(BatteryTest, ReadVoltageRespectsInterval) {
+    sim::setAdcRaw(ADC_CHANNEL, RAW_13S_4V0);
+
+    unsigned long start = millis();
+    ASSERT_TRUE(measureVoltage(1000));
+    uint32_t windows = batt.getAdcStats().windows;
+    uint32_t samples = sim::hw().adcSamples;
+
+    sim::advanceMillis(start + 990 - millis());
+    batt.readVoltage(1000);
+    EXPECT_EQ(sim::hw().adcSamples, samples);   // DMA stopped between windows
+    EXPECT_EQ(sim::hw().level[GPIO_NUM_32], LOW);
+    sim::advanceMillis(10);
+    ASSERT_TRUE(measureVoltage(1000));
+    EXPECT_EQ(batt.getAdcStats().windows, windows + 1);
+}
+
+TEST_F(BatteryTest, MeasureGateSettlesWithoutBlocking) {
+    sim::setAdcRaw(ADC_CHANNEL, RAW_13S_4V0);
+    ASSERT_TRUE(batt.setAdcSettle(10));
+    EXPECT_FALSE(batt.setAdcSettle(ADC_SETTLE_MAX_MS + 1));
+
+    unsigned long start = millis();
+    batt.readVoltage(0);                    // charger off: divider on, nothing sampled
+    EXPECT_EQ(millis(), start);
+    EXPECT_EQ(sim::hw().level[GPIO_NUM_32], HIGH);
+    EXPECT_EQ(batt.battery.adc.phase, ADC_SETTLING);
+
+    sim::advanceMillis(9);
+    batt.readVoltage(0);
+    EXPECT_EQ(batt.battery.adc.phase, ADC_SETTLING);
+    sim::advanceMillis(1);
+    batt.readVoltage(0);
+    EXPECT_EQ(batt.battery.adc.phase, ADC_SAMPLING);
+
+    ASSERT_TRUE(measureVoltage());
+    EXPECT_EQ(sim::hw().level[GPIO_NUM_32], LOW);
+    EXPECT_EQ(batt.battery.adc.phase, ADC_IDLE);
+    EXPECT_NEAR(batt.battery.milliVoltage, 13 * 4000, 13 * 30);
+
+    // charger on keeps the divider powered, no settle time
+    batt.battery.chrgr.enable = true;
+    batt.readVoltage(0);
+    EXPECT_EQ(batt.battery.adc.phase, ADC_SAMPLING);
+    batt.battery.chrgr.enable = false;
+    ASSERT_TRUE(batt.setAdcSettle(ADC_SETTLE_MS));
+}
+
+TEST_F(BatteryTest, DmaFailureReleasesTheDivider) {
+    sim::setAdcRaw(ADC_CHANNEL, RAW_13S_4V0);
+    sim::hw().adcDmaFails = true;
+
+    batt.readVoltage(0);
+    sim::advanceMillis(ADC_SETTLE_MS);
+    batt.readVoltage(0);
+    EXPECT_EQ(batt.battery.adc.phase, ADC_SAMPLING);
+    EXPECT_EQ(sim::hw().level[GPIO_NUM_32], HIGH);
+
+    sim::advanceMillis(ADC_SAMPLE_TIMEOUT_MS - 1);
+    batt.readVoltage(0);
+    EXPECT_EQ(batt.battery.adc.phase, ADC_SAMPLING);
+    sim::advanceMillis(1);
+    batt.readVoltage(0);
+    EXPECT_EQ(batt.battery.adc.phase, ADC_IDLE);
+    EXPECT_EQ(sim::hw().level[GPIO_NUM_32], LOW);
+    EXPECT_EQ(batt.battery.adc.timeouts, 1u);
+    EXPECT_EQ(batt.battery.milliVoltage, 1u);           // reported as a reading error
+
+    // the next interval measures again once the DMA is back
+    sim::hw().adcDmaFails = false;
+    ASSERT_TRUE(measureVoltage());
+    EXPECT_NEAR(batt.battery.milliVoltage, 13 * 4000, 13 * 30);
+}
+
+TEST_F(BatteryTest, OversampledVoltageRejectsSpikes) {
+    sim::setAdcRaw(ADC_CHANNEL, RAW_13S_4V0);
+    sim::hw().adcNoise = 6;
+    sim::setAdcSpikes(16, 4095);            // charger switching glitches, 1 in 16
+
+    ASSERT_TRUE(measureVoltage());          // each call only copies what the DMA has
+    const adcSamplerStats& stats = batt.getAdcStats();
+    ASSERT_GE(stats.windows, 1u);
+    EXPECT_EQ(stats.high, 4095);            // the spikes were there
+    EXPECT_NEAR(batt.battery.adc.raw, RAW_13S_4V0 * ADC_OVERSAMPLE, ADC_OVERSAMPLE / 2);
+    EXPECT_NEAR(batt.battery.milliVoltage, 13 * 4000, 13 * 30);
+
+    // the trimmed mean keeps the fraction: half 100, half 101
+    uint16_t samples[ADC_WINDOW];
+    for (int i = 0; i < ADC_WINDOW; i++) samples[i] = 100 + (i & 1);
+    samples[7] = 0;
+    samples[9] = 4095;
+    EXPECT_EQ(AdcSampler::reduce(samples, ADC_WINDOW, ADC_TRIM), 1608u);
+}
+
+TEST_F(BatteryTest, LoopChargesLowPackAndStopsWhenFrozen) {
+    sim::setAdcRaw(ADC_CHANNEL, 1860);      // ~3.4 V per cell
+    sim::setTemperature(15);
+
+    for (int i = 0; i < 10000; i++) {
+        batt.loop();
+        sim::advanceMillis(1);
+    }
+    EXPECT_TRUE(batt.getChargerStatus());
+    EXPECT_EQ(sim::hw().level[CHARGER_PIN], HIGH);
+
+    sim::setTemperature(-5);
+    for (int i = 0; i < 5000; i++) {
+        batt.loop();
+        sim::advanceMillis(1);
+    }
+    EXPECT_FALSE(batt.getChargerStatus());
+    EXPECT_EQ(sim::hw().level[CHARGER_PIN], LOW);
+}
+
+TEST_F(BatteryTest, ReadTemperatureNeverBlocks) {
+    sim::setTemperature(21.5);
+    batt.battery.ds.setup = false;
+
+    unsigned long start = millis();
+    batt.readTemperature();                 // starts the conversion
+    EXPECT_EQ(millis(), start);
+    EXPECT_TRUE(batt.battery.ds.pending);
+
+    sim::advanceMillis(400);
+    batt.readTemperature();                 // 12 bit still converting
+    EXPECT_EQ(millis(), start + 400);
+    EXPECT_TRUE(batt.battery.ds.pending);
+
+    sim::advanceMillis(400);
+    batt.readTemperature();
+    EXPECT_FALSE(batt.battery.ds.pending);
+    EXPECT_FLOAT_EQ(batt.battery.temperature, 21.5);
+}
+
+TEST_F(BatteryTest, LowerTempResolutionConvertsFaster) {
+    sim::setTemperature(21.5);
+    ASSERT_TRUE(batt.setTempResolution(9));
+    EXPECT_FALSE(batt.setTempResolution(13));
+
+    batt.readTemperature();
+    sim::advanceMillis(100);
+    batt.readTemperature();
+    EXPECT_FALSE(batt.battery.ds.pending);
+    EXPECT_FLOAT_EQ(batt.battery.temperature, 21.5);
+}
+
+TEST(FilterTest, RunningSumMedianAndEma) {
+    RunningFilter<uint32_t, 8> f;
+    EXPECT_EQ(f.value(FILTER_MEAN), 0u);
+
+    for (uint32_t v = 1; v <= 20; v++) f.push(v * 10);
+    EXPECT_EQ(f.size(), 8);
+    EXPECT_EQ(f.value(FILTER_MEAN), 165u);          // 130..200
+    EXPECT_EQ(f.value(FILTER_NONE), 200u);
+
+    f.push(5000);                                   // single spike
+    EXPECT_EQ(f.value(FILTER_MEDIAN), 190u);
+    EXPECT_EQ(f.latest(), 5000u);
+
+    RunningFilter<float, 8, double> t;
+    t.push(20.0f);
+    EXPECT_FLOAT_EQ(t.value(FILTER_EMA), 20.0f);    // starts at the first sample
+    t.push(28.0f);
+    EXPECT_FLOAT_EQ(t.value(FILTER_EMA), 21.0f);
+}
+
+TEST_F(BatteryTest, LoopStatsBucketsAndSummary) {
+    LoopStats::reset();
+    EXPECT_EQ(LoopStats::bucket(0), 0);
+    EXPECT_EQ(LoopStats::bucket(1), 0);
+    EXPECT_EQ(LoopStats::bucket(7), 2);
+    EXPECT_EQ(LoopStats::bucket(750000), 19);
+    EXPECT_EQ(LoopStats::bucket(UINT32_MAX), LOOP_HIST_BUCKETS - 1);
+
+    sim::setAdcRaw(ADC_CHANNEL, RAW_13S_4V0);
+    batt.readVoltage(0);                    // charger off: starts the measure gate
+    sim::advanceMillis(ADC_SETTLE_MS);
+    batt.readVoltage(0);                    // starts the DMA window
+    const stageStats& s = LoopStats::get(STAGE_VOLTAGE);
+    EXPECT_EQ(s.count, 2u);
+    EXPECT_LT(s.maxUs, 1000u);              // the gate no longer blocks
+    EXPECT_EQ(s.hist[LoopStats::bucket(s.maxUs)], 2u);
+
+    char json[256];
+    LoopStats::formatJson(STAGE_VOLTAGE, json, sizeof(json));
+    EXPECT_EQ(strncmp(json, "{\"n\":2,", 7), 0);
+}
+
+TEST_F(BatteryTest, TelemetryFollowsControlLoop) {
+    sim::setAdcRaw(ADC_CHANNEL, RAW_13S_4V0);
+    uint32_t before = batt.getTelemetryVersion();
+
+    batt.controlLoop();
+
+    batteryTelemetry t = batt.getTelemetry();
+    EXPECT_EQ(batt.getTelemetryVersion(), before + 1);
+    EXPECT_EQ(t.milliVoltage, batt.battery.milliVoltage);
+    EXPECT_EQ(t.vState, batt.battery.vState);
+}
+
+struct tornCheck { uint32_t word[16]; };
+
+TEST(SnapshotTest, ReaderNeverSeesTornWrite) {
+    Snapshot<tornCheck> snap;
+    std::atomic<bool> stop(false);
+
+    std::thread writer([&] {
+        tornCheck v;
+        for (uint32_t n = 1; !stop; n++) {
+            for (uint32_t& w : v.word) w = n;
+            snap.write(v);
+        }
+    });
+
+    uint32_t last = 0;
+    for (int i = 0; i < 200000; i++) {
+        tornCheck v = snap.read();
+        for (uint32_t w : v.word) ASSERT_EQ(w, v.word[0]);
+        ASSERT_GE(v.word[0], last);
+        last = v.word[0];
+    }
+    stop = true;
+    writer.join();
+}
+
+TEST(MailboxTest, KeepsOrderBetweenTwoTasks) {
+    Mailbox<tornCheck, 8> box;
+    const uint32_t count = 100000;
+
+    std::thread producer([&] {
+        tornCheck v;
+        for (uint32_t n = 1; n <= count; n++) {
+            for (uint32_t& w : v.word) w = n;
+            while (!box.push(v)) std::this_thread::yield();
+        }
+    });
+
+    tornCheck v;
+    for (uint32_t n = 1; n <= count; n++) {
+        while (!box.pop(v)) std::this_thread::yield();
+        for (uint32_t w : v.word) ASSERT_EQ(w, n);
+    }
+    producer.join();
+    EXPECT_TRUE(box.empty());
+}
+
+TEST_F(BatteryTest, PublishBatteryDataDoesNotAllocate) {
+    batt.preferences.begin("btry", false);
+    batt.preferences.putBool("mqtten", true);
+    batt.preferences.end();
+    batt.battery.mqtt.setup = false;
+    batt.battery.mqtt.lastMessageTime = 0;
+
+    for (int i = 0; i < 3 && sim::hw().published.empty(); i++) {
+        sim::advanceMillis(60001);
+        batt.handleMqtt();                  // setup, connect, publish
+    }
+    ASSERT_FALSE(sim::hw().published.empty());
+    EXPECT_EQ(sim::hw().published[0].topic, "battery/Onni/size");
+    EXPECT_EQ(sim::hw().published[0].payload, "13");
+
+    sim::hw().recordPublishes = false;
+    uint32_t published = sim::hw().publishCount;
+    uint32_t allocs = heapAllocs;
+
+    batt.publishBatteryData();
+
+    EXPECT_EQ(heapAllocs - allocs, 0u);
+    EXPECT_EQ(sim::hw().publishCount - published, 26u);
+}
+
+TEST_F(BatteryTest, StateModePublishesOneJsonMessage) {
+    batt.preferences.begin("btry", false);
+    batt.preferences.putBool("mqtten", true);
+    batt.preferences.putUChar("mqttfmt", MQTT_STATE);
+    batt.preferences.end();
+    batt.battery.mqtt.setup = false;
+
+    for (int i = 0; i < 3 && sim::hw().published.empty(); i++) {
+        sim::advanceMillis(60001);
+        batt.handleMqtt();
+    }
+    sim::hw().published.clear();
+
+    batt.publishBatteryData();
+
+    ASSERT_EQ(sim::hw().published.size(), 1u);
+    const sim::Publish& p = sim::hw().published[0];
+    EXPECT_EQ(p.topic, "battery/Onni/state");
+    EXPECT_EQ(p.payload.front(), '{');
+    EXPECT_EQ(p.payload.back(), '}');
+    EXPECT_NE(p.payload.find("\"size\":13"), std::string::npos);
+}
+
+TEST_F(BatteryTest, DeltaPublishesOnlyPastDeadband) {
+    batt.preferences.begin("btry", false);
+    batt.preferences.putBool("mqtten", true);
+    batt.preferences.putUChar("mqttfmt", MQTT_FIELDS);
+    batt.preferences.end();
+    batt.battery.mqtt.setup = false;
+
+    batt.battery.temperature = 20.0f;
+    batt.battery.vState = ECO;
+    batt.publishTelemetry();
+    for (int i = 0; i < 3 && sim::hw().published.empty(); i++) {
+        sim::advanceMillis(60001);
+        batt.handleMqtt();                  // connect, keyframe
+    }
+    sim::hw().published.clear();
+
+    batt.battery.temperature = 20.1f;       // inside 0.2 degC
+    batt.publishTelemetry();
+    batt.handleMqtt();
+    EXPECT_TRUE(sim::hw().published.empty());
+
+    batt.battery.temperature = 20.3f;
+    batt.publishTelemetry();
+    batt.handleMqtt();
+    ASSERT_EQ(sim::hw().published.size(), 1u);
+    EXPECT_EQ(sim::hw().published[0].topic, "battery/Onni/temperature");
+    EXPECT_EQ(sim::hw().published[0].payload, "20.30");
+
+    sim::hw().published.clear();
+    batt.battery.vState = ALERT;            // states go out at once
+    batt.publishTelemetry();
+    batt.handleMqtt();
+    ASSERT_EQ(sim::hw().published.size(), 1u);
+    EXPECT_EQ(sim::hw().published[0].topic, "battery/Onni/vState");
+    EXPECT_EQ(sim::hw().published[0].payload, "0");
+}
+
+TEST_F(BatteryTest, DeltaRetriesFieldsTheBrokerRejected) {
+    batt.preferences.begin("btry", false);
+    batt.preferences.putBool("mqtten", true);
+    batt.preferences.putUChar("mqttfmt", MQTT_FIELDS);
+    batt.preferences.end();
+    batt.battery.mqtt.setup = false;
+
+    batt.battery.temperature = 20.0f;
+    batt.battery.vState = ECO;
+    batt.publishTelemetry();
+    for (int i = 0; i < 3 && sim::hw().published.empty(); i++) {
+        sim::advanceMillis(60001);
+        batt.handleMqtt();                  // connect, keyframe
+    }
+    sim::hw().published.clear();
+
+    sim::hw().publishRejects = true;
+    batt.battery.temperature = 20.5f;
+    batt.battery.vState = ALERT;
+    batt.publishTelemetry();
+    batt.handleMqtt();
+    EXPECT_TRUE(sim::hw().published.empty());
+
+    // same values on the next telemetry pass, both still go out
+    sim::hw().publishRejects = false;
+    batt.publishTelemetry();
+    batt.handleMqtt();
+    ASSERT_EQ(sim::hw().published.size(), 2u);
+    EXPECT_EQ(sim::hw().published[0].topic, "battery/Onni/temperature");
+    EXPECT_EQ(sim::hw().published[1].topic, "battery/Onni/vState");
+
+    sim::hw().published.clear();
+    batt.publishTelemetry();
+    batt.handleMqtt();
+    EXPECT_TRUE(sim::hw().published.empty());
+}
+
+TEST_F(BatteryTest, MqttReconnectBacksOff) {
+    batt.preferences.begin("btry", false);
+    batt.preferences.putBool("mqtten", true);
+    batt.preferences.end();
+    batt.battery.mqtt.setup = false;
+
+    sim::setBrokerOnline(false);
+    sim::hw().brokerTimeoutMs = 500;
+    uint32_t connects = sim::hw().mqttConnects;
+
+    // 30 s of comms passes against a dead broker
+    for (int i = 0; i < 3000; i++) {
+        uint32_t before = millis();
+        batt.handleMqtt();
+        ASSERT_LE(millis() - before, 500u);     // never more than one connect per pass
+        sim::advanceMillis(10);
+    }
+    uint32_t tries = sim::hw().mqttConnects - connects;
+    EXPECT_GE(tries, 4u);                       // 1 + 2 + 4 + 8 + 16 s windows, jittered
+    EXPECT_LE(tries, 8u);
+    EXPECT_EQ(batt.battery.link.failures, batt.battery.link.attempts);
+    EXPECT_EQ(batt.battery.link.connectMs, tries * 500);
+
+    sim::setBrokerOnline(true);
+    for (int i = 0; i < 13000 && batt.battery.link.state != LINK_UP; i++) {
+        batt.handleMqtt();
+        sim::advanceMillis(10);
+    }
+    EXPECT_EQ(batt.battery.link.state, LINK_UP);
+    EXPECT_EQ(batt.battery.link.backoffMs, 0u);
+    EXPECT_FALSE(sim::hw().published.empty());  // keyframe right after connecting
+}
+
+TEST_F(BatteryTest, MqttFirstConnectAfterLongUptime) {
+    batt.preferences.begin("btry", false);
+    batt.preferences.putBool("mqtten", true);
+    batt.preferences.end();
+    batt.battery.mqtt.setup = false;
+    sim::setBrokerOnline(false);                // drop the session an earlier test left open
+    batt.handleMqtt();
+    sim::setBrokerOnline(true);
+    batt.battery.link.state = LINK_DOWN;        // as after boot, nextAttempt still 0
+    batt.battery.link.nextAttempt = 0;
+    batt.battery.link.attempts = 0;
+
+    sim::advanceMillis(0x80000000u);            // MQTT enabled after ~25 days
+    batt.handleMqtt();
+    EXPECT_EQ(batt.battery.link.state, LINK_UP);
+    EXPECT_EQ(batt.battery.link.attempts, 1u);
+}
+
+TEST_F(BatteryTest, MqttFollowsWifiBackQuickly) {
+    batt.preferences.begin("btry", false);
+    batt.preferences.putBool("mqtten", true);
+    batt.preferences.end();
+    batt.battery.mqtt.setup = false;
+
+    // five minutes without WiFi must not build up the broker backoff
+    sim::setWifiConnected(false);
+    for (int i = 0; i < 3000; i++) {
+        batt.handleMqtt();
+        sim::advanceMillis(100);
+    }
+    EXPECT_EQ(batt.battery.link.attempts, 0u);
+    EXPECT_GT(batt.battery.link.wifiRetries, 100u);
+
+    sim::setWifiConnected(true);
+    uint32_t back = millis();
+    while (batt.battery.link.state != LINK_UP && millis() - back < 60000) {
+        batt.handleMqtt();
+        sim::advanceMillis(10);
+    }
+    EXPECT_EQ(batt.battery.link.state, LINK_UP);
+    EXPECT_LE(millis() - back, uint32_t(MQTT_BACKOFF_MIN_MS) + 10);
+}
+
+TEST_F(BatteryTest, MqttSetCommandsUseTheSetters) {
+    batt.preferences.begin("btry", false);
+    batt.preferences.putBool("mqtten", true);
+    batt.preferences.end();
+    batt.battery.mqtt.setup = false;
+
+    for (int i = 0; i < 3 && batt.battery.link.state != LINK_UP; i++) {
+        sim::advanceMillis(60001);
+        batt.handleMqtt();
+    }
+    ASSERT_EQ(batt.battery.link.state, LINK_UP);
+
+    uint32_t allocs = heapAllocs;
+    EXPECT_TRUE(sim::mqttDeliver("battery/Onni/set/ecoTemp", "25"));
+    EXPECT_TRUE(sim::mqttDeliver("battery/Onni/set/boostVoltPrecent", "90"));
+    EXPECT_TRUE(sim::mqttDeliver("battery/Onni/set/boostTemp", "99"));     // out of range
+    EXPECT_TRUE(sim::mqttDeliver("battery/Onni/set/nope", "1"));
+    EXPECT_EQ(heapAllocs - allocs, 0u);
+
+    batt.handleMqtt();
+    EXPECT_NE(batt.getEcoTemp(), 25);           // queued for the control task
+    EXPECT_EQ(batt.battery.link.commands, 3u);
+    EXPECT_EQ(batt.battery.link.rejected, 1u);
+
+    batt.controlLoop();
+    sim::hw().published.clear();
+    batt.handleMqtt();
+
+    EXPECT_EQ(batt.getEcoTemp(), 25);
+    EXPECT_EQ(batt.getBoostPrecentVoltage(), 90);
+    EXPECT_EQ(batt.getBoostTemp(), 40);
+    EXPECT_EQ(batt.battery.link.commands, 2u);
+    EXPECT_EQ(batt.battery.link.rejected, 2u);
+
+    EXPECT_FALSE(sim::hw().published.empty());  // keyframe with the new values
+
+    sim::advanceMillis(SETTINGS_DEBOUNCE_MS);
+    EXPECT_TRUE(batt.commitSettings());
+    settingsBlob blob;
+    batt.preferences.begin("btry", true);
+    EXPECT_EQ(SettingsStore().readBlob(batt.preferences, blob), BLOB_OK);
+    batt.preferences.end();
+    EXPECT_EQ(blob.ecoTemp, 25);
+}
+
+TEST_F(BatteryTest, SettingsCommitOnlyChangedKeysAfterDebounce) {
+    batt.saveSettings(ALL);
+    sim::advanceMillis(SETTINGS_DEBOUNCE_MS);
+    ASSERT_TRUE(batt.commitSettings());         // baseline: every key stored once
+
+    settingsStats before = batt.getSettingsStats();
+    uint32_t flash = sim::hw().nvsWrites;
+
+    // a burst of UI edits, the same key several times
+    for (int t = 20; t < 26; t++) {
+        batt.setEcoTemp(t);
+        batt.saveSettings(SETUP);
+        sim::advanceMillis(SETTINGS_DEBOUNCE_MS / 4);
+        EXPECT_FALSE(batt.commitSettings());    // still inside the debounce window
+    }
+    batt.activateVoltageBoost(!batt.getActivateVoltageBoost());
+    EXPECT_EQ(sim::hw().nvsWrites, flash);
+
+    sim::advanceMillis(SETTINGS_DEBOUNCE_MS);
+    EXPECT_TRUE(batt.commitSettings());
+
+    const settingsStats& after = batt.getSettingsStats();
+    EXPECT_EQ(after.commits - before.commits, 1u);
+    EXPECT_EQ(after.writes - before.writes, 1u);        // ecoTemp and vboost share the blob
+    EXPECT_EQ(sim::hw().nvsWrites - flash, 1u);
+    EXPECT_FALSE(batt.commitSettings());                // nothing left
+}
+
+TEST_F(BatteryTest, SettingsCommitKeepsTheSaveLimits) {
+    batt.battery.size = 30;
+    batt.battery.ecoVoltPrecent = 120;
+    batt.battery.heater.boostTemp = 60;
+    batt.battery.heater.powerLimit = 0;
+    batt.markSettingDirty(SET_BOOST_TEMP);
+    ASSERT_TRUE(batt.commitSettings(true));
+
+    settingsBlob blob;
+    batt.preferences.begin("btry", true);
+    ASSERT_EQ(SettingsStore().readBlob(batt.preferences, blob), BLOB_OK);
+    batt.preferences.end();
+    EXPECT_EQ(blob.size, 21);
+    EXPECT_EQ(blob.ecoVolt, 100);
+    EXPECT_EQ(blob.boostTemp, 40);
+    EXPECT_EQ(blob.maxPower, 1);
+}
+
+TEST_F(BatteryTest, UiChangesApplyOnTheCommsTask) {
+    batt.commsLoop();                               // MQTT set up from flash already
+    batt.battery.mqtt.username = "old";
+    ASSERT_TRUE(batt.queueSetting(SET_MQTT_USER, "alice"));
+    ASSERT_TRUE(batt.queueSetting(SET_WIFI_PASS, "secret"));
+    ASSERT_TRUE(batt.queueSetting(SET_TG_CHAT, "12345"));
+    ASSERT_TRUE(batt.queueSetting(SET_MQTT_FORMAT, String(MQTT_STATE)));
+    char tooLong[UI_CHANGE_VALUE_LEN + 1];
+    memset(tooLong, 'x', UI_CHANGE_VALUE_LEN);
+    tooLong[UI_CHANGE_VALUE_LEN] = '\0';
+    EXPECT_FALSE(batt.queueSetting(SET_MQTT_PASS, tooLong));
+    EXPECT_EQ(batt.battery.mqtt.username, "old");   // nothing until the comms task runs
+
+    batt.commsLoop();
+    EXPECT_EQ(batt.battery.mqtt.username, "alice");
+    EXPECT_EQ(batt.battery.wlan.pass, "secret");
+    EXPECT_EQ(batt.battery.telegram.chatId, 12345u);
+    EXPECT_EQ(batt.getMqttFormat(), MQTT_STATE);
+
+    ASSERT_TRUE(batt.commitSettings(true));
+    batt.preferences.begin("btry", true);
+    EXPECT_EQ(batt.preferences.getString("mqttusr"), "alice");
+    EXPECT_EQ(batt.preferences.getString("wpass"), "secret");
+    batt.preferences.end();
+
+    // queue holds UI_CHANGE_QUEUE - 1, a reset is applied in order with the rest
+    for (int i = 0; i < UI_CHANGE_QUEUE - 2; i++) ASSERT_TRUE(batt.queueSetting(SET_MQTT_USER, "bob"));
+    ASSERT_TRUE(batt.queueReset());
+    EXPECT_FALSE(batt.queueSetting(SET_MQTT_USER, "carol"));
+    batt.commsLoop();
+    EXPECT_FALSE(batt.commitSettings(true));         // the reset dropped the pending changes
+    batt.preferences.begin("btry", true);
+    EXPECT_EQ(batt.preferences.getString("mqttusr"), "");
+    batt.preferences.end();
+}
+
+TEST_F(BatteryTest, UiControlSettingsReachTheControlStep) {
+    batt.commsLoop();
+    batt.setEcoTemp(15);
+    ASSERT_TRUE(batt.queueSetting(SET_ECO_TEMP, "22"));
+    ASSERT_TRUE(batt.queueSetting(SET_BOOST_TEMP, "99"));     // out of range
+    ASSERT_TRUE(batt.queueSetting(SET_VOLT_BOOST, "1"));
+    ASSERT_TRUE(batt.queueSetting(SET_CAPCT, "ten"));         // not a number
+
+    batt.commsLoop();
+    EXPECT_EQ(batt.getEcoTemp(), 15);               // the comms task never sets it
+
+    batt.controlLoop();
+    EXPECT_EQ(batt.getEcoTemp(), 22);
+    EXPECT_EQ(batt.getBoostTemp(), 40);
+    EXPECT_TRUE(batt.getActivateVoltageBoost());
+
+    ASSERT_TRUE(batt.commitSettings(true));
+    settingsBlob blob;
+    batt.preferences.begin("btry", true);
+    EXPECT_EQ(SettingsStore().readBlob(batt.preferences, blob), BLOB_OK);
+    batt.preferences.end();
+    EXPECT_EQ(blob.ecoTemp, 22);
+    EXPECT_TRUE(blob.voltBoost);
+}
+
+TEST_F(BatteryTest, UiBrokerChangeReconnects) {
+    batt.preferences.begin("btry", false);
+    batt.preferences.putBool("mqtten", true);
+    batt.preferences.putString("mqttip", "10.0.0.1");
+    batt.preferences.end();
+    batt.battery.mqtt.setup = false;
+    sim::setBrokerOnline(false);                    // drop a session left by an earlier test
+    batt.handleMqtt();
+    sim::setBrokerOnline(true);
+
+    for (int i = 0; i < 3 && batt.battery.link.state != LINK_UP; i++) {
+        sim::advanceMillis(60001);
+        batt.handleMqtt();
+    }
+    ASSERT_EQ(batt.battery.link.state, LINK_UP);
+    EXPECT_EQ(sim::hw().brokerHost, "10.0.0.1");
+    uint32_t drops = batt.battery.link.drops;
+
+    ASSERT_TRUE(batt.queueSetting(SET_MQTT_SERVER, "10.0.0.9"));
+    batt.commsLoop();
+    EXPECT_EQ(batt.battery.link.state, LINK_UP);
+    EXPECT_EQ(sim::hw().brokerHost, "10.0.0.9");
+    EXPECT_EQ(batt.battery.link.drops, drops);
+    EXPECT_EQ(batt.battery.mqtt.server, "10.0.0.9");    // not reloaded from flash
+
+    // the client reads the host through its own buffer, not the String
+    batt.battery.mqtt.server = "a much longer name that moves the String buffer";
+    sim::setBrokerOnline(false);
+    batt.handleMqtt();
+    sim::setBrokerOnline(true);
+    for (int i = 0; i < 3 && batt.battery.link.state != LINK_UP; i++) {
+        sim::advanceMillis(60001);
+        batt.handleMqtt();
+    }
+    ASSERT_EQ(batt.battery.link.state, LINK_UP);
+    EXPECT_EQ(sim::hw().brokerHost, "10.0.0.9");
+    batt.battery.mqtt.server = "10.0.0.9";
+
+    ASSERT_TRUE(batt.commitSettings(true));
+    batt.preferences.begin("btry", true);
+    EXPECT_EQ(batt.preferences.getString("mqttip"), "10.0.0.9");
+    batt.preferences.end();
+}
+
+TEST_F(BatteryTest, SettingsMigrateToBlobAndLoadWithOneRead) {
+    // per-key layout as written by older firmware
+    batt.preferences.begin("btry", false);
+    batt.preferences.putString("myname", "Vanha");
+    batt.preferences.putUChar("ecoTemp", 12);
+    batt.preferences.putFloat("pidP", 3.5f);
+    batt.preferences.putString("mqttip", "10.0.0.2");
+    batt.preferences.end();
+
+    batt.loadSettings(ALL);
+    EXPECT_EQ(batt.battery.name, "Vanha");
+    EXPECT_EQ(batt.getEcoTemp(), 12);
+    EXPECT_FLOAT_EQ(batt.battery.heater.pidP, 3.5f);
+
+    settingsBlob blob;
+    batt.preferences.begin("btry", true);
+    ASSERT_EQ(SettingsStore().readBlob(batt.preferences, blob), BLOB_OK);
+    EXPECT_EQ(batt.preferences.getUChar("ecoTemp"), 12);    // legacy keys stay for a downgrade
+    batt.preferences.end();
+    EXPECT_STREQ(blob.name, "Vanha");
+    EXPECT_EQ(blob.ecoTemp, 12);
+
+    uint32_t reads = sim::hw().nvsReads;
+    batt.loadSettings(ALL);
+    uint32_t packedLoad = sim::hw().nvsReads - reads;
+    EXPECT_EQ(batt.getEcoTemp(), 12);
+    EXPECT_EQ(batt.battery.mqtt.server, "10.0.0.2");
+    EXPECT_LT(packedLoad, (uint32_t)SETTING_COUNT);     // one blob read plus the strings
+}
+
+TEST_F(BatteryTest, SettingsBlobWithBadCrcFallsBackToKeys) {
+    batt.preferences.begin("btry", false);
+    batt.preferences.putUChar("ecoTemp", 14);
+    batt.preferences.end();
+    batt.loadSettings(ALL);                     // migrates
+
+    settingsBlob blob;
+    batt.preferences.begin("btry", false);
+    ASSERT_EQ(SettingsStore().readBlob(batt.preferences, blob), BLOB_OK);
+    blob.ecoTemp = 30;                          // flipped bits, CRC no longer matches
+    batt.preferences.putBytes(SETTINGS_BLOB_KEY, &blob, sizeof(blob));
+    EXPECT_EQ(SettingsStore().readBlob(batt.preferences, blob), BLOB_BAD_CRC);
+    batt.preferences.end();
+
+    batt.loadSettings(ALL);
+    EXPECT_EQ(batt.getEcoTemp(), 14);
+
+    batt.preferences.begin("btry", true);
+    EXPECT_EQ(SettingsStore().readBlob(batt.preferences, blob), BLOB_OK);  // rewritten
+    batt.preferences.end();
+    EXPECT_EQ(blob.ecoTemp, 14);
+}
+
+TEST_F(BatteryTest, SettingsBlobValuesAreRangeChecked) {
+    // a blob with a good CRC but values the per-key load would never accept
+    settingsBlob blob;
+    SettingsStore::pack(batt.battery, blob);
+    blob.size = 40;
+    blob.chrgr = 0;
+    blob.capct = 0;
+    blob.ecoVolt = 10;
+    blob.boostTemp = 99;
+    blob.ecoTemp = 0;
+    blob.maxPower = 0;
+    blob.tempRes = 3;
+    blob.mqttPort = 0;
+    blob.mqttFormat = 0x04;
+    blob.crc = SettingsStore::crc32(&blob, offsetof(settingsBlob, crc));
+
+    batt.preferences.begin("btry", false);
+    batt.preferences.putBytes(SETTINGS_BLOB_KEY, &blob, sizeof(blob));
+    batt.preferences.end();
+
+    batt.loadSettings(ALL);
+    EXPECT_EQ(batt.battery.size, 21);
+    EXPECT_EQ(batt.battery.chrgr.current, 1);
+    EXPECT_EQ(batt.battery.capct, 1);
+    EXPECT_EQ(batt.getEcoPrecentVoltage(), 50);
+    EXPECT_EQ(batt.getBoostTemp(), 40);
+    EXPECT_EQ(batt.getEcoTemp(), 5);
+    EXPECT_EQ(batt.battery.heater.powerLimit, 1);
+    EXPECT_EQ(batt.battery.ds.resolution, 9);
+    EXPECT_EQ(batt.battery.mqtt.port, 1883);
+    EXPECT_EQ(batt.getMqttFormat(), MQTT_FIELDS);       // unknown bits dropped, never 0
+
+    blob.mqttFormat = MQTT_STATE | 0x80;
+    blob.crc = SettingsStore::crc32(&blob, offsetof(settingsBlob, crc));
+    batt.preferences.begin("btry", false);
+    batt.preferences.putBytes(SETTINGS_BLOB_KEY, &blob, sizeof(blob));
+    batt.preferences.end();
+    batt.loadSettings(MQTT);
+    EXPECT_EQ(batt.getMqttFormat(), MQTT_STATE);
+}
+
+TEST_F(BatteryTest, VoltageFilterIsASetting) {
+    EXPECT_EQ(batt.getVoltageFilter(), FILTER_MEAN);
+    EXPECT_FALSE(batt.setVoltageFilter(FILTER_MODES));
+    ASSERT_TRUE(batt.setVoltageFilter(FILTER_MEDIAN));
+    batt.markSettingDirty(SET_VOLT_FILTER);
+    ASSERT_TRUE(batt.commitSettings(true));
+
+    batt.setVoltageFilter(FILTER_NONE);
+    batt.loadSettings(ALL);
+    EXPECT_EQ(batt.getVoltageFilter(), FILTER_MEDIAN);
+}
+
+TEST_F(BatteryTest, SettingsBlobVersion1IsUpgraded) {
+    // a blob as the first blob firmware wrote it: no filter fields
+    batt.battery.heater.ecoTemp = 17;
+    settingsBlob blob;
+    SettingsStore::pack(batt.battery, blob);
+    size_t len = SettingsStore::blobLength(1);
+    blob.version = 1;
+    blob.length = len;
+    uint32_t crc = SettingsStore::crc32(&blob, len - sizeof(crc));
+    memcpy(reinterpret_cast<uint8_t*>(&blob) + len - sizeof(crc), &crc, sizeof(crc));
+
+    batt.preferences.begin("btry", false);
+    batt.preferences.putUChar("ecoTemp", 9);        // stale legacy key must not win
+    batt.preferences.putBytes(SETTINGS_BLOB_KEY, &blob, len);
+    EXPECT_EQ(SettingsStore().readBlob(batt.preferences, blob), BLOB_UPGRADED);
+    batt.preferences.end();
+
+    batt.initBatteryState();
+    batt.battery.adc.filterMode = FILTER_EMA;
+    batt.loadSettings(ALL);
+    EXPECT_EQ(batt.getEcoTemp(), 17);
+    EXPECT_EQ(batt.getVoltageFilter(), FILTER_MEAN);
+    EXPECT_EQ(batt.getTemperatureFilter(), FILTER_NONE);
+
+    batt.preferences.begin("btry", true);
+    EXPECT_EQ(SettingsStore().readBlob(batt.preferences, blob), BLOB_OK);   // rewritten as v2
+    batt.preferences.end();
+    EXPECT_EQ(blob.version, SETTINGS_BLOB_VERSION);
+}
+
+TEST(OcvTest, CurvesAndInverse) {
+    const OcvCurve& nmc = ocvCurve(CHEM_NMC);
+    EXPECT_EQ(nmc.socTenths(2900), 0);
+    EXPECT_EQ(nmc.socTenths(4300), 1000);
+    EXPECT_EQ(nmc.socTenths(3710), 350);            // between 3680 / 30 % and 3740 / 40 %
+
+    // flat LFP plateau: 10 mV is a whole 10 %
+    const OcvCurve& lfp = ocvCurve(CHEM_LFP);
+    EXPECT_EQ(lfp.socTenths(3305), 500);
+    EXPECT_EQ(lfp.socTenths(3315), 600);
+
+    for (uint8_t chem = 0; chem < CHEM_COUNT; chem++) {
+        for (uint16_t tenths = 0; tenths <= 1000; tenths += 50) {
+            EXPECT_NEAR(ocvCurve(chem).socTenths(ocvCurve(chem).milliVolts(tenths)), tenths, 10) << int(chem);
+        }
+    }
+    EXPECT_EQ(&ocvCurve(CHEM_COUNT), &nmc);          // unknown falls back to NMC
+}
+
+TEST_F(BatteryTest, ChemistryPicksTheCurve) {
+    batt.battery.size = 4;
+    EXPECT_FLOAT_EQ(batt.btryToVoltage(50), 15.2f);
+    EXPECT_FLOAT_EQ(batt.btryToVoltage(150), 16.8f);    // clamped to full
+    EXPECT_EQ(batt.getVoltageInPercentage(15200), 50);
+
+    EXPECT_FALSE(batt.setChemistry(CHEM_COUNT));
+    ASSERT_TRUE(batt.setChemistry(CHEM_LFP));
+    EXPECT_FLOAT_EQ(batt.btryToVoltage(50), 13.22f);
+    EXPECT_EQ(batt.getVoltageInPercentage(15200), 100);
+    EXPECT_EQ(batt.determineBatterySeries(13200), 4u);
+    batt.setChemistry(CHEM_NMC);
+}
+
+TEST(CalibrationTest, PiecewiseLinearLookup) {
+    VoltageCalibration cal;
+    EXPECT_FALSE(cal.active());
+
+    ASSERT_TRUE(cal.add(30000, 40000));
+    EXPECT_EQ(cal.toMilliVolts(15000), 20000u);     // one point: gain through zero
+
+    ASSERT_TRUE(cal.add(40000, 54000));
+    ASSERT_TRUE(cal.add(20000, 27000));
+    ASSERT_TRUE(cal.add(30100, 40100));             // within CAL_MIN_SPAN, replaces
+    EXPECT_EQ(cal.size(), 3);
+    EXPECT_EQ(cal.point(1).raw, 30100u);
+
+    EXPECT_EQ(cal.toMilliVolts(20000), 27000u);
+    EXPECT_EQ(cal.toMilliVolts(40000), 54000u);
+    EXPECT_NEAR(cal.toMilliVolts(35050), 47050, 2); // halfway up the second segment
+    EXPECT_NEAR(cal.toMilliVolts(42000), 56808, 2); // extends the last segment
+    EXPECT_NEAR(cal.toMilliVolts(10000), 14030, 2); // and the first one
+
+    // every point has to read above the one below it
+    EXPECT_FALSE(cal.add(35000, 39000));            // below the 30100 point
+    EXPECT_FALSE(cal.add(25000, 40100));            // equal to the point above
+    EXPECT_FALSE(cal.add(30050, 55000));            // replacing, above the next point
+    EXPECT_FALSE(cal.add(50000, 50000));            // past the end, lower than the last
+    EXPECT_EQ(cal.size(), 3);
+    EXPECT_TRUE(cal.add(30050, 41000));             // re-measured within its neighbours
+}
+
+TEST_F(BatteryTest, CalibrationPointCorrectsVoltageAndPersists) {
+    sim::setAdcRaw(ADC_CHANNEL, RAW_13S_4V0);
+    batt.publishTelemetry();
+    EXPECT_FALSE(batt.addCalibrationPoint(52500));  // no reading yet
+    ASSERT_TRUE(measureVoltage());
+    uint32_t uncalibrated = batt.battery.milliVoltage;
+    batt.publishTelemetry();                        // the point takes raw from the snapshot
+
+    // meter says the board reads ~1 % low
+    uint32_t meter = uncalibrated * 101 / 100;
+    uint32_t flash = sim::hw().nvsWrites;
+    ASSERT_TRUE(batt.addCalibrationPoint(meter));
+    EXPECT_EQ(batt.getCalibrationPoints(), 1);
+    EXPECT_EQ(sim::hw().nvsWrites, flash);          // stored by the settings commit
+    ASSERT_TRUE(measureVoltage());
+    EXPECT_NEAR(batt.battery.milliVoltage, meter, 5);
+
+    batt.resetSettings(true);                       // user settings only
+    ASSERT_TRUE(batt.commitSettings(true));
+    batt.loadSettings(ALL);
+    EXPECT_EQ(batt.getCalibrationPoints(), 1);
+    ASSERT_TRUE(measureVoltage());
+    EXPECT_NEAR(batt.battery.milliVoltage, meter, 5);
+
+    batt.clearCalibration();
+    ASSERT_TRUE(batt.commitSettings(true));
+    batt.loadSettings(ALL);
+    EXPECT_EQ(batt.getCalibrationPoints(), 0);
+}
+
+TEST(SocEstimatorTest, CountsChargeAndTrustsVoltageAtRest) {
+    SocEstimator soc;
+    EXPECT_FALSE(soc.ready());
+    EXPECT_EQ(soc.etaMinutes(80, 10, 100), SOC_ETA_UNKNOWN);
+
+    soc.predict(0, false, 0, 100);
+    soc.correct(5000, 1000);                        // first reading sets the estimate
+    EXPECT_EQ(soc.soc(), 5000);
+    uint8_t first = soc.confidence();
+
+    // 10 A into 100 Ah for an hour at 95 %: +9.5 %
+    for (uint32_t now = 1000; now <= 3600000; now += 1000) soc.predict(now, true, 10, 100);
+    EXPECT_EQ(soc.soc(), 5950);
+
+    // voltage says 60 % with 1 % noise, the estimate moves most of the way
+    for (int i = 0; i < 20; i++) soc.correct(6000, 100);
+    EXPECT_NEAR(soc.soc(), 6000, 10);
+    EXPECT_GT(soc.confidence(), first);
+
+    // 20 % of 100 Ah at 10 A * 95 %: ~126 min
+    EXPECT_NEAR(soc.etaMinutes(80, 10, 100), 126, 1);
+    EXPECT_EQ(soc.etaMinutes(50, 10, 100), 0);
+}
+
+TEST_F(BatteryTest, ControlUsesFusedStateOfCharge) {
+    sim::setAdcRaw(ADC_CHANNEL, RAW_13S_4V0);
+    sim::setTemperature(20);
+    batt.battery.chrgr.enable = false;
+
+    for (int i = 0; i < 5000; i++) {
+        batt.loop();
+        sim::advanceMillis(1);
+    }
+    ASSERT_TRUE(batt.battery.soc.ready());
+    EXPECT_NEAR(batt.getStateOfCharge(), batt.battery.voltageInPrecent, 2);
+
+    batteryTelemetry t = batt.getTelemetry();
+    EXPECT_NEAR(t.socEstimate, batt.battery.voltageInPrecent * 100, 200);
+    EXPECT_GT(t.socConfidence, 0);
+
+    // a single noisy window barely moves the fused value
+    batt.battery.soc.correct(0, 50 * 100);
+    EXPECT_GT(batt.getStateOfCharge(), batt.battery.voltageInPrecent - 5);
+}
+
+TEST_F(BatteryTest, VoltageStateHasHysteresis) {
+    batt.battery.ecoVoltPrecent = 70;
+    batt.battery.boostVoltPrecent = 90;
+    batt.battery.vState = ALERT;
+
+    EXPECT_EQ(batt.getVoltageState(60), ECO);           // up: lower edges as before
+    batt.battery.vState = ECO;
+    EXPECT_EQ(batt.getVoltageState(70), BOOST);
+    batt.battery.vState = BOOST;
+    EXPECT_EQ(batt.getVoltageState(68), BOOST);         // within the band below 70
+    EXPECT_EQ(batt.getVoltageState(66), ECO);
+    EXPECT_EQ(batt.getVoltageState(95), BOOST);         // boost .. 99 used to fall through to ALERT
+    EXPECT_EQ(batt.getVoltageState(100), FULL);
+    batt.battery.vState = FULL;
+    EXPECT_EQ(batt.getVoltageState(96), FULL);
+    EXPECT_EQ(batt.getVoltageState(10), ALERT);
+
+    EXPECT_FALSE(batt.setHysteresis(ALERT, 2));
+    EXPECT_FALSE(batt.setHysteresis(ECO, VSTATE_HYST_MAX + 1));
+    ASSERT_TRUE(batt.setHysteresis(BOOST, 0));
+    batt.battery.vState = BOOST;
+    EXPECT_EQ(batt.getVoltageState(69), ECO);
+}
+
+TEST_F(BatteryTest, ChargerKeepsMinimumDwell) {
+    batt.battery.ecoVoltPrecent = 70;
+    batt.battery.temperature = 20;
+    batt.battery.vState = ECO;
+    batt.battery.soc.predict(millis(), false, 0, batt.battery.capct);
+    batt.battery.soc.correct(6900, 100);                // just under the eco target
+
+    batt.battery.stateMachine = millis() - 2500;
+    batt.handleBatteryControl();
+    ASSERT_TRUE(batt.getChargerStatus());
+    EXPECT_EQ(batt.battery.chrgr.toggles, 1u);
+
+    // the estimate wobbles across the edge every control period
+    uint32_t pin = sim::hw().toggles[CHARGER_PIN];
+    for (int i = 0; i < 20; i++) {
+        batt.battery.soc.correct(i & 1 ? 6900 : 7100, 1);
+        sim::advanceMillis(2500);
+        batt.handleBatteryControl();
+    }
+    EXPECT_TRUE(batt.getChargerStatus());               // BOOST, but inside minOn
+    EXPECT_EQ(sim::hw().toggles[CHARGER_PIN], pin);
+    EXPECT_GT(batt.battery.chrgr.held, 0u);
+
+    sim::advanceMillis(CHARGER_MIN_ON_S * 1000UL);
+    batt.battery.soc.correct(7100, 1);
+    batt.handleBatteryControl();
+    EXPECT_FALSE(batt.getChargerStatus());
+    EXPECT_EQ(batt.battery.chrgr.toggles, 2u);
+    batt.publishTelemetry();
+    EXPECT_EQ(batt.getTelemetry().chargerToggles, 2u);
+
+    // too cold switches off at once, dwell or not
+    batt.battery.vState = ECO;
+    batt.battery.chrgr.minOff = 0;
+    batt.chargerRequest(true);
+    ASSERT_TRUE(batt.getChargerStatus());
+    batt.battery.temperature = -5;
+    sim::advanceMillis(2500);
+    batt.handleBatteryControl();
+    EXPECT_FALSE(batt.getChargerStatus());
+}
+
+TEST_F(BatteryTest, HysteresisAndDwellAreSettings) {
+    ASSERT_TRUE(batt.setHysteresis(ECO, 7));
+    ASSERT_TRUE(batt.setChargerMinOn(300));
+    EXPECT_FALSE(batt.setChargerMinOff(CHARGER_DWELL_MAX_S + 1));
+    batt.markSettingDirty(SET_HYST_ECO);
+    batt.markSettingDirty(SET_CHRGR_MIN_ON);
+    ASSERT_TRUE(batt.commitSettings(true));
+
+    batt.initBatteryState();
+    batt.loadSettings(ALL);
+    EXPECT_EQ(batt.getHysteresis(ECO), 7);
+    EXPECT_EQ(batt.getHysteresis(BOOST), vStateHystDefault[BOOST]);
+    EXPECT_EQ(batt.getChargerMinOn(), 300);
+    EXPECT_EQ(batt.getChargerMinOff(), CHARGER_MIN_OFF_S);
+}
+
+TEST(ControlTableTest, EveryStateHasASafeAction) {
+    for (uint8_t v = ALERT; v <= FULL; v++) {
+        for (uint8_t t = SUBZERO; t <= UNKNOWN_TEMP; t++) {
+            const controlAction& a = controlTable.at(VoltageState(v), TempState(t));
+            bool tooCold = t == SUBZERO, tooHot = t == TEMP_WARNING, lost = t == UNKNOWN_TEMP;
+
+            if (tooCold || tooHot || lost) EXPECT_EQ(a.charger, CHG_CUT) << int(v) << "/" << int(t);
+            else if (v == FULL) EXPECT_EQ(a.charger, CHG_OFF);
+            else if (v == BOOST) EXPECT_EQ(a.charger, CHG_BOOST);
+            else EXPECT_EQ(a.charger, CHG_ON);
+
+            EXPECT_LT(a.leds, LED_PATTERNS);
+            EXPECT_EQ(bool(a.flags & CTRL_RED_LED), !(tooCold || tooHot || lost));
+            EXPECT_EQ(bool(a.flags & CTRL_RESTART), lost);
+            EXPECT_EQ(a.heater == HEAT_SAFE, tooHot);
+            EXPECT_EQ(bool(a.flags & CTRL_CLEAR_VBOOST), v == FULL);
+        }
+    }
+}
+
+TEST_F(BatteryTest, ControlStepFollowsTheTable) {
+    batt.battery.ecoVoltPrecent = 70;
+    batt.battery.boostVoltPrecent = 90;
+    batt.battery.heater.ecoTemp = 20;
+    batt.battery.heater.boostTemp = 35;
+    batt.battery.temperature = 25;              // BOOST_TEMP
+    batt.battery.chrgr.minOff = 0;
+    batt.battery.vState = BOOST;
+    batt.battery.soc.predict(millis(), false, 0, batt.battery.capct);
+    batt.battery.soc.correct(8000, 100);
+
+    batt.battery.stateMachine = millis() - 2500;
+    batt.handleBatteryControl();
+    EXPECT_EQ(batt.battery.tState, BOOST_TEMP);
+    EXPECT_FALSE(batt.getChargerStatus());      // eco target reached, no boost
+    EXPECT_EQ(sim::hw().level[RED_LED], HIGH);
+    EXPECT_FLOAT_EQ(batt.battery.heater.pidSetpoint, 20);
+
+    batt.battery.voltBoost = true;
+    batt.battery.tempBoost = true;
+    sim::advanceMillis(2500);
+    batt.handleBatteryControl();
+    EXPECT_TRUE(batt.getChargerStatus());
+    EXPECT_FLOAT_EQ(batt.battery.heater.pidSetpoint, 35);
+
+    batt.battery.temperature = 45;              // TEMP_WARNING, vState kept
+    sim::advanceMillis(2500);
+    batt.handleBatteryControl();
+    EXPECT_EQ(batt.battery.vState, BOOST);
+    EXPECT_FALSE(batt.getChargerStatus());
+    EXPECT_EQ(sim::hw().level[RED_LED], LOW);
+    EXPECT_FLOAT_EQ(batt.battery.heater.pidSetpoint, HEATER_SAFE_SETPOINT);
+}
+
+TEST_F(BatteryTest, CommissioningWindowDoesNotBlock) {
+    sim::setAdcRaw(ADC_CHANNEL, RAW_13S_4V0);
+    batt.battery.startup.startupSave = false;
+    batt.battery.size = 0;                      // nothing in NVS yet
+    batt.battery.timer.startupTimer = millis() + 5000;
+
+    unsigned long start = millis();
+    EXPECT_FALSE(batt.startUpInit());
+    EXPECT_EQ(millis(), start);                 // one step, no spinning
+    for (int ms = 0; ms < 200; ms++) {
+        EXPECT_FALSE(batt.startUpInit());
+        sim::advanceMillis(1);
+    }
+    ASSERT_GT(batt.battery.milliVoltage, 0u);   // readVoltage() runs inside the window
+
+    // hold the save button for 500 ms
+    batt.battery.sizeApprx = 13;
+    sim::setPinInput(GPIO_NUM_0, LOW);
+    bool done = false;
+    for (int ms = 0; ms < 600 && !done; ms++) {
+        done = batt.startUpInit();
+        sim::advanceMillis(1);
+    }
+    sim::setPinInput(GPIO_NUM_0, -1);
+    EXPECT_TRUE(done);
+    EXPECT_EQ(batt.battery.size, 13);
+    EXPECT_LT(millis(), batt.battery.timer.startupTimer);
+}
+
+TEST_F(BatteryTest, MqttRunsDuringCommissioningWindow) {
+    batt.preferences.begin("btry", false);
+    batt.preferences.putBool("mqtten", true);
+    batt.preferences.end();
+    batt.battery.mqtt.setup = false;
+
+    // a lost sensor sends the control loop back to STARTUP
+    batt.battery.temperature = NAN;
+    batt.battery.stateMachine = millis() - 2500;
+    batt.handleBatteryControl();
+    ASSERT_EQ(batt.battery.tState, UNKNOWN_TEMP);
+
+    sim::setBrokerOnline(false);                // drop the session an earlier test left open
+    batt.handleMqtt();
+    sim::setBrokerOnline(true);
+
+    batt.battery.startup.startupSave = false;
+    batt.battery.starUpInit = false;
+    batt.battery.size = 0;
+    batt.battery.timer.startupTimer = millis() + 5000;
+    sim::setPinInput(GPIO_NUM_0, HIGH);         // save button not pressed
+    uint32_t connects = sim::hw().mqttConnects;
+    sim::hw().published.clear();
+
+    for (int ms = 0; ms < 1000; ms++) {
+        batt.loop();
+        sim::advanceMillis(1);
+    }
+    sim::setPinInput(GPIO_NUM_0, -1);
+    EXPECT_FALSE(batt.battery.starUpInit);      // still inside the window
+    EXPECT_GT(sim::hw().mqttConnects, connects);
+    EXPECT_EQ(batt.battery.link.state, LINK_UP);
+    EXPECT_FALSE(sim::hw().published.empty());
+}
+
+TEST_F(BatteryTest, QuickStartSkipsWindowWithStoredSize) {
+    batt.battery.startup.startupSave = false;
+    batt.battery.timer.startupTimer = millis() + 5000;
+    sim::setPinInput(GPIO_NUM_0, HIGH);
+    ASSERT_FALSE(batt.getQuickStart());         // opt-in, the window stays by default
+    EXPECT_FALSE(batt.startUpInit());           // size 13 from SetUp
+    sim::advanceMillis(5000);
+    EXPECT_TRUE(batt.startUpInit());
+
+    batt.initBatteryState();
+    batt.battery.timer.startupTimer = millis() + 5000;
+    batt.setQuickStart(true);
+    batt.battery.size = 13;
+    EXPECT_TRUE(batt.startUpInit());
+    sim::setPinInput(GPIO_NUM_0, -1);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+
+    if (RUN_ALL_TESTS())
+    ;
+
+    // Always return zero-code and allow PlatformIO to parse results
+    return 0;
+}
+
+// Step the WiFi link like the comms task does until it settles
+static bool runWifi(WifiLink& link, uint32_t ms) {
+    for (uint32_t t = 0; t < ms && !link.linked(); t += 10) {
+        sim::advanceMillis(10);
+        link.loop();
+    }
+    return link.linked();
+}
+
+TEST(WifiLinkTest, CachedAccessPointRejoinsFast) {
+    sim::reset();
+    sim::freezeClock(true);
+    sim::setSerialEcho(false);
+    sim::setWifiConnected(false);
+
+    WifiLink first;
+    uint32_t start = millis();
+    first.begin("home", "secret", "batt", "Helmi");
+    EXPECT_EQ(millis(), start);                         // never waits for the radio
+    EXPECT_EQ(first.phase(), WIFI_SCAN_JOIN);           // nothing cached yet
+
+    ASSERT_TRUE(runWifi(first, 5000));
+    EXPECT_GE(first.stats().lastJoinMs, 3000u);         // scan + DHCP
+    EXPECT_EQ(first.stats().scanJoins, 1u);
+    EXPECT_EQ(first.stats().cacheWrites, 1u);
+
+    // power blip: board and access point restart, only NVS survives
+    sim::setWifiConnected(false);
+    WifiLink after;
+    after.begin("home", "secret", "batt", "Helmi");
+    EXPECT_EQ(after.phase(), WIFI_FAST_JOIN);
+
+    ASSERT_TRUE(runWifi(after, 5000));
+    EXPECT_LT(after.stats().lastJoinMs, 500u);
+    EXPECT_EQ(after.stats().fastJoins, 1u);
+    EXPECT_EQ(after.stats().cacheWrites, 0u);           // same AP, no flash write
+    EXPECT_EQ(WiFi.localIP(), IPAddress(192, 168, 1, 50));
+
+    // a drop later rejoins through the cache as well
+    sim::setWifiConnected(false);
+    after.loop();
+    EXPECT_EQ(after.phase(), WIFI_FAST_JOIN);
+    EXPECT_EQ(after.stats().drops, 1u);
+    ASSERT_TRUE(runWifi(after, 5000));
+    EXPECT_LT(after.stats().lastJoinMs, 500u);
+}
+
+// Step the link for a fixed time, linked or not
+static void stepWifi(WifiLink& link, uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t += 10) {
+        sim::advanceMillis(10);
+        link.loop();
+    }
+}
+
+TEST(WifiLinkTest, FastJoinRenewsTheLease) {
+    sim::reset();
+    sim::freezeClock(true);
+    sim::setSerialEcho(false);
+    sim::setWifiConnected(false);
+
+    WifiLink first;
+    first.begin("home", "secret", "batt", "Helmi");
+    ASSERT_TRUE(runWifi(first, 5000));
+
+    // the router handed .50 to someone else while the board was off
+    sim::setWifiConnected(false);
+    sim::hw().wifiLease[0] = IPAddress(192, 168, 1, 77);
+    WifiLink after;
+    after.begin("home", "secret", "batt", "Helmi");
+    ASSERT_TRUE(runWifi(after, 5000));
+    EXPECT_EQ(after.stats().fastJoins, 1u);
+    EXPECT_EQ(WiFi.localIP(), IPAddress(192, 168, 1, 77));  // back on DHCP right away
+
+    stepWifi(after, sim::hw().wifiDhcpMs + 100);
+    EXPECT_TRUE(after.linked());
+    EXPECT_EQ(after.stats().renews, 1u);
+    EXPECT_EQ(after.stats().cacheWrites, 1u);           // the new lease is cached
+
+    // next boot the DHCP server is down: the cached address is not kept
+    sim::setWifiConnected(false);
+    sim::hw().wifiDhcpDown = true;
+    WifiLink noDhcp;
+    noDhcp.begin("home", "secret", "batt", "Helmi");
+    ASSERT_TRUE(runWifi(noDhcp, 5000));
+    EXPECT_EQ(WiFi.localIP(), IPAddress(192, 168, 1, 77));
+    stepWifi(noDhcp, WIFI_JOIN_MS + 100);
+    EXPECT_EQ(noDhcp.stats().renewMisses, 1u);
+    EXPECT_EQ(noDhcp.phase(), WIFI_SCAN_JOIN);
+
+    // DHCP back: the scan gave up by then, the next fast join gets its lease
+    sim::hw().wifiDhcpDown = false;
+    stepWifi(noDhcp, WIFI_JOIN_MS + 100);
+    ASSERT_TRUE(noDhcp.linked());
+    EXPECT_EQ(noDhcp.stats().fastJoins, 2u);
+    stepWifi(noDhcp, sim::hw().wifiDhcpMs + 100);
+    EXPECT_EQ(noDhcp.stats().renews, 1u);
+    EXPECT_EQ(noDhcp.stats().renewMisses, 1u);
+}
+
+TEST(WifiLinkTest, StaleCacheFallsBackToScanAndHotspot) {
+    sim::reset();
+    sim::freezeClock(true);
+    sim::setSerialEcho(false);
+    sim::setWifiConnected(false);
+
+    WifiLink first;
+    first.begin("home", "secret", "batt", "Helmi");
+    ASSERT_TRUE(runWifi(first, 5000));
+
+    // the access point was replaced and moved channel
+    sim::setWifiConnected(false);
+    sim::hw().wifiBssid[5] ^= 0xff;
+    sim::hw().wifiChannel = 11;
+
+    WifiLink moved;
+    moved.begin("home", "secret", "batt", "Helmi");
+    EXPECT_EQ(moved.phase(), WIFI_FAST_JOIN);
+    ASSERT_TRUE(runWifi(moved, 10000));
+    EXPECT_EQ(moved.stats().fastMisses, 1u);
+    EXPECT_EQ(moved.stats().scanJoins, 1u);
+    EXPECT_GE(moved.stats().lastJoinMs, uint32_t(WIFI_FAST_MS));
+    EXPECT_EQ(moved.stats().cacheWrites, 1u);           // the new AP is remembered
+
+    // nothing answers at boot: hotspot once the scan join gives up
+    sim::setWifiConnected(false);
+    sim::hw().wifiInRange = false;
+    WifiLink lost;
+    lost.begin("home", "secret", "batt", "Helmi");
+    EXPECT_FALSE(runWifi(lost, WIFI_FAST_MS + WIFI_JOIN_MS + 100));
+    EXPECT_EQ(lost.phase(), WIFI_HOTSPOT);
+    EXPECT_TRUE(sim::hw().wifiHotspot);
+    EXPECT_EQ(WiFi.getMode(), WIFI_AP_STA);
+
+    // the router comes back late: the station retries behind the hotspot
+    EXPECT_FALSE(runWifi(lost, WIFI_RETRY_MS + WIFI_JOIN_MS));
+    EXPECT_TRUE(sim::hw().wifiHotspot);
+    sim::hw().wifiInRange = true;
+    ASSERT_TRUE(runWifi(lost, WIFI_RETRY_MS + WIFI_JOIN_MS + 100));
+    EXPECT_FALSE(sim::hw().wifiHotspot);
+    EXPECT_EQ(WiFi.getMode(), WIFI_STA);
+}
+
+static std::vector<std::pair<uint16_t, std::string>> labelPushes;
+
+TEST(LabelViewTest, PushesOnlyChangedText) {
+    labelPushes.clear();
+    LabelView labels([](uint16_t id, const char* text) { labelPushes.emplace_back(id, text); });
+
+    EXPECT_TRUE(labels.set(3, "%.1f V", 52.04f));
+    EXPECT_FALSE(labels.set(3, "%.1f V", 51.96f));      // renders the same
+    EXPECT_TRUE(labels.setText(4, "Ok"));
+    EXPECT_TRUE(labels.set(3, "%.1f V", 51.9f));
+    ASSERT_EQ(labelPushes.size(), 3u);
+    EXPECT_EQ(labelPushes[2].second, "51.9 V");
+    EXPECT_EQ(labels.stats().skips, 1u);
+
+    labels.invalidate(4);
+    EXPECT_TRUE(labels.setText(4, "Ok"));
+    EXPECT_FALSE(labels.setText(4, "Ok"));
+
+    // more controls than slots: the extra ones are always pushed
+    for (uint16_t id = 100; id < 100 + UI_LABEL_SLOTS; id++) labels.setText(id, "x");
+    size_t before = labelPushes.size();
+    labels.setText(100 + UI_LABEL_SLOTS - 1, "x");
+    EXPECT_EQ(labelPushes.size(), before + 1);
+
+    // and nothing allocates on the skip path
+    uint32_t allocs = heapAllocs;
+    for (int i = 0; i < 100; i++) labels.set(3, "%.1f V", 51.9f);
+    EXPECT_EQ(heapAllocs, allocs);
+}
+
+static std::atomic<uint32_t> labelSinkCalls(0);
+
+TEST(LabelViewTest, TwoTasksShareTheSlots) {
+    LabelView labels([](uint16_t, const char*) { labelSinkCalls++; });
+
+    // the UI loop and an ESPUI callback adding controls at the same time
+    auto fill = [&](uint16_t first) {
+        for (int pass = 0; pass < 2000; pass++) {
+            for (uint16_t id = first; id < first + UI_LABEL_SLOTS / 2; id++) {
+                labels.setText(id, pass % 2 ? "a" : "b");
+                if (pass % 7 == 0) labels.invalidate(id);
+            }
+        }
+    };
+    std::thread other(fill, UI_LABEL_SLOTS / 2);
+    fill(0);
+    other.join();
+
+    // every control got its own slot, none was lost or shared
+    for (uint16_t id = 0; id < UI_LABEL_SLOTS; id++) labels.setText(id, "c");
+    uint32_t calls = labelSinkCalls;
+    for (uint16_t id = 0; id < UI_LABEL_SLOTS; id++) EXPECT_FALSE(labels.setText(id, "c"));
+    EXPECT_EQ(labelSinkCalls, calls);
+    EXPECT_EQ(labels.stats().pushes + labels.stats().skips, 2u * 2000 * UI_LABEL_SLOTS / 2 + 2 * UI_LABEL_SLOTS);
+}
+
+TEST(StateLogTest, RingKeepsNewestAndRenders) {
+    StateLog log;
+    for (uint32_t i = 0; i < STATE_LOG_SIZE + 5; i++) {
+        log.append(LOG_VSTATE, uint8_t(i % (FULL + 1)), 0, i * 60);
+    }
+    EXPECT_EQ(log.size(), STATE_LOG_SIZE);
+    EXPECT_EQ(log.appended(), uint32_t(STATE_LOG_SIZE + 5));
+    EXPECT_EQ(log.at(0).seconds, uint32_t(STATE_LOG_SIZE + 4) * 60);
+    EXPECT_EQ(log.at(STATE_LOG_SIZE - 1).seconds, 5u * 60);
+
+    log.clear();
+    log.append(LOG_VSTATE, ECO, LOVV, 120);
+    log.append(LOG_TSTATE, ECO_READY, ECO_TEMP, 185);
+    log.append(LOG_VSTATE, BOOST, ECO, 600);
+
+    char names[64], times[32];
+    EXPECT_EQ(log.render(names, sizeof(names), times, sizeof(times), 2), 2);
+    EXPECT_STREQ(names, "Eco Temp Ready\nBoost Voltage\n");
+    EXPECT_STREQ(times, "3 min\n10 min\n");
+
+    // whole lines only when the buffer is short
+    char small[20];
+    EXPECT_EQ(log.render(small, sizeof(small), times, sizeof(times), 3), 1);
+    EXPECT_STREQ(small, "Eco Voltage\n");
+}
+
+TEST_F(BatteryTest, ControlStepLogsStateChanges) {
+    batt.battery.temperature = 25;
+    batt.battery.soc.predict(millis(), false, 0, batt.battery.capct);
+    batt.battery.soc.correct(6000, 100);
+
+    uint32_t version = batt.getStateLogVersion();
+    batt.battery.stateMachine = millis() - 2500;
+    batt.handleBatteryControl();
+    EXPECT_NE(batt.getStateLogVersion(), version);
+
+    StateLog log = batt.getStateLog();
+    ASSERT_GE(log.size(), 1);
+    EXPECT_EQ(log.at(0).kind, LOG_TSTATE);
+    EXPECT_EQ(log.at(0).state, batt.battery.tState);
+
+    // nothing changed, nothing logged
+    version = batt.getStateLogVersion();
+    uint8_t size = log.size();
+    sim::advanceMillis(2500);
+    batt.handleBatteryControl();
+    EXPECT_EQ(batt.getStateLogVersion(), version);
+    EXPECT_EQ(batt.getStateLog().size(), size);
+
+    batt.battery.temperature = 45;
+    sim::advanceMillis(2500);
+    batt.handleBatteryControl();
+    log = batt.getStateLog();
+    EXPECT_EQ(log.at(0).state, TEMP_WARNING);
+    EXPECT_EQ(log.at(0).previous, log.at(1).state);
+}
+
+static uint32_t journalSeconds = 0;
+
+static void journalEvents(Journal& j, uint16_t n) {
+    for (uint16_t i = 0; i < n; i++) {
+        j.log(JRN_CHARGER, i & 1, 52000 + i, ++journalSeconds);
+        if (i % 16 == 15) j.service();
+    }
+    j.service();
+}
+
+TEST(JournalTest, SurvivesRebootsAndRotates) {
+    sim::reset();
+    sim::freezeClock(true);
+    sim::setSerialEcho(false);
+
+    {
+        Journal j;
+        ASSERT_TRUE(j.begin(1, 0));
+        EXPECT_EQ(j.stats().boot, 0);
+        journalEvents(j, 10);
+        EXPECT_EQ(j.stats().written, 11u);              // boot record + 10
+    }
+
+    // reboot: the new instance carries on from the flash contents
+    Journal j;
+    ASSERT_TRUE(j.begin(4, 0));
+    EXPECT_EQ(j.stats().recovered, 11u);
+    EXPECT_EQ(j.stats().boot, 1);
+
+    journalRecord recs[3];
+    ASSERT_EQ(j.newest(recs, 3), 3);
+    EXPECT_EQ(recs[0].type, JRN_BOOT);
+    EXPECT_EQ(recs[0].arg, 4);
+    EXPECT_EQ(recs[0].seq, 12u);
+    EXPECT_EQ(recs[1].type, JRN_CHARGER);
+    EXPECT_EQ(recs[1].value, 52009);
+    EXPECT_EQ(recs[1].boot, 0);
+
+    // more than the partition share holds: the oldest segment goes
+    journalEvents(j, JOURNAL_SEGMENTS * JOURNAL_SEGMENT_RECORDS);
+    EXPECT_GE(j.stats().rotations, uint32_t(JOURNAL_SEGMENTS));
+    EXPECT_LE(LittleFS.usedBytes(), size_t(JOURNAL_SEGMENTS * JOURNAL_SEGMENT_RECORDS * sizeof(journalRecord)));
+
+    journalRecord all[JOURNAL_SEGMENTS * JOURNAL_SEGMENT_RECORDS];
+    uint16_t n = j.newest(all, JOURNAL_SEGMENTS * JOURNAL_SEGMENT_RECORDS);
+    EXPECT_GT(n, (JOURNAL_SEGMENTS - 1) * JOURNAL_SEGMENT_RECORDS);
+    for (uint16_t i = 1; i < n; i++) ASSERT_EQ(all[i].seq + 1, all[i - 1].seq);
+
+    // a sequence bound pages through the same records
+    ASSERT_EQ(j.newest(recs, 2, all[4].seq), 2);
+    EXPECT_EQ(recs[0].seq, all[5].seq);
+}
+
+TEST(JournalTest, TornTailIsSkippedAtBoot) {
+    sim::reset();
+    sim::freezeClock(true);
+    sim::setSerialEcho(false);
+
+    {
+        Journal j;
+        ASSERT_TRUE(j.begin(1, 0));
+        journalEvents(j, 5);
+    }
+
+    // power lost halfway through the last record
+    std::string* seg = sim::fsFile(JOURNAL_DIR "/seg0.bin");
+    ASSERT_NE(seg, nullptr);
+    sim::fsTruncate(JOURNAL_DIR "/seg0.bin", seg->size() - sizeof(journalRecord) / 2);
+
+    Journal j;
+    ASSERT_TRUE(j.begin(1, 0));
+    EXPECT_EQ(j.stats().recovered, 5u);
+    EXPECT_EQ(j.stats().torn, 1u);
+    journalEvents(j, 3);
+
+    journalRecord recs[16];
+    uint16_t n = j.newest(recs, 16);
+    ASSERT_EQ(n, 9);                                    // 5 + boot + 3, the torn one is gone
+    EXPECT_EQ(recs[3].type, JRN_BOOT);
+    EXPECT_EQ(recs[4].seq, 5u);
+    EXPECT_NE(sim::fsFile(JOURNAL_DIR "/seg1.bin"), nullptr);   // carried on in the next segment
+}
+
+TEST(JournalTest, FailedRotationIsRetried) {
+    sim::reset();
+    sim::freezeClock(true);
+    sim::setSerialEcho(false);
+
+    Journal j;
+    ASSERT_TRUE(j.begin(1, 0));
+    journalEvents(j, JOURNAL_SEGMENT_RECORDS - 1);      // segment 0 full with the boot record
+
+    sim::hw().fsOpenFails = 2;                          // the next segment can not be opened twice
+    journalEvents(j, 5);
+    EXPECT_EQ(j.stats().failed, 2u);
+    EXPECT_EQ(j.stats().rotations, 1u);                 // one move, the retries stay on it
+
+    journalRecord recs[4];
+    ASSERT_EQ(j.newest(recs, 4), 4);
+    EXPECT_EQ(recs[0].value, 52004);
+    EXPECT_EQ(recs[2].value, 52002);
+    EXPECT_EQ(recs[3].seq, uint32_t(JOURNAL_SEGMENT_RECORDS));  // the last one in segment 0
+    std::string* seg = sim::fsFile(JOURNAL_DIR "/seg1.bin");
+    ASSERT_NE(seg, nullptr);
+    EXPECT_EQ(seg->size(), 3 * sizeof(journalRecord));
+}
+
+TEST(JournalTest, LogNeverTouchesFlash) {
+    sim::reset();
+    sim::freezeClock(true);
+    sim::setSerialEcho(false);
+
+    Journal j;
+    ASSERT_TRUE(j.begin(1, 0));
+    uint32_t bytes = sim::hw().fsBytesWritten;
+
+    for (int i = 0; i < JOURNAL_QUEUE + 8; i++) j.log(JRN_VSTATE, ECO, LOVV, 1);
+    EXPECT_EQ(sim::hw().fsBytesWritten, bytes);         // queued only
+
+    // routine records wait for the flush interval, losses are recorded
+    uint32_t flushes = j.stats().flushes;
+    j.service();
+    EXPECT_EQ(j.stats().written, 1u + JOURNAL_QUEUE - 1 + 1);
+    EXPECT_EQ(j.stats().dropped, 9u);
+    EXPECT_EQ(j.stats().flushes, flushes + 1);          // the drop record is urgent
+
+    j.log(JRN_TSTATE, ECO_TEMP, COLD, 2);
+    j.service();
+    EXPECT_EQ(j.stats().flushes, flushes + 1);
+    sim::advanceMillis(JOURNAL_FLUSH_MS);
+    j.service();
+    EXPECT_EQ(j.stats().flushes, flushes + 2);
+}
+
+TEST_F(BatteryTest, ControlEventsReachTheJournal) {
+    ASSERT_TRUE(batt.startJournal(1));
+    batt.battery.temperature = 25;
+    batt.battery.soc.predict(millis(), false, 0, batt.battery.capct);
+    batt.battery.soc.correct(3000, 100);
+    batt.battery.stateMachine = millis() - 2500;
+    batt.handleBatteryControl();
+    batt.commsLoop();
+
+    journalRecord recs[8];
+    uint16_t n = batt.readJournal(recs, 8);
+    ASSERT_GE(n, 2);
+    bool charger = false, tState = false;
+    for (uint16_t i = 0; i < n; i++) {
+        charger |= recs[i].type == JRN_CHARGER && recs[i].arg == 1;
+        tState |= recs[i].type == JRN_TSTATE && recs[i].arg == batt.battery.tState;
+    }
+    EXPECT_TRUE(charger);
+    EXPECT_TRUE(tState);
+}
+
+TEST_F(BatteryTest, JournalDumpIsNotShiftedByNewRecords) {
+    batt.preferences.begin("btry", false);
+    batt.preferences.putBool("mqtten", true);
+    batt.preferences.end();
+    batt.battery.mqtt.setup = false;
+    for (int i = 0; i < 3 && batt.battery.link.state != LINK_UP; i++) {
+        sim::advanceMillis(60001);
+        batt.handleMqtt();
+    }
+    ASSERT_EQ(batt.battery.link.state, LINK_UP);
+    ASSERT_TRUE(batt.startJournal(1));
+
+    batt.battery.soc.predict(millis(), false, 0, batt.battery.capct);
+    batt.battery.soc.correct(3000, 100);
+    auto event = [&] {                          // one tState change, journalled
+        batt.battery.temperature = batt.battery.temperature == 25 ? 45 : 25;
+        batt.battery.stateMachine = millis() - 2500;
+        batt.handleBatteryControl();
+        batt.commsLoop();
+    };
+    for (int i = 0; i < 12; i++) event();
+
+    journalRecord newest;
+    ASSERT_EQ(batt.readJournal(&newest, 1), 1);
+    ASSERT_TRUE(sim::mqttDeliver("battery/Onni/set/journal", "10"));
+    sim::hw().published.clear();
+
+    // a record lands between every page
+    for (int i = 0; i < 6; i++) {
+        batt.handleMqtt();
+        event();
+    }
+    std::vector<uint32_t> seqs;
+    for (const auto& p : sim::hw().published) {
+        if (p.topic == "battery/Onni/journal") seqs.push_back(strtoul(p.payload.c_str() + 7, nullptr, 10));
+    }
+    ASSERT_EQ(seqs.size(), 10u);
+    for (size_t i = 0; i < seqs.size(); i++) EXPECT_EQ(seqs[i], newest.seq - i);
+}